@@ -18,6 +18,7 @@
 #include <errno.h>
 
 #include "gpio.h"
+#include "probe.h"
 
 #define P_PATH_MAX  256
 /* Delay between checks for successful GPIO export (100ms) */
@@ -139,9 +140,13 @@ int gpio_close(gpio_t *gpio) {
 
 int gpio_read(gpio_t *gpio, bool *value) {
     char buf[2];
+    ssize_t ret;
 
     /* Read fd */
-    if (read(gpio->fd, buf, 2) < 0)
+    PERIPHERY_PROBE1(periphery, gpio_read_start, gpio->fd);
+    ret = read(gpio->fd, buf, 2);
+    PERIPHERY_PROBE3(periphery, gpio_read_done, gpio->fd, ret < 0 ? errno : 0, ret > 0 ? buf[0] - '0' : -1);
+    if (ret < 0)
         return _gpio_error(gpio, GPIO_ERROR_IO, errno, "Reading GPIO 'value'");
 
     /* Rewind */
@@ -185,10 +190,13 @@ int gpio_poll(gpio_t *gpio, int timeout_ms) {
     if (lseek(gpio->fd, 0, SEEK_END) < 0)
         return _gpio_error(gpio, GPIO_ERROR_IO, errno, "Seeking to end of GPIO 'value'");
 
-    /* Poll */
+    /* Poll, done carries 1 on an edge and 0 on a timeout */
     fds[0].fd = gpio->fd;
     fds[0].events = POLLPRI | POLLERR;
-    if ((ret = poll(fds, 1, timeout_ms)) < 0)
+    PERIPHERY_PROBE2(periphery, gpio_poll_start, gpio->fd, timeout_ms);
+    ret = poll(fds, 1, timeout_ms);
+    PERIPHERY_PROBE3(periphery, gpio_poll_done, gpio->fd, ret < 0 ? errno : 0, ret > 0);
+    if (ret < 0)
         return _gpio_error(gpio, GPIO_ERROR_IO, errno, "Polling GPIO 'value'");
 
     /* GPIO edge interrupt occurred */
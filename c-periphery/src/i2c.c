@@ -21,6 +21,7 @@
 #include <linux/i2c-dev.h>
 
 #include "i2c.h"
+#include "probe.h"
 
 static int _i2c_error(struct i2c_handle *i2c, int code, int c_errno, const char *fmt, ...) {
     va_list ap;
@@ -67,14 +68,18 @@ int i2c_open(i2c_t *i2c, const char *path) {
 
 int i2c_transfer(i2c_t *i2c, struct i2c_msg *msgs, size_t count) {
     struct i2c_rdwr_ioctl_data i2c_rdwr_data;
+    int ret;
 
     /* Prepare I2C transfer structure */
     memset(&i2c_rdwr_data, 0, sizeof(struct i2c_rdwr_ioctl_data));
     i2c_rdwr_data.msgs = msgs;
     i2c_rdwr_data.nmsgs = count;
 
-    /* Transfer */
-    if (ioctl(i2c->fd, I2C_RDWR, &i2c_rdwr_data) < 0)
+    /* Transfer, the messages are left to the tracer to look into */
+    PERIPHERY_PROBE4(periphery, i2c_transfer_start, i2c->fd, count ? msgs[0].addr : 0, count, msgs);
+    ret = ioctl(i2c->fd, I2C_RDWR, &i2c_rdwr_data);
+    PERIPHERY_PROBE2(periphery, i2c_transfer_done, i2c->fd, ret < 0 ? errno : 0);
+    if (ret < 0)
         return _i2c_error(i2c, I2C_ERROR_TRANSFER, errno, "I2C transfer");
 
     return 0;
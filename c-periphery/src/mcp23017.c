@@ -0,0 +1,408 @@
+/*
+ * c-periphery
+ * https://github.com/vsergeev/c-periphery
+ * License: MIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+
+#include "mcp23017.h"
+
+/* Register pairs per I2C_RDWR call in byte mode, each a write and a read */
+#define MCP23017_PAIRS_PER_TRANSFER     (I2C_RDWR_IOCTL_MAX_MSGS / 2)
+
+static int _mcp23017_error(struct mcp23017_handle *mcp, int code, int c_errno, const char *fmt, ...) {
+    va_list ap;
+
+    mcp->error.c_errno = c_errno;
+
+    va_start(ap, fmt);
+    vsnprintf(mcp->error.errmsg, sizeof(mcp->error.errmsg), fmt, ap);
+    va_end(ap);
+
+    /* Tack on strerror() and errno */
+    if (c_errno) {
+        char buf[64];
+        strerror_r(c_errno, buf, sizeof(buf));
+        snprintf(mcp->error.errmsg+strlen(mcp->error.errmsg), sizeof(mcp->error.errmsg)-strlen(mcp->error.errmsg), ": %s [errno %d]", buf, c_errno);
+    }
+
+    return code;
+}
+
+static int _mcp23017_bank(mcp23017_t *mcp) {
+    return (mcp->shadow[MCP23017_IOCON][MCP23017_PORT_A] & MCP23017_IOCON_BANK) != 0;
+}
+
+/* SEQOP clear: the address pointer increments across a burst */
+static int _mcp23017_sequential(mcp23017_t *mcp) {
+    return (mcp->shadow[MCP23017_IOCON][MCP23017_PORT_A] & MCP23017_IOCON_SEQOP) == 0;
+}
+
+static int _mcp23017_transfer(mcp23017_t *mcp, struct i2c_msg *msgs, size_t count, uint8_t reg_addr) {
+    for (size_t i = 0; i < count; i++)
+        msgs[i].addr = mcp->addr;
+
+    if (i2c_transfer(mcp->i2c, msgs, count) < 0)
+        return _mcp23017_error(mcp, MCP23017_ERROR_TRANSFER, i2c_errno(mcp->i2c), "Accessing register 0x%02x of MCP23017 0x%02x", reg_addr, mcp->addr);
+
+    return 0;
+}
+
+/* Read registers first..first+nregs-1 of both ports, in as few transfers
+ * as the current IOCON layout allows */
+static int _mcp23017_read_range(mcp23017_t *mcp, enum mcp23017_reg first, size_t nregs, uint8_t values[][2]) {
+    struct i2c_msg msgs[MCP23017_PAIRS_PER_TRANSFER * 2];
+    uint8_t addrs[MCP23017_PAIRS_PER_TRANSFER];
+    uint8_t buf[2 * MCP23017_NUM_REGS];
+    int ret;
+
+    if (_mcp23017_sequential(mcp)) {
+        size_t nblocks = _mcp23017_bank(mcp) ? 2 : 1;
+        size_t len = 2 * nregs / nblocks;
+
+        /* BANK=0 interleaves the ports, BANK=1 has one block per port */
+        for (size_t b = 0; b < nblocks; b++) {
+            addrs[b] = mcp23017_reg_addr(mcp, first, (enum mcp23017_port)b);
+            msgs[2 * b].flags = 0;
+            msgs[2 * b].len = 1;
+            msgs[2 * b].buf = &addrs[b];
+            msgs[2 * b + 1].flags = I2C_M_RD;
+            msgs[2 * b + 1].len = len;
+            msgs[2 * b + 1].buf = &buf[b * len];
+        }
+
+        if ((ret = _mcp23017_transfer(mcp, msgs, 2 * nblocks, addrs[0])) < 0)
+            return ret;
+
+        for (size_t r = 0; r < nregs; r++) {
+            for (size_t p = 0; p < 2; p++)
+                values[r][p] = (nblocks == 1) ? buf[2 * r + p] : buf[p * nregs + r];
+        }
+    } else {
+        /* Byte mode, one register address per read */
+        for (size_t i = 0; i < 2 * nregs; i += MCP23017_PAIRS_PER_TRANSFER) {
+            size_t n = (2 * nregs - i < MCP23017_PAIRS_PER_TRANSFER) ? 2 * nregs - i : MCP23017_PAIRS_PER_TRANSFER;
+
+            for (size_t k = 0; k < n; k++) {
+                size_t r = (i + k) / 2, p = (i + k) % 2;
+
+                addrs[k] = mcp23017_reg_addr(mcp, (enum mcp23017_reg)(first + r), (enum mcp23017_port)p);
+                msgs[2 * k].flags = 0;
+                msgs[2 * k].len = 1;
+                msgs[2 * k].buf = &addrs[k];
+                msgs[2 * k + 1].flags = I2C_M_RD;
+                msgs[2 * k + 1].len = 1;
+                msgs[2 * k + 1].buf = &values[r][p];
+            }
+
+            if ((ret = _mcp23017_transfer(mcp, msgs, 2 * n, addrs[0])) < 0)
+                return ret;
+        }
+    }
+
+    for (size_t r = 0; r < nregs; r++) {
+        mcp->shadow[first + r][MCP23017_PORT_A] = values[r][MCP23017_PORT_A];
+        mcp->shadow[first + r][MCP23017_PORT_B] = values[r][MCP23017_PORT_B];
+    }
+
+    return 0;
+}
+
+/* Write one register of both ports in one transfer */
+static int _mcp23017_write_both(mcp23017_t *mcp, enum mcp23017_reg reg, uint8_t value_a, uint8_t value_b) {
+    struct i2c_msg msgs[2];
+    uint8_t buf[2][3];
+    size_t count;
+    int ret;
+
+    if (!_mcp23017_bank(mcp)) {
+        /* Adjacent registers: incremented in sequential mode, toggled
+         * between A and B in byte mode. Either way one burst. */
+        buf[0][0] = mcp23017_reg_addr(mcp, reg, MCP23017_PORT_A);
+        buf[0][1] = value_a;
+        buf[0][2] = value_b;
+        msgs[0].flags = 0;
+        msgs[0].len = 3;
+        msgs[0].buf = buf[0];
+        count = 1;
+    } else {
+        for (size_t p = 0; p < 2; p++) {
+            buf[p][0] = mcp23017_reg_addr(mcp, reg, (enum mcp23017_port)p);
+            buf[p][1] = p ? value_b : value_a;
+            msgs[p].flags = 0;
+            msgs[p].len = 2;
+            msgs[p].buf = buf[p];
+        }
+        count = 2;
+    }
+
+    if ((ret = _mcp23017_transfer(mcp, msgs, count, buf[0][0])) < 0)
+        return ret;
+
+    mcp->shadow[reg][MCP23017_PORT_A] = value_a;
+    mcp->shadow[reg][MCP23017_PORT_B] = value_b;
+    /* Writing GPIO writes the output latch */
+    if (reg == MCP23017_GPIO) {
+        mcp->shadow[MCP23017_OLAT][MCP23017_PORT_A] = value_a;
+        mcp->shadow[MCP23017_OLAT][MCP23017_PORT_B] = value_b;
+    }
+
+    return 0;
+}
+
+/* Messages writing registers first..first+nregs-1 of both ports from the
+ * shadow, in the current IOCON layout. How many were added to msgs */
+static size_t _mcp23017_range_msgs(mcp23017_t *mcp, enum mcp23017_reg first, size_t nregs,
+                                   struct i2c_msg *msgs, uint8_t buf[][1 + 2 * MCP23017_NUM_REGS]) {
+    size_t count = 0;
+
+    if (_mcp23017_sequential(mcp) && !_mcp23017_bank(mcp)) {
+        /* Ports interleaved, one burst */
+        buf[0][0] = mcp23017_reg_addr(mcp, first, MCP23017_PORT_A);
+        memcpy(&buf[0][1], mcp->shadow[first], 2 * nregs);
+        msgs[0].len = 1 + 2 * nregs;
+        count = 1;
+    } else if (_mcp23017_sequential(mcp)) {
+        /* One block per port, one burst each */
+        for (size_t p = 0; p < 2; p++) {
+            buf[p][0] = mcp23017_reg_addr(mcp, first, (enum mcp23017_port)p);
+            for (size_t r = 0; r < nregs; r++)
+                buf[p][1 + r] = mcp->shadow[first + r][p];
+            msgs[p].len = 1 + nregs;
+        }
+        count = 2;
+    } else {
+        /* Byte mode, one message per register */
+        for (size_t r = 0; r < nregs; r++) {
+            for (size_t p = 0; p < 2; p++) {
+                buf[count][0] = mcp23017_reg_addr(mcp, (enum mcp23017_reg)(first + r), (enum mcp23017_port)p);
+                buf[count][1] = mcp->shadow[first + r][p];
+                msgs[count].len = 2;
+                count++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        msgs[i].flags = 0;
+        msgs[i].buf = buf[i];
+    }
+
+    return count;
+}
+
+int mcp23017_open(mcp23017_t *mcp, i2c_t *i2c, uint16_t addr) {
+    memset(mcp, 0, sizeof(struct mcp23017_handle));
+
+    if (i2c == NULL || addr > 0x7f)
+        return _mcp23017_error(mcp, MCP23017_ERROR_ARG, 0, "Invalid I2C handle or address 0x%02x", addr);
+
+    mcp->i2c = i2c;
+    mcp->addr = addr;
+
+    /* Power-on reset state: all inputs, IOCON.BANK = 0 */
+    mcp->shadow[MCP23017_IODIR][MCP23017_PORT_A] = 0xff;
+    mcp->shadow[MCP23017_IODIR][MCP23017_PORT_B] = 0xff;
+
+    return 0;
+}
+
+int mcp23017_read(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port, uint8_t *value) {
+    struct i2c_msg msgs[2];
+    uint8_t addr;
+    int ret;
+
+    if (reg >= MCP23017_NUM_REGS || port > MCP23017_PORT_B)
+        return _mcp23017_error(mcp, MCP23017_ERROR_ARG, 0, "Invalid register %d port %d", reg, port);
+
+    addr = mcp23017_reg_addr(mcp, reg, port);
+
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &addr;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = 1;
+    msgs[1].buf = value;
+
+    if ((ret = _mcp23017_transfer(mcp, msgs, 2, addr)) < 0)
+        return ret;
+
+    mcp->shadow[reg][port] = *value;
+
+    return 0;
+}
+
+int mcp23017_write(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port, uint8_t value) {
+    struct i2c_msg msgs[1];
+    uint8_t buf[2];
+    int ret;
+
+    if (reg >= MCP23017_NUM_REGS || port > MCP23017_PORT_B)
+        return _mcp23017_error(mcp, MCP23017_ERROR_ARG, 0, "Invalid register %d port %d", reg, port);
+
+    /* IOCON changes the register layout under us */
+    if (reg == MCP23017_IOCON)
+        return mcp23017_set_iocon(mcp, value);
+
+    buf[0] = mcp23017_reg_addr(mcp, reg, port);
+    buf[1] = value;
+
+    msgs[0].flags = 0;
+    msgs[0].len = 2;
+    msgs[0].buf = buf;
+
+    if ((ret = _mcp23017_transfer(mcp, msgs, 1, buf[0])) < 0)
+        return ret;
+
+    mcp->shadow[reg][port] = value;
+    if (reg == MCP23017_GPIO)
+        mcp->shadow[MCP23017_OLAT][port] = value;
+
+    return 0;
+}
+
+int mcp23017_write_pair(mcp23017_t *mcp, enum mcp23017_reg reg, uint8_t value_a, uint8_t value_b) {
+    if (reg >= MCP23017_NUM_REGS)
+        return _mcp23017_error(mcp, MCP23017_ERROR_ARG, 0, "Invalid register %d", reg);
+
+    if (reg == MCP23017_IOCON)
+        return mcp23017_set_iocon(mcp, value_a);
+
+    return _mcp23017_write_both(mcp, reg, value_a, value_b);
+}
+
+int mcp23017_update(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port, uint8_t mask, uint8_t value) {
+    uint8_t v;
+
+    if (reg >= MCP23017_NUM_REGS || port > MCP23017_PORT_B)
+        return _mcp23017_error(mcp, MCP23017_ERROR_ARG, 0, "Invalid register %d port %d", reg, port);
+
+    /* GPIO reads back the pins, the latch is what we wrote */
+    if (reg == MCP23017_GPIO)
+        reg = MCP23017_OLAT;
+
+    v = (mcp->shadow[reg][port] & ~mask) | (value & mask);
+    if (v == mcp->shadow[reg][port])
+        return 0;
+
+    return mcp23017_write(mcp, reg, port, v);
+}
+
+int mcp23017_set_iocon(mcp23017_t *mcp, uint8_t iocon) {
+    struct i2c_msg msgs[1];
+    uint8_t buf[2];
+    int ret;
+
+    buf[0] = mcp23017_reg_addr(mcp, MCP23017_IOCON, MCP23017_PORT_A);
+    buf[1] = iocon;
+
+    msgs[0].flags = 0;
+    msgs[0].len = 2;
+    msgs[0].buf = buf;
+
+    if ((ret = _mcp23017_transfer(mcp, msgs, 1, buf[0])) < 0)
+        return ret;
+
+    /* IOCONA and IOCONB are the same register */
+    mcp->shadow[MCP23017_IOCON][MCP23017_PORT_A] = iocon;
+    mcp->shadow[MCP23017_IOCON][MCP23017_PORT_B] = iocon;
+
+    return 0;
+}
+
+int mcp23017_read_events(mcp23017_t *mcp, struct mcp23017_events *events) {
+    uint8_t values[3][2];
+    int ret;
+
+    /* INTF, INTCAP and GPIO are adjacent in both layouts */
+    if ((ret = _mcp23017_read_range(mcp, MCP23017_INTF, 3, values)) < 0)
+        return ret;
+
+    memcpy(events->intf, values[0], 2);
+    memcpy(events->intcap, values[1], 2);
+    memcpy(events->gpio, values[2], 2);
+
+    return 0;
+}
+
+int mcp23017_refresh(mcp23017_t *mcp) {
+    uint8_t values[MCP23017_NUM_REGS][2];
+    uint8_t iocon;
+    int ret;
+
+    /* IOCON first, in the layout we believe the device is in, as the
+     * sequential mode setting decides how the rest is read */
+    if ((ret = mcp23017_read(mcp, MCP23017_IOCON, MCP23017_PORT_A, &iocon)) < 0)
+        return ret;
+    mcp->shadow[MCP23017_IOCON][MCP23017_PORT_B] = iocon;
+
+    /* Configuration registers, then the output latch. INTF, INTCAP and
+     * GPIO are left alone, reading them clears a pending interrupt. */
+    if ((ret = _mcp23017_read_range(mcp, MCP23017_IODIR, MCP23017_GPPU + 1, values)) < 0)
+        return ret;
+
+    return _mcp23017_read_range(mcp, MCP23017_OLAT, 1, values);
+}
+
+int mcp23017_restore(mcp23017_t *mcp) {
+    struct i2c_msg msgs[1 + 2 * (MCP23017_GPPU + 2)];
+    uint8_t buf[1 + 2 * (MCP23017_GPPU + 2)][1 + 2 * MCP23017_NUM_REGS];
+    size_t count = 1;
+
+    /* A device that lost its configuration is back in the BANK = 0
+     * layout: IOCON first at its power-on address, which sets the layout
+     * the shadow is in for the rest of the burst. With a BANK = 1 shadow
+     * and a device that kept it, that address is OLATA, rewritten right
+     * after */
+    buf[0][0] = (MCP23017_IOCON << 1) | MCP23017_PORT_A;
+    buf[0][1] = mcp->shadow[MCP23017_IOCON][MCP23017_PORT_A];
+    msgs[0].flags = 0;
+    msgs[0].len = 2;
+    msgs[0].buf = buf[0];
+
+    /* Then the output latch, so pins that become outputs come up in
+     * their commanded state, and the configuration registers. All of it
+     * in one I2C_RDWR call */
+    count += _mcp23017_range_msgs(mcp, MCP23017_OLAT, 1, &msgs[count], &buf[count]);
+    count += _mcp23017_range_msgs(mcp, MCP23017_IODIR, MCP23017_GPPU + 1, &msgs[count], &buf[count]);
+
+    return _mcp23017_transfer(mcp, msgs, count, buf[0][0]);
+}
+
+int mcp23017_close(mcp23017_t *mcp) {
+    mcp->i2c = NULL;
+
+    return 0;
+}
+
+uint8_t mcp23017_shadow(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port) {
+    return mcp->shadow[reg][port];
+}
+
+uint8_t mcp23017_reg_addr(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port) {
+    if (_mcp23017_bank(mcp))
+        return (port << 4) | reg;
+
+    return (reg << 1) | port;
+}
+
+int mcp23017_tostring(mcp23017_t *mcp, char *str, size_t len) {
+    return snprintf(str, len, "MCP23017 (addr=0x%02x, bank=%d, seqop=%d)", mcp->addr, _mcp23017_bank(mcp), !_mcp23017_sequential(mcp));
+}
+
+const char *mcp23017_errmsg(mcp23017_t *mcp) {
+    return mcp->error.errmsg;
+}
+
+int mcp23017_errno(mcp23017_t *mcp) {
+    return mcp->error.c_errno;
+}
+
@@ -0,0 +1,101 @@
+/*
+ * c-periphery
+ * https://github.com/vsergeev/c-periphery
+ * License: MIT
+ */
+
+#ifndef _PERIPHERY_MCP23017_H
+#define _PERIPHERY_MCP23017_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2c.h"
+
+enum mcp23017_error_code {
+    MCP23017_ERROR_ARG          = -1, /* Invalid arguments */
+    MCP23017_ERROR_TRANSFER     = -2, /* I2C transfer */
+};
+
+/* Registers, each with an A and a B port. The order matches the device,
+ * so the same enum addresses both IOCON.BANK layouts. */
+enum mcp23017_reg {
+    MCP23017_IODIR,
+    MCP23017_IPOL,
+    MCP23017_GPINTEN,
+    MCP23017_DEFVAL,
+    MCP23017_INTCON,
+    MCP23017_IOCON,
+    MCP23017_GPPU,
+    MCP23017_INTF,
+    MCP23017_INTCAP,
+    MCP23017_GPIO,
+    MCP23017_OLAT,
+    MCP23017_NUM_REGS,
+};
+
+enum mcp23017_port {
+    MCP23017_PORT_A,
+    MCP23017_PORT_B,
+};
+
+/* IOCON bits */
+#define MCP23017_IOCON_BANK     0x80
+#define MCP23017_IOCON_MIRROR   0x40
+#define MCP23017_IOCON_SEQOP    0x20
+#define MCP23017_IOCON_DISSLW   0x10
+#define MCP23017_IOCON_HAEN     0x08
+#define MCP23017_IOCON_ODR      0x04
+#define MCP23017_IOCON_INTPOL   0x02
+
+typedef struct mcp23017_handle {
+    i2c_t *i2c;
+    uint16_t addr;
+
+    /* Last value written to or read from each register */
+    uint8_t shadow[MCP23017_NUM_REGS][2];
+
+    struct {
+        int c_errno;
+        char errmsg[96];
+    } error;
+} mcp23017_t;
+
+/* Interrupt state, as read by mcp23017_read_events() */
+struct mcp23017_events {
+    uint8_t intf[2];
+    uint8_t intcap[2];
+    uint8_t gpio[2];
+};
+
+/* Primary Functions */
+int mcp23017_open(mcp23017_t *mcp, i2c_t *i2c, uint16_t addr);
+int mcp23017_read(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port, uint8_t *value);
+int mcp23017_write(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port, uint8_t value);
+int mcp23017_write_pair(mcp23017_t *mcp, enum mcp23017_reg reg, uint8_t value_a, uint8_t value_b);
+int mcp23017_update(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port, uint8_t mask, uint8_t value);
+int mcp23017_set_iocon(mcp23017_t *mcp, uint8_t iocon);
+int mcp23017_read_events(mcp23017_t *mcp, struct mcp23017_events *events);
+int mcp23017_refresh(mcp23017_t *mcp);
+int mcp23017_restore(mcp23017_t *mcp);
+int mcp23017_close(mcp23017_t *mcp);
+
+/* Miscellaneous */
+uint8_t mcp23017_shadow(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port);
+uint8_t mcp23017_reg_addr(mcp23017_t *mcp, enum mcp23017_reg reg, enum mcp23017_port port);
+int mcp23017_tostring(mcp23017_t *mcp, char *str, size_t len);
+
+/* Error Handling */
+int mcp23017_errno(mcp23017_t *mcp);
+const char *mcp23017_errmsg(mcp23017_t *mcp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
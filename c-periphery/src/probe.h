@@ -0,0 +1,43 @@
+/*
+ * c-periphery
+ * https://github.com/vsergeev/c-periphery
+ * License: MIT
+ */
+
+#ifndef _PERIPHERY_PROBE_H
+#define _PERIPHERY_PROBE_H
+
+/*
+ * Statically defined tracepoints (USDT), for bpftrace, perf or SystemTap:
+ *
+ *     bpftrace -e 'usdt:/usr/local/bin/iotool:periphery:i2c_transfer_start { ... }'
+ *
+ * A probe is a single nop in the code until a tracer attaches to it.
+ * Calls come in _start and _done pairs, the time between the two is the
+ * duration of the call; _done carries 0 or the errno of the failure.
+ *
+ * Built in when <sys/sdt.h> (systemtap-sdt-dev) is around and
+ * PERIPHERY_NO_PROBES is not defined, empty otherwise.
+ */
+
+#if !defined(PERIPHERY_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PERIPHERY_PROBES 1
+#endif
+#endif
+
+#ifdef PERIPHERY_PROBES
+#define PERIPHERY_PROBE1(provider, name, a)             DTRACE_PROBE1(provider, name, a)
+#define PERIPHERY_PROBE2(provider, name, a, b)          DTRACE_PROBE2(provider, name, a, b)
+#define PERIPHERY_PROBE3(provider, name, a, b, c)       DTRACE_PROBE3(provider, name, a, b, c)
+#define PERIPHERY_PROBE4(provider, name, a, b, c, d)    DTRACE_PROBE4(provider, name, a, b, c, d)
+#else
+#define PERIPHERY_PROBE1(provider, name, a)             do { } while (0)
+#define PERIPHERY_PROBE2(provider, name, a, b)          do { } while (0)
+#define PERIPHERY_PROBE3(provider, name, a, b, c)       do { } while (0)
+#define PERIPHERY_PROBE4(provider, name, a, b, c, d)    do { } while (0)
+#endif
+
+#endif
+
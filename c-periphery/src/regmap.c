@@ -0,0 +1,387 @@
+/*
+ * c-periphery
+ * https://github.com/vsergeev/c-periphery
+ * License: MIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+
+#include "regmap.h"
+
+static int _regmap_error(struct regmap_handle *map, int code, int c_errno, const char *fmt, ...) {
+    va_list ap;
+
+    map->error.c_errno = c_errno;
+
+    va_start(ap, fmt);
+    vsnprintf(map->error.errmsg, sizeof(map->error.errmsg), fmt, ap);
+    va_end(ap);
+
+    /* Tack on strerror() and errno */
+    if (c_errno) {
+        char buf[64];
+        strerror_r(c_errno, buf, sizeof(buf));
+        snprintf(map->error.errmsg+strlen(map->error.errmsg), sizeof(map->error.errmsg)-strlen(map->error.errmsg), ": %s [errno %d]", buf, c_errno);
+    }
+
+    return code;
+}
+
+#define _BIT_GET(set, i)    (((set)[(i) / 8] >> ((i) % 8)) & 1)
+#define _BIT_SET(set, i)    ((set)[(i) / 8] |= (uint8_t)(1 << ((i) % 8)))
+#define _BIT_CLR(set, i)    ((set)[(i) / 8] &= (uint8_t)~(1 << ((i) % 8)))
+
+/* Index of the register at addr in the description, or -1 */
+static int _regmap_index(regmap_t *map, uint8_t addr) {
+    size_t lo = 0, hi = map->nregs;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (map->regs[mid].addr == addr)
+            return (int)mid;
+        if (map->regs[mid].addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return -1;
+}
+
+/* Register i+1 follows register i without a gap, so a burst can cross */
+static bool _regmap_adjacent(regmap_t *map, size_t i) {
+    return i + 1 < map->nregs && map->regs[i].addr + map->regs[i].width == map->regs[i + 1].addr;
+}
+
+/* Register holds a known value that can be written again unchanged */
+static bool _regmap_rewritable(regmap_t *map, size_t i) {
+    return !(map->regs[i].flags & (REGMAP_VOLATILE | REGMAP_READONLY)) && _BIT_GET(map->valid, i);
+}
+
+static void _regmap_pack(regmap_t *map, size_t i, uint32_t value, uint8_t *buf) {
+    unsigned int width = map->regs[i].width;
+
+    for (unsigned int b = 0; b < width; b++) {
+        unsigned int shift = (map->flags & REGMAP_LITTLE_ENDIAN) ? 8 * b : 8 * (width - 1 - b);
+        buf[b] = (uint8_t)(value >> shift);
+    }
+}
+
+static uint32_t _regmap_unpack(regmap_t *map, size_t i, const uint8_t *buf) {
+    unsigned int width = map->regs[i].width;
+    uint32_t value = 0;
+
+    for (unsigned int b = 0; b < width; b++) {
+        unsigned int shift = (map->flags & REGMAP_LITTLE_ENDIAN) ? 8 * b : 8 * (width - 1 - b);
+        value |= (uint32_t)buf[b] << shift;
+    }
+
+    return value;
+}
+
+static int _regmap_bus_read(regmap_t *map, uint8_t addr, uint8_t *buf, size_t len) {
+    if (map->i2c) {
+        struct i2c_msg msgs[2];
+
+        msgs[0].addr = map->addr;
+        msgs[0].flags = 0;
+        msgs[0].len = 1;
+        msgs[0].buf = &addr;
+        msgs[1].addr = map->addr;
+        msgs[1].flags = I2C_M_RD;
+        msgs[1].len = len;
+        msgs[1].buf = buf;
+
+        if (i2c_transfer(map->i2c, msgs, 2) < 0)
+            return _regmap_error(map, REGMAP_ERROR_TRANSFER, i2c_errno(map->i2c), "Reading register 0x%02x", addr);
+    } else {
+        uint8_t tx[1 + REGMAP_MAX_BURST] = {0};
+        uint8_t rx[1 + REGMAP_MAX_BURST];
+
+        tx[0] = addr | map->read_mask;
+
+        if (spi_transfer(map->spi, tx, rx, 1 + len) < 0)
+            return _regmap_error(map, REGMAP_ERROR_TRANSFER, spi_errno(map->spi), "Reading register 0x%02x", addr);
+
+        memcpy(buf, rx + 1, len);
+    }
+
+    return 0;
+}
+
+static int _regmap_bus_write(regmap_t *map, uint8_t addr, const uint8_t *data, size_t len) {
+    uint8_t buf[1 + REGMAP_MAX_BURST];
+
+    buf[0] = addr;
+    memcpy(buf + 1, data, len);
+
+    if (map->i2c) {
+        struct i2c_msg msgs[1];
+
+        msgs[0].addr = map->addr;
+        msgs[0].flags = 0;
+        msgs[0].len = 1 + len;
+        msgs[0].buf = buf;
+
+        if (i2c_transfer(map->i2c, msgs, 1) < 0)
+            return _regmap_error(map, REGMAP_ERROR_TRANSFER, i2c_errno(map->i2c), "Writing register 0x%02x", addr);
+    } else {
+        if (spi_transfer(map->spi, buf, NULL, 1 + len) < 0)
+            return _regmap_error(map, REGMAP_ERROR_TRANSFER, spi_errno(map->spi), "Writing register 0x%02x", addr);
+    }
+
+    return 0;
+}
+
+static int _regmap_open(regmap_t *map, const struct regmap_reg *regs, size_t nregs, unsigned int flags) {
+    if (regs == NULL || nregs == 0 || nregs > REGMAP_MAX_REGS)
+        return _regmap_error(map, REGMAP_ERROR_ARG, 0, "Invalid register description (%zu registers)", nregs);
+
+    for (size_t i = 0; i < nregs; i++) {
+        if (regs[i].width < 1 || regs[i].width > 4 || regs[i].width > REGMAP_MAX_BURST)
+            return _regmap_error(map, REGMAP_ERROR_ARG, 0, "Invalid width of register 0x%02x", regs[i].addr);
+        /* Sorted and not overlapping */
+        if (i > 0 && regs[i].addr < regs[i - 1].addr + regs[i - 1].width)
+            return _regmap_error(map, REGMAP_ERROR_ARG, 0, "Register 0x%02x out of order", regs[i].addr);
+    }
+
+    map->regs = regs;
+    map->nregs = nregs;
+    map->flags = flags;
+
+    /* Cache starts out at the power-on values */
+    for (size_t i = 0; i < nregs; i++) {
+        if (regs[i].flags & REGMAP_VOLATILE)
+            continue;
+        map->cache[i] = regs[i].def;
+        _BIT_SET(map->valid, i);
+    }
+
+    return 0;
+}
+
+int regmap_open_i2c(regmap_t *map, i2c_t *i2c, uint16_t addr, const struct regmap_reg *regs, size_t nregs, unsigned int flags) {
+    memset(map, 0, sizeof(struct regmap_handle));
+
+    if (i2c == NULL || addr > 0x7f)
+        return _regmap_error(map, REGMAP_ERROR_ARG, 0, "Invalid I2C handle or address 0x%02x", addr);
+
+    map->i2c = i2c;
+    map->addr = addr;
+
+    return _regmap_open(map, regs, nregs, flags);
+}
+
+int regmap_open_spi(regmap_t *map, spi_t *spi, uint8_t read_mask, const struct regmap_reg *regs, size_t nregs, unsigned int flags) {
+    memset(map, 0, sizeof(struct regmap_handle));
+
+    if (spi == NULL)
+        return _regmap_error(map, REGMAP_ERROR_ARG, 0, "Invalid SPI handle");
+
+    map->spi = spi;
+    map->read_mask = read_mask;
+
+    return _regmap_open(map, regs, nregs, flags);
+}
+
+int regmap_read(regmap_t *map, uint8_t reg, uint32_t *value) {
+    return regmap_read_range(map, reg, 1, value);
+}
+
+int regmap_read_range(regmap_t *map, uint8_t first, size_t count, uint32_t *values) {
+    uint8_t buf[REGMAP_MAX_BURST];
+    size_t len = 0;
+    bool cached = true;
+    int start, ret;
+
+    if ((start = _regmap_index(map, first)) < 0 || count == 0 || (size_t)start + count > map->nregs)
+        return _regmap_error(map, REGMAP_ERROR_ARG, 0, "Invalid register range 0x%02x+%zu", first, count);
+
+    for (size_t i = start; i < start + count; i++) {
+        if (i + 1 < start + count && !_regmap_adjacent(map, i))
+            return _regmap_error(map, REGMAP_ERROR_ARG, 0, "Register range 0x%02x+%zu has a gap", first, count);
+        if ((map->regs[i].flags & REGMAP_VOLATILE) || !_BIT_GET(map->valid, i))
+            cached = false;
+        len += map->regs[i].width;
+    }
+
+    if (len > REGMAP_MAX_BURST)
+        return _regmap_error(map, REGMAP_ERROR_ARG, 0, "Register range 0x%02x+%zu too long", first, count);
+
+    /* Everything known, no transfer */
+    if (cached) {
+        for (size_t k = 0; k < count; k++)
+            values[k] = map->cache[start + k];
+        return 0;
+    }
+
+    if ((ret = _regmap_bus_read(map, first, buf, len)) < 0)
+        return ret;
+
+    len = 0;
+    for (size_t k = 0; k < count; k++) {
+        size_t i = start + k;
+
+        /* A pending write-back value is newer than the device */
+        if (_BIT_GET(map->dirty, i)) {
+            values[k] = map->cache[i];
+        } else {
+            values[k] = _regmap_unpack(map, i, buf + len);
+            if (!(map->regs[i].flags & REGMAP_VOLATILE)) {
+                map->cache[i] = values[k];
+                _BIT_SET(map->valid, i);
+            }
+        }
+        len += map->regs[i].width;
+    }
+
+    return 0;
+}
+
+int regmap_write(regmap_t *map, uint8_t reg, uint32_t value) {
+    uint8_t buf[4];
+    int i, ret;
+
+    if ((i = _regmap_index(map, reg)) < 0)
+        return _regmap_error(map, REGMAP_ERROR_ARG, 0, "Invalid register 0x%02x", reg);
+
+    if (map->regs[i].flags & REGMAP_READONLY)
+        return _regmap_error(map, REGMAP_ERROR_READONLY, 0, "Register 0x%02x is read-only", reg);
+
+    /* Volatile registers are not cached, so always go to the device */
+    if ((map->flags & REGMAP_WRITE_BACK) && !(map->regs[i].flags & REGMAP_VOLATILE)) {
+        if (!_BIT_GET(map->valid, i) || map->cache[i] != value)
+            _BIT_SET(map->dirty, i);
+        map->cache[i] = value;
+        _BIT_SET(map->valid, i);
+        return 0;
+    }
+
+    _regmap_pack(map, i, value, buf);
+    if ((ret = _regmap_bus_write(map, reg, buf, map->regs[i].width)) < 0)
+        return ret;
+
+    if (!(map->regs[i].flags & REGMAP_VOLATILE)) {
+        map->cache[i] = value;
+        _BIT_SET(map->valid, i);
+    }
+
+    return 0;
+}
+
+int regmap_update_bits(regmap_t *map, uint8_t reg, uint32_t mask, uint32_t value) {
+    uint32_t old, new;
+    int ret;
+
+    if ((ret = regmap_read(map, reg, &old)) < 0)
+        return ret;
+
+    new = (old & ~mask) | (value & mask);
+
+    /* Unchanged, stay off the bus */
+    if (new == old)
+        return 0;
+
+    return regmap_write(map, reg, new);
+}
+
+int regmap_sync(regmap_t *map) {
+    uint8_t buf[REGMAP_MAX_BURST];
+    int ret;
+
+    map->sync_bursts = 0;
+
+    for (size_t i = 0; i < map->nregs; i++) {
+        size_t end, last, len;
+
+        if (!_BIT_GET(map->dirty, i))
+            continue;
+
+        /* Grow the burst over adjacent registers, bridging clean ones that
+         * can be written again with their cached value. Stop after the
+         * last dirty register. */
+        len = map->regs[i].width;
+        last = i;
+        for (end = i; _regmap_adjacent(map, end) && _regmap_rewritable(map, end + 1); end++) {
+            if (len + map->regs[end + 1].width > REGMAP_MAX_BURST)
+                break;
+            len += map->regs[end + 1].width;
+            if (_BIT_GET(map->dirty, end + 1))
+                last = end + 1;
+        }
+
+        len = 0;
+        for (size_t k = i; k <= last; k++) {
+            _regmap_pack(map, k, map->cache[k], buf + len);
+            len += map->regs[k].width;
+        }
+
+        if ((ret = _regmap_bus_write(map, map->regs[i].addr, buf, len)) < 0)
+            return ret;
+        map->sync_bursts++;
+
+        for (size_t k = i; k <= last; k++)
+            _BIT_CLR(map->dirty, k);
+
+        i = last;
+    }
+
+    return 0;
+}
+
+int regmap_close(regmap_t *map) {
+    map->i2c = NULL;
+    map->spi = NULL;
+
+    return 0;
+}
+
+int regmap_mark_dirty(regmap_t *map) {
+    for (size_t i = 0; i < map->nregs; i++) {
+        if (_regmap_rewritable(map, i))
+            _BIT_SET(map->dirty, i);
+    }
+
+    return 0;
+}
+
+int regmap_invalidate(regmap_t *map) {
+    memset(map->valid, 0, sizeof(map->valid));
+    memset(map->dirty, 0, sizeof(map->dirty));
+
+    return 0;
+}
+
+size_t regmap_dirty_count(regmap_t *map) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < map->nregs; i++)
+        count += _BIT_GET(map->dirty, i);
+
+    return count;
+}
+
+int regmap_tostring(regmap_t *map, char *str, size_t len) {
+    if (map->i2c)
+        return snprintf(str, len, "Register Map (bus=i2c, addr=0x%02x, registers=%zu, write_back=%d, dirty=%zu)", map->addr, map->nregs, (map->flags & REGMAP_WRITE_BACK) != 0, regmap_dirty_count(map));
+
+    return snprintf(str, len, "Register Map (bus=spi, read_mask=0x%02x, registers=%zu, write_back=%d, dirty=%zu)", map->read_mask, map->nregs, (map->flags & REGMAP_WRITE_BACK) != 0, regmap_dirty_count(map));
+}
+
+const char *regmap_errmsg(regmap_t *map) {
+    return map->error.errmsg;
+}
+
+int regmap_errno(regmap_t *map) {
+    return map->error.c_errno;
+}
+
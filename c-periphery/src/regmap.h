@@ -0,0 +1,96 @@
+/*
+ * c-periphery
+ * https://github.com/vsergeev/c-periphery
+ * License: MIT
+ */
+
+#ifndef _PERIPHERY_REGMAP_H
+#define _PERIPHERY_REGMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2c.h"
+#include "spi.h"
+
+enum regmap_error_code {
+    REGMAP_ERROR_ARG            = -1, /* Invalid arguments */
+    REGMAP_ERROR_READONLY       = -2, /* Writing a read-only register */
+    REGMAP_ERROR_TRANSFER       = -3, /* I2C or SPI transfer */
+};
+
+#define REGMAP_MAX_REGS         128
+/* Largest burst, in bytes of register data */
+#define REGMAP_MAX_BURST        64
+
+/* Register flags */
+#define REGMAP_VOLATILE         0x01    /* Changed by the device, never cached */
+#define REGMAP_READONLY         0x02    /* Writes are rejected */
+
+/* Map flags */
+#define REGMAP_WRITE_BACK       0x01    /* Writes are cached until regmap_sync() */
+#define REGMAP_LITTLE_ENDIAN    0x02    /* Multi-byte registers LSB first */
+
+struct regmap_reg {
+    uint8_t addr;
+    uint8_t width;      /* In bytes, 1 to 4 */
+    uint8_t flags;
+    uint32_t def;       /* Power-on value */
+};
+
+typedef struct regmap_handle {
+    i2c_t *i2c;
+    spi_t *spi;
+    uint16_t addr;      /* I2C address */
+    uint8_t read_mask;  /* SPI read flag, ORed into the register address */
+    unsigned int flags;
+
+    /* Sorted by address, described by the caller */
+    const struct regmap_reg *regs;
+    size_t nregs;
+
+    uint32_t cache[REGMAP_MAX_REGS];
+    uint8_t valid[REGMAP_MAX_REGS / 8];
+    uint8_t dirty[REGMAP_MAX_REGS / 8];
+
+    /* Bursts used by the last regmap_sync() */
+    unsigned int sync_bursts;
+
+    struct {
+        int c_errno;
+        char errmsg[96];
+    } error;
+} regmap_t;
+
+/* Primary Functions */
+int regmap_open_i2c(regmap_t *map, i2c_t *i2c, uint16_t addr, const struct regmap_reg *regs, size_t nregs, unsigned int flags);
+int regmap_open_spi(regmap_t *map, spi_t *spi, uint8_t read_mask, const struct regmap_reg *regs, size_t nregs, unsigned int flags);
+int regmap_read(regmap_t *map, uint8_t reg, uint32_t *value);
+int regmap_write(regmap_t *map, uint8_t reg, uint32_t value);
+int regmap_update_bits(regmap_t *map, uint8_t reg, uint32_t mask, uint32_t value);
+int regmap_read_range(regmap_t *map, uint8_t first, size_t count, uint32_t *values);
+int regmap_sync(regmap_t *map);
+int regmap_close(regmap_t *map);
+
+/* Cache Control */
+int regmap_mark_dirty(regmap_t *map);
+int regmap_invalidate(regmap_t *map);
+size_t regmap_dirty_count(regmap_t *map);
+
+/* Miscellaneous */
+int regmap_tostring(regmap_t *map, char *str, size_t len);
+
+/* Error Handling */
+int regmap_errno(regmap_t *map);
+const char *regmap_errmsg(regmap_t *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -22,6 +22,7 @@
 #include <termios.h>
 
 #include "serial.h"
+#include "probe.h"
 
 static int _serial_error(struct serial_handle *serial, int code, int c_errno, const char *fmt, ...) {
     va_list ap;
@@ -226,25 +227,31 @@ int serial_read(serial_t *serial, uint8_t *buf, size_t len, int timeout_ms) {
     bytes_left = len;
     bytes_read = 0;
 
+    PERIPHERY_PROBE3(periphery, serial_read_start, serial->fd, len, timeout_ms);
     do {
         if (timeout_ms >= 0) {
             FD_ZERO(&rfds);
             FD_SET(serial->fd, &rfds);
 
-            if ((ret = select(serial->fd+1, &rfds, NULL, NULL, &tv_timeout)) < 0)
+            if ((ret = select(serial->fd+1, &rfds, NULL, NULL, &tv_timeout)) < 0) {
+                PERIPHERY_PROBE3(periphery, serial_read_done, serial->fd, errno, bytes_read);
                 return _serial_error(serial, SERIAL_ERROR_IO, errno, "select() on serial port");
+            }
 
             /* Timeout / nothing more to read */
             if (ret == 0)
                 break;
         }
 
-        if ((ret = read(serial->fd, buf + bytes_read, bytes_left)) < 0)
+        if ((ret = read(serial->fd, buf + bytes_read, bytes_left)) < 0) {
+            PERIPHERY_PROBE3(periphery, serial_read_done, serial->fd, errno, bytes_read);
             return _serial_error(serial, SERIAL_ERROR_IO, errno, "Reading serial port");
+        }
 
         bytes_read += ret;
         bytes_left -= ret;
     } while (bytes_left > 0);
+    PERIPHERY_PROBE3(periphery, serial_read_done, serial->fd, 0, bytes_read);
 
     return bytes_read;
 }
@@ -252,7 +259,10 @@ int serial_read(serial_t *serial, uint8_t *buf, size_t len, int timeout_ms) {
 int serial_write(serial_t *serial, const uint8_t *buf, size_t len) {
     ssize_t ret;
 
-    if ((ret = write(serial->fd, buf, len)) < 0)
+    PERIPHERY_PROBE2(periphery, serial_write_start, serial->fd, len);
+    ret = write(serial->fd, buf, len);
+    PERIPHERY_PROBE3(periphery, serial_write_done, serial->fd, ret < 0 ? errno : 0, ret);
+    if (ret < 0)
         return _serial_error(serial, SERIAL_ERROR_IO, errno, "Writing serial port");
 
     return ret;
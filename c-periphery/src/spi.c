@@ -20,6 +20,7 @@
 #include <linux/spi/spidev.h>
 
 #include "spi.h"
+#include "probe.h"
 
 static int _spi_error(struct spi_handle *spi, int code, int c_errno, const char *fmt, ...) {
     va_list ap;
@@ -86,6 +87,7 @@ int spi_open_advanced(spi_t *spi, const char *path, unsigned int mode, uint32_t
 
 int spi_transfer(spi_t *spi, const uint8_t *txbuf, uint8_t *rxbuf, size_t len) {
     struct spi_ioc_transfer spi_xfer;
+    int ret;
 
     /* Prepare SPI transfer structure */
     memset(&spi_xfer, 0, sizeof(struct spi_ioc_transfer));
@@ -98,7 +100,10 @@ int spi_transfer(spi_t *spi, const uint8_t *txbuf, uint8_t *rxbuf, size_t len) {
     spi_xfer.cs_change = 0;
 
     /* Transfer */
-    if (ioctl(spi->fd, SPI_IOC_MESSAGE(1), &spi_xfer) < 1)
+    PERIPHERY_PROBE4(periphery, spi_transfer_start, spi->fd, len, txbuf, rxbuf);
+    ret = ioctl(spi->fd, SPI_IOC_MESSAGE(1), &spi_xfer);
+    PERIPHERY_PROBE2(periphery, spi_transfer_done, spi->fd, ret < 1 ? errno : 0);
+    if (ret < 1)
         return _spi_error(spi, SPI_ERROR_TRANSFER, errno, "SPI transfer");
 
     return 0;
@@ -0,0 +1,176 @@
+/*
+ * c-periphery
+ * https://github.com/vsergeev/c-periphery
+ * License: MIT
+ */
+
+#include "test.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../src/i2c.h"
+#include "../src/mcp23017.h"
+
+const char *i2c_bus_path;
+uint8_t mcp_address;
+
+void test_arguments(void) {
+    mcp23017_t mcp;
+    i2c_t i2c;
+
+    ptest();
+
+    /* No bus */
+    passert(mcp23017_open(&mcp, NULL, 0x20) == MCP23017_ERROR_ARG);
+    /* Not a 7-bit address */
+    passert(mcp23017_open(&mcp, &i2c, 0x80) == MCP23017_ERROR_ARG);
+
+    /* Open does not touch the bus */
+    passert(mcp23017_open(&mcp, &i2c, 0x20) == 0);
+    passert(mcp23017_shadow(&mcp, MCP23017_IODIR, MCP23017_PORT_B) == 0xff);
+    passert(mcp23017_shadow(&mcp, MCP23017_OLAT, MCP23017_PORT_A) == 0x00);
+
+    /* Invalid register */
+    passert(mcp23017_read(&mcp, MCP23017_NUM_REGS, MCP23017_PORT_A, NULL) == MCP23017_ERROR_ARG);
+
+    /* Register addresses in both layouts */
+    passert(mcp23017_reg_addr(&mcp, MCP23017_IODIR, MCP23017_PORT_B) == 0x01);
+    passert(mcp23017_reg_addr(&mcp, MCP23017_GPIO, MCP23017_PORT_A) == 0x12);
+    passert(mcp23017_reg_addr(&mcp, MCP23017_OLAT, MCP23017_PORT_B) == 0x15);
+    mcp.shadow[MCP23017_IOCON][MCP23017_PORT_A] = MCP23017_IOCON_BANK;
+    passert(mcp23017_reg_addr(&mcp, MCP23017_IODIR, MCP23017_PORT_B) == 0x10);
+    passert(mcp23017_reg_addr(&mcp, MCP23017_GPIO, MCP23017_PORT_A) == 0x09);
+    passert(mcp23017_reg_addr(&mcp, MCP23017_OLAT, MCP23017_PORT_B) == 0x1a);
+
+    /* Updates that change nothing stay off the bus */
+    mcp.shadow[MCP23017_OLAT][MCP23017_PORT_B] = 0x05;
+    passert(mcp23017_update(&mcp, MCP23017_GPIO, MCP23017_PORT_B, 0x04, 0xff) == 0);
+}
+
+void test_open_config_close(void) {
+    mcp23017_t mcp;
+    i2c_t i2c;
+    uint8_t value;
+
+    ptest();
+
+    passert(i2c_open(&i2c, i2c_bus_path) == 0);
+    passert(mcp23017_open(&mcp, &i2c, mcp_address) == 0);
+
+    /* Device should be in its power-on layout */
+    passert(mcp23017_set_iocon(&mcp, 0x00) == 0);
+
+    /* Write and read back */
+    passert(mcp23017_write(&mcp, MCP23017_IPOL, MCP23017_PORT_A, 0x5a) == 0);
+    passert(mcp23017_read(&mcp, MCP23017_IPOL, MCP23017_PORT_A, &value) == 0);
+    passert(value == 0x5a);
+    passert(mcp23017_write_pair(&mcp, MCP23017_IPOL, 0x00, 0xa5) == 0);
+    passert(mcp23017_read(&mcp, MCP23017_IPOL, MCP23017_PORT_B, &value) == 0);
+    passert(value == 0xa5);
+
+    /* Shadow follows a refresh */
+    mcp.shadow[MCP23017_IPOL][MCP23017_PORT_B] = 0x00;
+    passert(mcp23017_refresh(&mcp) == 0);
+    passert(mcp23017_shadow(&mcp, MCP23017_IPOL, MCP23017_PORT_B) == 0xa5);
+
+    /* Restore puts the shadow back */
+    passert(mcp23017_write(&mcp, MCP23017_IPOL, MCP23017_PORT_B, 0x00) == 0);
+    mcp.shadow[MCP23017_IPOL][MCP23017_PORT_B] = 0xa5;
+    passert(mcp23017_restore(&mcp) == 0);
+    passert(mcp23017_read(&mcp, MCP23017_IPOL, MCP23017_PORT_B, &value) == 0);
+    passert(value == 0xa5);
+
+    /* Same registers in the BANK = 1 layout, and in byte mode */
+    passert(mcp23017_set_iocon(&mcp, MCP23017_IOCON_BANK) == 0);
+    passert(mcp23017_read(&mcp, MCP23017_IPOL, MCP23017_PORT_B, &value) == 0);
+    passert(value == 0xa5);
+    passert(mcp23017_set_iocon(&mcp, MCP23017_IOCON_BANK | MCP23017_IOCON_SEQOP) == 0);
+    passert(mcp23017_refresh(&mcp) == 0);
+    passert(mcp23017_shadow(&mcp, MCP23017_IPOL, MCP23017_PORT_B) == 0xa5);
+    passert(mcp23017_set_iocon(&mcp, 0x00) == 0);
+
+    /* Restore of a BANK = 1 shadow to a device back in its power-on layout */
+    passert(mcp23017_set_iocon(&mcp, MCP23017_IOCON_BANK) == 0);
+    passert(mcp23017_set_iocon(&mcp, 0x00) == 0);
+    mcp.shadow[MCP23017_IOCON][MCP23017_PORT_A] = MCP23017_IOCON_BANK;
+    mcp.shadow[MCP23017_IOCON][MCP23017_PORT_B] = MCP23017_IOCON_BANK;
+    passert(mcp23017_restore(&mcp) == 0);
+    passert(mcp23017_read(&mcp, MCP23017_IOCON, MCP23017_PORT_A, &value) == 0);
+    passert(value == MCP23017_IOCON_BANK);
+    passert(mcp23017_read(&mcp, MCP23017_IPOL, MCP23017_PORT_B, &value) == 0);
+    passert(value == 0xa5);
+    passert(mcp23017_set_iocon(&mcp, 0x00) == 0);
+
+    passert(mcp23017_write_pair(&mcp, MCP23017_IPOL, 0x00, 0x00) == 0);
+    passert(mcp23017_close(&mcp) == 0);
+    passert(i2c_close(&i2c) == 0);
+}
+
+void test_loopback(void) {
+    struct mcp23017_events ev;
+    mcp23017_t mcp;
+    i2c_t i2c;
+
+    ptest();
+
+    /* Loopback plan: port B drives port A, B0-7 wired to A0-7 */
+
+    passert(i2c_open(&i2c, i2c_bus_path) == 0);
+    passert(mcp23017_open(&mcp, &i2c, mcp_address) == 0);
+
+    passert(mcp23017_write_pair(&mcp, MCP23017_OLAT, 0x00, 0x00) == 0);
+    passert(mcp23017_write_pair(&mcp, MCP23017_IODIR, 0xff, 0x00) == 0);
+    passert(mcp23017_write_pair(&mcp, MCP23017_GPINTEN, 0xff, 0x00) == 0);
+    passert(mcp23017_read_events(&mcp, &ev) == 0);
+
+    /* Latch updates from the shadow */
+    passert(mcp23017_update(&mcp, MCP23017_OLAT, MCP23017_PORT_B, 0x0f, 0x05) == 0);
+    passert(mcp23017_read_events(&mcp, &ev) == 0);
+    passert(ev.gpio[MCP23017_PORT_A] == 0x05);
+    passert(ev.intf[MCP23017_PORT_A] != 0);
+
+    passert(mcp23017_update(&mcp, MCP23017_GPIO, MCP23017_PORT_B, 0x01, 0x00) == 0);
+    passert(mcp23017_shadow(&mcp, MCP23017_OLAT, MCP23017_PORT_B) == 0x04);
+    passert(mcp23017_read_events(&mcp, &ev) == 0);
+    passert(ev.gpio[MCP23017_PORT_A] == 0x04);
+
+    /* Same in the BANK = 1 layout */
+    passert(mcp23017_set_iocon(&mcp, MCP23017_IOCON_BANK) == 0);
+    passert(mcp23017_update(&mcp, MCP23017_OLAT, MCP23017_PORT_B, 0xff, 0xa0) == 0);
+    passert(mcp23017_read_events(&mcp, &ev) == 0);
+    passert(ev.gpio[MCP23017_PORT_A] == 0xa0);
+    passert(ev.gpio[MCP23017_PORT_B] == 0xa0);
+    passert(mcp23017_set_iocon(&mcp, 0x00) == 0);
+
+    passert(mcp23017_write_pair(&mcp, MCP23017_GPINTEN, 0x00, 0x00) == 0);
+    passert(mcp23017_write_pair(&mcp, MCP23017_IODIR, 0xff, 0xff) == 0);
+    passert(mcp23017_close(&mcp) == 0);
+    passert(i2c_close(&i2c) == 0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <I2C bus> <MCP23017 address>\n\n", argv[0]);
+        fprintf(stderr, "[1/3] Arguments test: No requirements.\n");
+        fprintf(stderr, "[2/3] Open/config/close test: an MCP23017 should be on the I2C bus.\n");
+        fprintf(stderr, "[3/3] Loopback test: MCP23017 port B pins should be wired to port A pins.\n\n");
+        fprintf(stderr, "    %s /dev/i2c-1 0x20\n\n", argv[0]);
+        exit(1);
+    }
+
+    i2c_bus_path = argv[1];
+    mcp_address = strtoul(argv[2], NULL, 0);
+
+    test_arguments();
+    printf(" " STR_OK "  Arguments test passed.\n\n");
+    test_open_config_close();
+    printf(" " STR_OK "  Open/config/close test passed.\n\n");
+    test_loopback();
+    printf(" " STR_OK "  Loopback test passed.\n\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}
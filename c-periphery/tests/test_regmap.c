@@ -0,0 +1,180 @@
+/*
+ * c-periphery
+ * https://github.com/vsergeev/c-periphery
+ * License: MIT
+ */
+
+#include "test.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../src/i2c.h"
+#include "../src/regmap.h"
+
+const char *i2c_bus_path;
+uint8_t mcp_address;
+
+/* MCP23017 with IOCON.BANK = 0, as a register map */
+static const struct regmap_reg mcp23017_regs[] = {
+    {0x00, 1, 0, 0xff}, {0x01, 1, 0, 0xff},                                     /* IODIR */
+    {0x02, 1, 0, 0x00}, {0x03, 1, 0, 0x00},                                     /* IPOL */
+    {0x04, 1, 0, 0x00}, {0x05, 1, 0, 0x00},                                     /* GPINTEN */
+    {0x06, 1, 0, 0x00}, {0x07, 1, 0, 0x00},                                     /* DEFVAL */
+    {0x08, 1, 0, 0x00}, {0x09, 1, 0, 0x00},                                     /* INTCON */
+    {0x0a, 1, 0, 0x00}, {0x0b, 1, 0, 0x00},                                     /* IOCON */
+    {0x0c, 1, 0, 0x00}, {0x0d, 1, 0, 0x00},                                     /* GPPU */
+    {0x0e, 1, REGMAP_VOLATILE | REGMAP_READONLY, 0}, {0x0f, 1, REGMAP_VOLATILE | REGMAP_READONLY, 0}, /* INTF */
+    {0x10, 1, REGMAP_VOLATILE | REGMAP_READONLY, 0}, {0x11, 1, REGMAP_VOLATILE | REGMAP_READONLY, 0}, /* INTCAP */
+    {0x12, 1, REGMAP_VOLATILE, 0}, {0x13, 1, REGMAP_VOLATILE, 0},               /* GPIO */
+    {0x14, 1, 0, 0x00}, {0x15, 1, 0, 0x00},                                     /* OLAT */
+};
+
+#define NUM_REGS    (sizeof(mcp23017_regs) / sizeof(mcp23017_regs[0]))
+
+void test_arguments(void) {
+    static const struct regmap_reg unsorted[] = { {0x02, 1, 0, 0}, {0x01, 1, 0, 0} };
+    static const struct regmap_reg overlapping[] = { {0x00, 2, 0, 0}, {0x01, 1, 0, 0} };
+    regmap_t map;
+    i2c_t i2c;
+    uint32_t value;
+
+    ptest();
+
+    /* No bus, bad address */
+    passert(regmap_open_i2c(&map, NULL, 0x20, mcp23017_regs, NUM_REGS, 0) == REGMAP_ERROR_ARG);
+    passert(regmap_open_i2c(&map, &i2c, 0x80, mcp23017_regs, NUM_REGS, 0) == REGMAP_ERROR_ARG);
+    passert(regmap_open_spi(&map, NULL, 0x80, mcp23017_regs, NUM_REGS, 0) == REGMAP_ERROR_ARG);
+    /* Bad descriptions */
+    passert(regmap_open_i2c(&map, &i2c, 0x20, NULL, 0, 0) == REGMAP_ERROR_ARG);
+    passert(regmap_open_i2c(&map, &i2c, 0x20, unsorted, 2, 0) == REGMAP_ERROR_ARG);
+    passert(regmap_open_i2c(&map, &i2c, 0x20, overlapping, 2, 0) == REGMAP_ERROR_ARG);
+
+    /* Open does not touch the bus, non-volatile registers read from the cache */
+    passert(regmap_open_i2c(&map, &i2c, 0x20, mcp23017_regs, NUM_REGS, REGMAP_WRITE_BACK) == 0);
+    passert(regmap_read(&map, 0x00, &value) == 0);
+    passert(value == 0xff);
+
+    /* Unknown and read-only registers */
+    passert(regmap_read(&map, 0x16, &value) == REGMAP_ERROR_ARG);
+    passert(regmap_write(&map, 0x0e, 0x00) == REGMAP_ERROR_READONLY);
+
+    /* Write-back marks dirty only what changes */
+    passert(regmap_write(&map, 0x00, 0xff) == 0);
+    passert(regmap_dirty_count(&map) == 0);
+    passert(regmap_write(&map, 0x00, 0x0f) == 0);
+    passert(regmap_update_bits(&map, 0x14, 0x03, 0x01) == 0);
+    passert(regmap_update_bits(&map, 0x15, 0x03, 0x00) == 0);
+    passert(regmap_dirty_count(&map) == 2);
+    passert(regmap_read(&map, 0x14, &value) == 0);
+    passert(value == 0x01);
+
+    /* Every rewritable register */
+    passert(regmap_mark_dirty(&map) == 0);
+    passert(regmap_dirty_count(&map) == 16);
+    passert(regmap_invalidate(&map) == 0);
+    passert(regmap_dirty_count(&map) == 0);
+
+    passert(regmap_close(&map) == 0);
+}
+
+void test_open_config_close(void) {
+    regmap_t map;
+    i2c_t i2c;
+    uint32_t values[3];
+
+    ptest();
+
+    passert(i2c_open(&i2c, i2c_bus_path) == 0);
+    passert(regmap_open_i2c(&map, &i2c, mcp_address, mcp23017_regs, NUM_REGS, REGMAP_WRITE_BACK) == 0);
+
+    /* Take over whatever state the device is in */
+    passert(regmap_invalidate(&map) == 0);
+    passert(regmap_read_range(&map, 0x00, 14, (uint32_t [14]){0}) == 0);
+    passert(regmap_read_range(&map, 0x14, 2, values) == 0);
+
+    /* IPOLA and DEFVALB with IPOLB, GPINTEN and DEFVALA in between, one burst */
+    passert(regmap_write(&map, 0x02, 0x5a) == 0);
+    passert(regmap_write(&map, 0x07, 0xa5) == 0);
+    passert(regmap_dirty_count(&map) == 2);
+    passert(regmap_sync(&map) == 0);
+    passert(map.sync_bursts == 1);
+    passert(regmap_dirty_count(&map) == 0);
+
+    /* Read back past the cache */
+    passert(regmap_invalidate(&map) == 0);
+    passert(regmap_read(&map, 0x02, &values[0]) == 0);
+    passert(regmap_read(&map, 0x07, &values[1]) == 0);
+    passert(values[0] == 0x5a);
+    passert(values[1] == 0xa5);
+
+    /* A volatile register in between splits a burst */
+    passert(regmap_write(&map, 0x0d, 0x00) == 0);
+    passert(regmap_write(&map, 0x14, 0x00) == 0);
+    passert(regmap_mark_dirty(&map) == 0);
+    passert(regmap_sync(&map) == 0);
+    passert(map.sync_bursts == 2);
+
+    passert(regmap_write(&map, 0x02, 0x00) == 0);
+    passert(regmap_write(&map, 0x07, 0x00) == 0);
+    passert(regmap_sync(&map) == 0);
+
+    passert(regmap_close(&map) == 0);
+    passert(i2c_close(&i2c) == 0);
+}
+
+void test_loopback(void) {
+    regmap_t map;
+    i2c_t i2c;
+    uint32_t values[2];
+
+    ptest();
+
+    /* Loopback plan: port B drives port A, B0-7 wired to A0-7 */
+
+    passert(i2c_open(&i2c, i2c_bus_path) == 0);
+    passert(regmap_open_i2c(&map, &i2c, mcp_address, mcp23017_regs, NUM_REGS, 0) == 0);
+
+    /* Write-through */
+    passert(regmap_write(&map, 0x15, 0x00) == 0);
+    passert(regmap_write(&map, 0x01, 0x00) == 0);
+    passert(regmap_dirty_count(&map) == 0);
+
+    /* GPIO is volatile, always read from the device */
+    passert(regmap_update_bits(&map, 0x15, 0xff, 0x3c) == 0);
+    passert(regmap_read_range(&map, 0x12, 2, values) == 0);
+    passert(values[0] == 0x3c);
+    passert(regmap_update_bits(&map, 0x15, 0x0c, 0x00) == 0);
+    passert(regmap_read(&map, 0x12, &values[0]) == 0);
+    passert(values[0] == 0x30);
+
+    passert(regmap_write(&map, 0x01, 0xff) == 0);
+    passert(regmap_close(&map) == 0);
+    passert(i2c_close(&i2c) == 0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <I2C bus> <MCP23017 address>\n\n", argv[0]);
+        fprintf(stderr, "[1/3] Arguments test: No requirements.\n");
+        fprintf(stderr, "[2/3] Open/config/close test: an MCP23017 should be on the I2C bus.\n");
+        fprintf(stderr, "[3/3] Loopback test: MCP23017 port B pins should be wired to port A pins.\n\n");
+        fprintf(stderr, "    %s /dev/i2c-1 0x20\n\n", argv[0]);
+        exit(1);
+    }
+
+    i2c_bus_path = argv[1];
+    mcp_address = strtoul(argv[2], NULL, 0);
+
+    test_arguments();
+    printf(" " STR_OK "  Arguments test passed.\n\n");
+    test_open_config_close();
+    printf(" " STR_OK "  Open/config/close test passed.\n\n");
+    test_loopback();
+    printf(" " STR_OK "  Loopback test passed.\n\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "iotool.h"
+
+/* Reconnect delay, doubling from the first to the last */
+#define RETRY_FIRST_MS  100
+#define RETRY_MAX_MS    5000
+
+static void
+retry_later(iotool_t *c)
+{
+    clock_gettime(CLOCK_MONOTONIC, &c->retry_at);
+    c->retry_at.tv_sec += c->retry_ms / 1000;
+    c->retry_at.tv_nsec += (c->retry_ms % 1000) * 1000000L;
+    if (c->retry_at.tv_nsec >= 1000000000L) {
+        c->retry_at.tv_sec++;
+        c->retry_at.tv_nsec -= 1000000000L;
+    }
+
+    c->retry_ms = (c->retry_ms * 2 > RETRY_MAX_MS) ? RETRY_MAX_MS : c->retry_ms * 2;
+}
+
+static void
+disconnect(iotool_t *c)
+{
+    if (c->fd >= 0)
+        close(c->fd);
+    c->fd = -1;
+    c->npartial = 0;
+    /* A record cut short is sent whole to the next connection */
+    c->qsent = 0;
+    retry_later(c);
+}
+
+static int
+queue_push(iotool_t *c, const io_t *rec)
+{
+    if (c->qhead - c->qtail == IOTOOL_QUEUE) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    c->queue[c->qhead % IOTOOL_QUEUE] = *rec;
+    c->qhead++;
+
+    return 0;
+}
+
+/* Connect if it is time to, 0 when connected */
+static int
+reconnect(iotool_t *c)
+{
+    struct sockaddr_un remote;
+    io_t q;
+
+    if (c->fd >= 0)
+        return 0;
+    if (iotool_timeout_ms(c) > 0)
+        return -1;
+
+    if ((c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        retry_later(c);
+        return -1;
+    }
+
+    memset(&remote, 0, sizeof(remote));
+    remote.sun_family = AF_UNIX;
+    strcpy(remote.sun_path, c->path);
+    if (connect(c->fd, (struct sockaddr *)&remote, sizeof(remote)) < 0) {
+        disconnect(c);
+        return -1;
+    }
+
+    c->retry_ms = RETRY_FIRST_MS;
+    c->reconnects++;
+
+    /* Ask again what was not answered, after what is queued already */
+    for (unsigned int b = 0; b < IO_BANKS; b++) {
+        if (!(c->queries & (1u << b)))
+            continue;
+        q.command = IO_COMMAND(QUERY_STATE, b);
+        q.input_bits = c->query_age[b] & 0xFF;
+        q.output_bits = c->query_age[b] >> 8;
+        if (queue_push(c, &q) < 0)
+            break;
+    }
+
+    iotool_flush(c);
+
+    return 0;
+}
+
+int
+iotool_open(iotool_t *c, const char *path)
+{
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    c->retry_ms = RETRY_FIRST_MS;
+
+    if (path == NULL)
+        path = IOTOOL_SOCK_PATH;
+    if (strlen(path) >= sizeof(c->path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(c->path, path);
+
+    reconnect(c);
+    /* The first one does not count as a reconnect */
+    c->reconnects = 0;
+
+    return 0;
+}
+
+void
+iotool_close(iotool_t *c)
+{
+    if (c->fd >= 0)
+        close(c->fd);
+    c->fd = -1;
+}
+
+int
+iotool_fd(iotool_t *c)
+{
+    return c->fd;
+}
+
+int
+iotool_timeout_ms(iotool_t *c)
+{
+    struct timespec now;
+    long ms;
+
+    if (c->fd >= 0)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (c->retry_at.tv_sec - now.tv_sec) * 1000 + (c->retry_at.tv_nsec - now.tv_nsec + 999999) / 1000000;
+
+    return ms > 0 ? (int)ms : 0;
+}
+
+int
+iotool_want_write(iotool_t *c)
+{
+    return c->fd >= 0 && c->qhead != c->qtail;
+}
+
+int
+iotool_flush(iotool_t *c)
+{
+    io_t out[IOTOOL_QUEUE];
+    size_t n = 0;
+    ssize_t ret;
+
+    if (c->fd < 0)
+        return 0;
+
+    while (c->qtail + n != c->qhead) {
+        out[n] = c->queue[(c->qtail + n) % IOTOOL_QUEUE];
+        n++;
+    }
+    if (n == 0)
+        return 0;
+
+    /* All queued records in one write */
+    ret = send(c->fd, (uint8_t *)out + c->qsent, n * sizeof(io_t) - c->qsent, MSG_NOSIGNAL);
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return 0;
+        if (errno == EPIPE || errno == ECONNRESET) {
+            disconnect(c);
+            return 0;
+        }
+        return -1;
+    }
+
+    /* A nearly full socket may take part of a record */
+    c->qtail += (c->qsent + ret) / sizeof(io_t);
+    c->qsent = (c->qsent + ret) % sizeof(io_t);
+
+    return 0;
+}
+
+int
+iotool_recv(iotool_t *c, io_t *ev, size_t max)
+{
+    uint8_t *p = (uint8_t *)ev;
+    ssize_t ret;
+    size_t total, n;
+
+    if (max == 0)
+        return 0;
+    if (reconnect(c) < 0)
+        return 0;
+
+    iotool_flush(c);
+    if (c->fd < 0)
+        return 0;
+
+    memcpy(p, c->partial, c->npartial);
+    ret = read(c->fd, p + c->npartial, max * sizeof(io_t) - c->npartial);
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return 0;
+        if (errno == ECONNRESET) {
+            disconnect(c);
+            return 0;
+        }
+        return -1;
+    }
+    if (ret == 0) {
+        /* Daemon went away, the next call tries again */
+        disconnect(c);
+        return 0;
+    }
+
+    total = c->npartial + ret;
+    n = total / sizeof(io_t);
+    c->npartial = total % sizeof(io_t);
+    memcpy(c->partial, p + n * sizeof(io_t), c->npartial);
+
+    for (size_t i = 0; i < n; i++) {
+        if (IO_CMD(ev[i].command) == OUTPUT_INFO)
+            c->queries &= ~(1u << IO_BANK(ev[i].command));
+    }
+
+    return (int)n;
+}
+
+int
+iotool_next(iotool_t *c, io_t *ev)
+{
+    if (c->bcount == 0) {
+        int n = iotool_recv(c, c->buf, IOTOOL_BUF);
+
+        if (n <= 0)
+            return 0;
+        c->bhead = 0;
+        c->bcount = n;
+    }
+
+    *ev = c->buf[c->bhead++];
+    c->bcount--;
+
+    return 1;
+}
+
+int
+iotool_dispatch(iotool_t *c, void (*cb)(const io_t *ev, void *arg), void *arg)
+{
+    io_t ev[IOTOOL_BUF];
+    int n, total = 0;
+
+    /* What iotool_next() read ahead comes first */
+    while (c->bcount > 0) {
+        cb(&c->buf[c->bhead++], arg);
+        c->bcount--;
+        total++;
+    }
+
+    if ((n = iotool_recv(c, ev, IOTOOL_BUF)) < 0)
+        return -1;
+    for (int i = 0; i < n; i++)
+        cb(&ev[i], arg);
+
+    return total + n;
+}
+
+int
+iotool_send(iotool_t *c, uint8_t command, uint8_t input_bits, uint8_t output_bits)
+{
+    io_t rec = { command, input_bits, output_bits };
+
+    if (queue_push(c, &rec) < 0)
+        return -1;
+
+    if (reconnect(c) < 0)
+        return 0;
+
+    return iotool_flush(c);
+}
+
+int
+iotool_set_outputs(iotool_t *c, unsigned int bank, uint8_t bits)
+{
+    return iotool_send(c, IO_COMMAND(SET_OUTPUT_BIT, bank), 0, bits);
+}
+
+int
+iotool_clear_outputs(iotool_t *c, unsigned int bank, uint8_t bits)
+{
+    return iotool_send(c, IO_COMMAND(CLEAR_OUTPUT_BIT, bank), 0, bits);
+}
+
+int
+iotool_set_all(iotool_t *c)
+{
+    return iotool_send(c, SET_ALL_OUTPUT_BIT, 0, 0);
+}
+
+int
+iotool_clear_all(iotool_t *c)
+{
+    return iotool_send(c, CLEAR_ALL_OUTPUT_BIT, 0, 0);
+}
+
+int
+iotool_query(iotool_t *c, unsigned int bank, uint16_t max_age_ms)
+{
+    if (bank >= IO_BANKS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    c->queries |= 1u << bank;
+    c->query_age[bank] = max_age_ms;
+
+    return iotool_send(c, IO_COMMAND(QUERY_STATE, bank), max_age_ms & 0xFF, max_age_ms >> 8);
+}
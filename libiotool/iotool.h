@@ -0,0 +1,129 @@
+#ifndef _IOTOOL_H
+#define _IOTOOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * iotool daemon protocol and client library.
+ *
+ * Client and daemon exchange fixed three byte records over a Unix
+ * stream socket. The daemon sends INPUT_INFO, OUTPUT_INFO and
+ * SHORT_CIRCUIT, clients send the output commands and QUERY_STATE.
+ */
+
+#define IOTOOL_SOCK_PATH    "/var/run/iotool.sock"
+/* Same protocol, for safety clients: served before anything else */
+#define IOTOOL_URGENT_PATH  "/var/run/iotool-urgent.sock"
+
+typedef struct iotool {
+    uint8_t command;
+    uint8_t input_bits;
+    uint8_t output_bits;
+} io_t;
+
+enum {
+    INPUT_INFO,
+    OUTPUT_INFO,
+    SHORT_CIRCUIT,
+    SET_OUTPUT_BIT,
+    SET_ALL_OUTPUT_BIT,
+    CLEAR_OUTPUT_BIT,
+    CLEAR_ALL_OUTPUT_BIT,
+    QUERY_STATE         /* OUTPUT_INFO wanted, max age in ms: input_bits low, output_bits high */
+};
+
+/*
+ * The high nibble of command selects a bank of eight channels, so bank 0
+ * is what single expander clients have always seen.
+ */
+#define IO_CMD(c)           ((c) & 0x0F)
+#define IO_BANK(c)          ((c) >> 4)
+#define IO_COMMAND(c, bank) ((uint8_t)(((bank) << 4) | (c)))
+#define IO_BANKS            16
+
+/* Records kept while disconnected or while the socket is full */
+#define IOTOOL_QUEUE        64
+/* Records buffered for iotool_next() */
+#define IOTOOL_BUF          64
+
+/*
+ * Client connection. The socket is non-blocking: put iotool_fd() in your
+ * own poll() set, and call iotool_recv(), iotool_next() or
+ * iotool_dispatch() when it is readable. When the daemon goes away the
+ * client reconnects by itself, with a growing delay, from any of these
+ * calls; poll with iotool_timeout_ms() meanwhile. The fd changes across a
+ * reconnect, take it again on every loop.
+ *
+ * Commands given while disconnected are replayed in order once the
+ * connection is back, and queries not answered yet are asked again.
+ */
+typedef struct iotool_client {
+    int fd;
+    char path[108];
+
+    /* Part of a record left over by the last read */
+    uint8_t partial[sizeof(io_t)];
+    size_t npartial;
+
+    /* Outgoing records not written yet */
+    io_t queue[IOTOOL_QUEUE];
+    unsigned int qhead, qtail;
+    size_t qsent;               /* bytes of queue[qtail] written */
+    uint16_t queries;           /* banks queried and not answered */
+    uint16_t query_age[IO_BANKS];
+
+    /* Read ahead for iotool_next() */
+    io_t buf[IOTOOL_BUF];
+    size_t bhead, bcount;
+
+    struct timespec retry_at;
+    unsigned int retry_ms;
+    unsigned long reconnects;
+} iotool_t;
+
+/* Connect to the daemon at path, NULL for IOTOOL_SOCK_PATH. Succeeds
+ * without a daemon too, the client then keeps trying */
+int iotool_open(iotool_t *c, const char *path);
+void iotool_close(iotool_t *c);
+
+/* Socket to poll for POLLIN, -1 while disconnected */
+int iotool_fd(iotool_t *c);
+/* Poll timeout: until the next reconnect attempt, or -1 */
+int iotool_timeout_ms(iotool_t *c);
+/* Also wait for POLLOUT, records are queued */
+int iotool_want_write(iotool_t *c);
+
+/*
+ * Bulk receive: as many records as fit in ev, from a single read().
+ * Returns the number of records, 0 if there were none, -1 with errno set
+ * on a failure other than the daemon going away.
+ */
+int iotool_recv(iotool_t *c, io_t *ev, size_t max);
+/* Iterator: 1 and the next record in *ev, 0 when none is pending */
+int iotool_next(iotool_t *c, io_t *ev);
+/* Callback: cb for each pending record, returns how many, or -1 */
+int iotool_dispatch(iotool_t *c, void (*cb)(const io_t *ev, void *arg), void *arg);
+
+/* Commands, queued when they cannot be written right away. -1 with
+ * errno ENOBUFS when the queue is full */
+int iotool_send(iotool_t *c, uint8_t command, uint8_t input_bits, uint8_t output_bits);
+int iotool_set_outputs(iotool_t *c, unsigned int bank, uint8_t bits);
+int iotool_clear_outputs(iotool_t *c, unsigned int bank, uint8_t bits);
+int iotool_set_all(iotool_t *c);
+int iotool_clear_all(iotool_t *c);
+/* Ask for OUTPUT_INFO of bank, with inputs read at most max_age_ms ago */
+int iotool_query(iotool_t *c, unsigned int bank, uint16_t max_age_ms);
+/* Write queued records, when iotool_want_write() and POLLOUT */
+int iotool_flush(iotool_t *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define DEFAULT_SAMPLES (16 * 1024 * 1024)
+#define ROUNDS          5
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A clock on pin 0, slow random toggles elsewhere, much like a capture */
+static void
+make_trace(uint16_t *s, size_t n)
+{
+    uint32_t x = 2463534242u;
+    uint16_t v = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if ((x & 0xFF) < 8)
+            v ^= 1u << ((x >> 8) % TRACE_PINS);
+        if (i % 5 == 0)
+            v ^= 1;
+        s[i] = v;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    const struct trace_kernel **k = trace_kernels();
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_SAMPLES;
+    size_t words = (n + 63) / 64;
+    uint16_t *s = malloc(n * sizeof(*s));
+    uint32_t *idx = malloc(n * sizeof(*idx)), *ref_idx = malloc(n * sizeof(*idx));
+    uint64_t *planes = malloc(TRACE_PINS * words * sizeof(*planes));
+    uint64_t *ref_planes = malloc(TRACE_PINS * words * sizeof(*planes));
+    uint64_t high[TRACE_PINS], toggles[TRACE_PINS], ref_high[TRACE_PINS], ref_toggles[TRACE_PINS];
+    size_t nedges, ref_nedges = 0;
+    int fail = 0;
+
+    if (!s || !idx || !ref_idx || !planes || !ref_planes) {
+        perror("malloc");
+        return 1;
+    }
+
+    make_trace(s, n);
+    printf("%zu samples, best kernel %s\n\n", n, trace_kernel()->name);
+    printf("%-8s %12s %12s %12s\n", "kernel", "edges", "transpose", "count");
+
+    for (size_t i = 0; k[i]; i++) {
+        double t[3] = { 1e9, 1e9, 1e9 }, t0;
+
+        for (int r = 0; r < ROUNDS; r++) {
+            t0 = now();
+            nedges = k[i]->edges(s, n, 0, idx);
+            if (now() - t0 < t[0])
+                t[0] = now() - t0;
+
+            t0 = now();
+            k[i]->transpose(s, n, planes, words);
+            if (now() - t0 < t[1])
+                t[1] = now() - t0;
+
+            memset(high, 0, sizeof(high));
+            memset(toggles, 0, sizeof(toggles));
+            t0 = now();
+            k[i]->count(s, n, 0, high, toggles);
+            if (now() - t0 < t[2])
+                t[2] = now() - t0;
+        }
+
+        /* Scalar comes first and is what the others must match */
+        if (i == 0) {
+            ref_nedges = nedges;
+            memcpy(ref_idx, idx, nedges * sizeof(*idx));
+            memcpy(ref_planes, planes, TRACE_PINS * words * sizeof(*planes));
+            memcpy(ref_high, high, sizeof(high));
+            memcpy(ref_toggles, toggles, sizeof(toggles));
+        }
+        else if (nedges != ref_nedges || memcmp(idx, ref_idx, nedges * sizeof(*idx)) ||
+                 memcmp(planes, ref_planes, TRACE_PINS * words * sizeof(*planes)) ||
+                 memcmp(high, ref_high, sizeof(high)) || memcmp(toggles, ref_toggles, sizeof(toggles))) {
+            printf("%-8s differs from scalar\n", k[i]->name);
+            fail = 1;
+            continue;
+        }
+
+        printf("%-8s %9.0f M/s %9.0f M/s %9.0f M/s\n", k[i]->name,
+               n / t[0] / 1e6, n / t[1] / 1e6, n / t[2] / 1e6);
+    }
+
+    printf("\n%zu edges\n", ref_nedges);
+
+    free(s);
+    free(idx);
+    free(ref_idx);
+    free(planes);
+    free(ref_planes);
+
+    return fail;
+}
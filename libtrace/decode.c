@@ -0,0 +1,429 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "decode.h"
+
+struct decoder {
+    struct decode_config cfg;
+    decode_emit_t emit;
+    void *arg;
+    unsigned int id;
+    uint64_t pins;              /* levels before the next change */
+
+    union {
+        struct {
+            uint64_t bit_ns, next, start;
+            int busy, bit;
+            uint8_t byte;
+        } uart;
+        struct {
+            uint64_t start;
+            int busy, bit;
+            uint8_t byte;
+        } i2c;
+        struct {
+            uint64_t start;
+            int bit;
+            uint8_t mosi, miso;
+        } spi;
+        struct {
+            uint64_t t;
+            int32_t pos;
+            int dir;
+        } quad;
+    } u;
+};
+
+/* A chunk of changes, shared by every thread */
+struct chunk {
+    size_t n;
+    unsigned int refs;
+    struct decode_edge e[];
+};
+
+struct worker {
+    decode_pool_t *pool;
+    unsigned int id;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct chunk *queue[DECODE_QUEUE];
+    unsigned int head, tail;
+};
+
+struct decode_pool {
+    unsigned int nthreads;
+    int started;
+    struct worker *w;
+    struct decoder *d;
+    unsigned int ndecoders;
+};
+
+static inline int
+level(const struct decoder *d, uint64_t pins, unsigned int n)
+{
+    return (pins >> d->cfg.pin[n]) & 1;
+}
+
+static void
+emit(struct decoder *d, uint64_t t, enum decode_type type, uint32_t value)
+{
+    struct decode_frame f = { t, type, value };
+
+    d->emit(d->id, &f, d->arg);
+}
+
+/* UART: 8N1, LSB first, sampled in the middle of each bit from the start edge */
+static void
+uart_until(struct decoder *d, uint64_t t)
+{
+    while (d->u.uart.busy && d->u.uart.next < t) {
+        int bit = level(d, d->pins, 0) ^ d->cfg.invert;
+
+        if (d->u.uart.bit == 0 && bit) {
+            /* Glitch, not a start bit */
+            d->u.uart.busy = 0;
+        }
+        else if (d->u.uart.bit >= 1 && d->u.uart.bit <= 8) {
+            d->u.uart.byte |= bit << (d->u.uart.bit - 1);
+        }
+        else if (d->u.uart.bit == 9) {
+            emit(d, d->u.uart.start, bit ? DECODE_BYTE : DECODE_ERROR, d->u.uart.byte);
+            d->u.uart.busy = 0;
+        }
+        d->u.uart.bit++;
+        d->u.uart.next += d->u.uart.bit_ns;
+    }
+}
+
+static void
+uart_edge(struct decoder *d, const struct decode_edge *e)
+{
+    uart_until(d, e->t);
+
+    if (!d->u.uart.busy && level(d, d->pins, 0) != level(d, e->pins, 0) &&
+        (level(d, e->pins, 0) ^ d->cfg.invert) == 0) {
+        d->u.uart.busy = 1;
+        d->u.uart.bit = 0;
+        d->u.uart.byte = 0;
+        d->u.uart.start = e->t;
+        d->u.uart.next = e->t + d->u.uart.bit_ns / 2;
+    }
+}
+
+/* I2C: data on SCL rising, START and STOP are SDA changing while SCL is high */
+static void
+i2c_edge(struct decoder *d, const struct decode_edge *e)
+{
+    int scl0 = level(d, d->pins, 0), scl1 = level(d, e->pins, 0);
+    int sda0 = level(d, d->pins, 1), sda1 = level(d, e->pins, 1);
+
+    if (scl0 && scl1 && sda0 != sda1) {
+        if (!sda1) {
+            emit(d, e->t, DECODE_START, 0);
+            d->u.i2c.busy = 1;
+        }
+        else {
+            emit(d, e->t, DECODE_STOP, 0);
+            d->u.i2c.busy = 0;
+        }
+        d->u.i2c.bit = 0;
+        d->u.i2c.byte = 0;
+        return;
+    }
+
+    if (!d->u.i2c.busy || scl0 || !scl1)
+        return;
+
+    if (d->u.i2c.bit == 0)
+        d->u.i2c.start = e->t;
+    if (d->u.i2c.bit < 8) {
+        d->u.i2c.byte = d->u.i2c.byte << 1 | sda1;
+        if (++d->u.i2c.bit == 8)
+            emit(d, d->u.i2c.start, DECODE_BYTE, d->u.i2c.byte);
+    }
+    else {
+        emit(d, e->t, sda1 ? DECODE_NACK : DECODE_ACK, 0);
+        d->u.i2c.bit = 0;
+        d->u.i2c.byte = 0;
+    }
+}
+
+/* SPI: MSB first, 8 bits, framed by an active low CS when there is one */
+static void
+spi_edge(struct decoder *d, const struct decode_edge *e)
+{
+    int clk0 = level(d, d->pins, 0), clk1 = level(d, e->pins, 0);
+    int cpol = (d->cfg.mode >> 1) & 1, cpha = d->cfg.mode & 1;
+
+    if (d->cfg.pin[3] != DECODE_NO_PIN) {
+        int cs0 = level(d, d->pins, 3), cs1 = level(d, e->pins, 3);
+
+        if (cs0 != cs1) {
+            emit(d, e->t, cs1 ? DECODE_STOP : DECODE_START, 0);
+            d->u.spi.bit = 0;
+        }
+        if (cs1)
+            return;
+    }
+
+    /* Sample on the leading edge with CPHA 0, on the trailing one with CPHA 1 */
+    if (clk0 == clk1 || clk1 != (cpol ^ cpha ^ 1))
+        return;
+
+    if (d->u.spi.bit == 0) {
+        d->u.spi.start = e->t;
+        d->u.spi.mosi = 0;
+        d->u.spi.miso = 0;
+    }
+    d->u.spi.mosi = d->u.spi.mosi << 1 | level(d, e->pins, 1);
+    if (d->cfg.pin[2] != DECODE_NO_PIN)
+        d->u.spi.miso = d->u.spi.miso << 1 | level(d, e->pins, 2);
+    if (++d->u.spi.bit == 8) {
+        emit(d, d->u.spi.start, DECODE_BYTE, d->u.spi.mosi | d->u.spi.miso << 8);
+        d->u.spi.bit = 0;
+    }
+}
+
+/* Quadrature, x4: the position is reported where the direction reverses */
+static void
+quad_edge(struct decoder *d, const struct decode_edge *e)
+{
+    /* Gray order 00 01 11 10: state index of a << 1 | b */
+    static const int8_t gray[4] = { 0, 1, 3, 2 };
+    int s0 = gray[level(d, d->pins, 0) << 1 | level(d, d->pins, 1)];
+    int s1 = gray[level(d, e->pins, 0) << 1 | level(d, e->pins, 1)];
+    int step = (s1 - s0) & 3;
+
+    if (step == 0)
+        return;
+    if (step == 2) {
+        emit(d, e->t, DECODE_ERROR, 0);
+        return;
+    }
+
+    step = step == 1 ? 1 : -1;
+    if (d->u.quad.dir && step != d->u.quad.dir)
+        emit(d, d->u.quad.t, DECODE_POSITION, (uint32_t)d->u.quad.pos);
+    d->u.quad.dir = step;
+    d->u.quad.pos += step;
+    d->u.quad.t = e->t;
+}
+
+static void
+decoder_run(struct decoder *d, const struct decode_edge *e, size_t n)
+{
+    uint64_t mask = 0;
+
+    for (int i = 0; i < 4; i++) {
+        if (d->cfg.pin[i] != DECODE_NO_PIN)
+            mask |= 1ull << d->cfg.pin[i];
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        /* Not our pins. The UART samples lazily, up to its next change */
+        if (!((e[i].pins ^ d->pins) & mask))
+            continue;
+
+        switch (d->cfg.kind) {
+            case DECODE_UART : uart_edge(d, &e[i]); break;
+            case DECODE_I2C : i2c_edge(d, &e[i]); break;
+            case DECODE_SPI : spi_edge(d, &e[i]); break;
+            case DECODE_QUAD : quad_edge(d, &e[i]); break;
+        }
+        d->pins = e[i].pins;
+    }
+}
+
+static void
+decoder_flush(struct decoder *d)
+{
+    if (d->cfg.kind == DECODE_UART)
+        uart_until(d, UINT64_MAX);
+    else if (d->cfg.kind == DECODE_QUAD && d->u.quad.dir)
+        emit(d, d->u.quad.t, DECODE_POSITION, (uint32_t)d->u.quad.pos);
+}
+
+static void *
+worker_main(void *arg)
+{
+    struct worker *w = arg;
+    decode_pool_t *p = w->pool;
+    struct chunk *c;
+
+    for (;;) {
+        pthread_mutex_lock(&w->lock);
+        while (w->head == w->tail)
+            pthread_cond_wait(&w->cond, &w->lock);
+        c = w->queue[w->tail % DECODE_QUEUE];
+        pthread_mutex_unlock(&w->lock);
+
+        if (c == NULL)
+            break;
+
+        for (unsigned int i = w->id; i < p->ndecoders; i += p->nthreads)
+            decoder_run(&p->d[i], c->e, c->n);
+        if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) == 0)
+            free(c);
+
+        /* Room for the feeder once the chunk is done with */
+        pthread_mutex_lock(&w->lock);
+        w->tail++;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    return NULL;
+}
+
+static void
+worker_push(struct worker *w, struct chunk *c)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->head - w->tail == DECODE_QUEUE)
+        pthread_cond_wait(&w->cond, &w->lock);
+    w->queue[w->head++ % DECODE_QUEUE] = c;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+decode_pool_t *
+decode_pool_new(unsigned int nthreads)
+{
+    decode_pool_t *p;
+
+    if (nthreads == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((p = calloc(1, sizeof(*p))) == NULL)
+        return NULL;
+    p->nthreads = nthreads;
+
+    return p;
+}
+
+int
+decode_add(decode_pool_t *p, const struct decode_config *cfg, decode_emit_t emit, void *arg)
+{
+    static const int npins[] = { [DECODE_UART] = 1, [DECODE_I2C] = 2, [DECODE_SPI] = 2, [DECODE_QUAD] = 2 };
+    struct decoder *d;
+
+    if (p->started || (unsigned int)cfg->kind > DECODE_QUAD || emit == NULL ||
+        (cfg->kind == DECODE_UART && cfg->baud == 0) || cfg->mode > 3) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* SPI has an optional miso and cs, the other pins must be there */
+    for (int i = 0; i < (cfg->kind == DECODE_SPI ? 4 : npins[cfg->kind]); i++) {
+        if (cfg->pin[i] >= DECODE_MAX_PINS && (i < npins[cfg->kind] || cfg->pin[i] != DECODE_NO_PIN)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if ((d = realloc(p->d, (p->ndecoders + 1) * sizeof(*d))) == NULL)
+        return -1;
+    p->d = d;
+
+    d = &p->d[p->ndecoders];
+    memset(d, 0, sizeof(*d));
+    d->cfg = *cfg;
+    if (cfg->kind != DECODE_SPI) {
+        for (int i = npins[cfg->kind]; i < 4; i++)
+            d->cfg.pin[i] = DECODE_NO_PIN;
+    }
+    d->emit = emit;
+    d->arg = arg;
+    d->id = p->ndecoders;
+    if (cfg->kind == DECODE_UART)
+        d->u.uart.bit_ns = 1000000000ull / cfg->baud;
+
+    return p->ndecoders++;
+}
+
+int
+decode_start(decode_pool_t *p, uint64_t t, uint64_t pins)
+{
+    if (p->started) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < p->ndecoders; i++) {
+        p->d[i].pins = pins;
+        if (p->d[i].cfg.kind == DECODE_QUAD)
+            p->d[i].u.quad.t = t;
+    }
+
+    /* No thread without a decoder */
+    if (p->nthreads > p->ndecoders)
+        p->nthreads = p->ndecoders ? p->ndecoders : 1;
+    if ((p->w = calloc(p->nthreads, sizeof(*p->w))) == NULL)
+        return -1;
+
+    for (unsigned int i = 0; i < p->nthreads; i++) {
+        struct worker *w = &p->w[i];
+
+        w->pool = p;
+        w->id = i;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        if ((errno = pthread_create(&w->thread, NULL, worker_main, w)) != 0) {
+            p->nthreads = i;
+            return -1;
+        }
+    }
+    p->started = 1;
+
+    return 0;
+}
+
+int
+decode_feed(decode_pool_t *p, const struct decode_edge *e, size_t n)
+{
+    struct chunk *c;
+
+    if (!p->started) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (n == 0)
+        return 0;
+
+    if ((c = malloc(sizeof(*c) + n * sizeof(*e))) == NULL)
+        return -1;
+    c->n = n;
+    c->refs = p->nthreads;
+    memcpy(c->e, e, n * sizeof(*e));
+
+    for (unsigned int i = 0; i < p->nthreads; i++)
+        worker_push(&p->w[i], c);
+
+    return 0;
+}
+
+int
+decode_finish(decode_pool_t *p)
+{
+    for (unsigned int i = 0; i < p->nthreads && p->w; i++)
+        worker_push(&p->w[i], NULL);
+    for (unsigned int i = 0; i < p->nthreads && p->w; i++) {
+        pthread_join(p->w[i].thread, NULL);
+        pthread_mutex_destroy(&p->w[i].lock);
+        pthread_cond_destroy(&p->w[i].cond);
+    }
+
+    if (p->started) {
+        for (unsigned int i = 0; i < p->ndecoders; i++)
+            decoder_flush(&p->d[i]);
+    }
+
+    free(p->w);
+    free(p->d);
+    free(p);
+
+    return 0;
+}
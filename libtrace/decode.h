@@ -0,0 +1,82 @@
+#ifndef _DECODE_H
+#define _DECODE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming protocol decoders over pin transitions. A trace is fed in as
+ * chunks of changes; every decoder sees every chunk, in order, and keeps
+ * only its own small state, so a trace of any length decodes in constant
+ * memory. Decoders are spread over a pool of threads, each decoder always
+ * on the same one, and the chunks are shared between them.
+ */
+
+#define DECODE_MAX_PINS     64
+/* Chunks in flight per thread before decode_feed() waits */
+#define DECODE_QUEUE        8
+
+/* The levels of every pin after a change at t, in ns */
+struct decode_edge {
+    uint64_t t;
+    uint64_t pins;
+};
+
+enum decode_kind {
+    DECODE_UART,        /* pin: rx */
+    DECODE_I2C,         /* pin: scl, sda */
+    DECODE_SPI,         /* pin: clk, mosi, miso, cs */
+    DECODE_QUAD,        /* pin: a, b */
+};
+
+#define DECODE_NO_PIN       0xFF
+
+struct decode_config {
+    enum decode_kind kind;
+    uint8_t pin[4];         /* DECODE_NO_PIN for unused miso or cs */
+    uint32_t baud;          /* UART, 8N1 */
+    uint8_t mode;           /* SPI mode 0-3, CPOL in bit 1, CPHA in bit 0 */
+    uint8_t invert;         /* UART idles low */
+};
+
+enum decode_type {
+    DECODE_BYTE,            /* value; for SPI mosi | miso << 8 */
+    DECODE_START,
+    DECODE_STOP,
+    DECODE_ACK,
+    DECODE_NACK,
+    DECODE_POSITION,        /* quadrature count, as int32_t */
+    DECODE_ERROR,           /* framing error or illegal transition */
+};
+
+struct decode_frame {
+    uint64_t t;             /* start of the frame, ns */
+    enum decode_type type;
+    uint32_t value;
+};
+
+/* Called on the decoder's thread, arg as given to decode_add() */
+typedef void (*decode_emit_t)(unsigned int decoder, const struct decode_frame *f, void *arg);
+
+typedef struct decode_pool decode_pool_t;
+
+/* NULL with errno set on failure */
+decode_pool_t *decode_pool_new(unsigned int nthreads);
+/* Decoder number, or -1 with errno EINVAL. Only before decode_start() */
+int decode_add(decode_pool_t *p, const struct decode_config *cfg, decode_emit_t emit, void *arg);
+/* Levels at t, before the first change, and start the threads */
+int decode_start(decode_pool_t *p, uint64_t t, uint64_t pins);
+/* Queue n changes, waiting while the threads are behind */
+int decode_feed(decode_pool_t *p, const struct decode_edge *e, size_t n);
+/* Decode what is queued, flush the decoders and free the pool */
+int decode_finish(decode_pool_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+static size_t
+scalar_edges(const uint16_t *s, size_t n, uint16_t prev, uint32_t *idx)
+{
+    size_t k = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] != prev)
+            idx[k++] = i;
+        prev = s[i];
+    }
+
+    return k;
+}
+
+static void
+scalar_transpose(const uint16_t *s, size_t n, uint64_t *planes, size_t stride)
+{
+    for (size_t w = 0; w < (n + 63) / 64; w++) {
+        for (unsigned int b = 0; b < TRACE_PINS; b++)
+            planes[b * stride + w] = 0;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        for (unsigned int b = 0; b < TRACE_PINS; b++)
+            planes[b * stride + i / 64] |= (uint64_t)((s[i] >> b) & 1) << (i % 64);
+    }
+}
+
+static void
+scalar_count(const uint16_t *s, size_t n, uint16_t prev, uint64_t *high, uint64_t *toggles)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint16_t d = s[i] ^ prev;
+
+        for (unsigned int b = 0; b < TRACE_PINS; b++) {
+            high[b] += (s[i] >> b) & 1;
+            toggles[b] += (d >> b) & 1;
+        }
+        prev = s[i];
+    }
+}
+
+const struct trace_kernel trace_scalar = {
+    "scalar", scalar_edges, scalar_transpose, scalar_count
+};
+
+static const struct trace_kernel *kernels[5];
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void
+kernels_probe(void)
+{
+    size_t n = 0;
+
+    kernels[n++] = &trace_scalar;
+#if defined(__SSE2__)
+    kernels[n++] = &trace_sse2;
+    if (__builtin_cpu_supports("avx2"))
+        kernels[n++] = &trace_avx2;
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    kernels[n++] = &trace_neon;
+#endif
+    kernels[n] = NULL;
+}
+
+const struct trace_kernel **
+trace_kernels(void)
+{
+    pthread_once(&kernels_once, kernels_probe);
+
+    return kernels;
+}
+
+const struct trace_kernel *
+trace_kernel(void)
+{
+    const struct trace_kernel **list = trace_kernels();
+    size_t n = 0;
+
+    while (list[n + 1])
+        n++;
+
+    return list[n];
+}
+
+void
+trace_stats_init(struct trace_stats *st, uint16_t first)
+{
+    memset(st, 0, sizeof(*st));
+    st->prev = first;
+}
+
+void
+trace_stats_update(struct trace_stats *st, const uint16_t *s, size_t n, uint32_t *idx)
+{
+    const struct trace_kernel *k = trace_kernel();
+    size_t nedges;
+
+    k->count(s, n, st->prev, st->high, st->toggles);
+
+    /* Edges are sparse, the widths are worked out from them alone */
+    nedges = k->edges(s, n, st->prev, idx);
+    for (size_t i = 0; i < nedges; i++) {
+        uint64_t at = st->samples + idx[i];
+        uint16_t before = idx[i] ? s[idx[i] - 1] : st->prev;
+
+        for (uint16_t d = before ^ s[idx[i]]; d; d &= d - 1) {
+            unsigned int b = __builtin_ctz(d);
+            unsigned int level = (before >> b) & 1;
+
+            if (st->last_edge[b]) {
+                uint64_t width = at + 1 - st->last_edge[b];
+
+                if (st->pulses[b][level] == 0 || width < st->min_width[b][level])
+                    st->min_width[b][level] = width;
+                if (width > st->max_width[b][level])
+                    st->max_width[b][level] = width;
+                st->pulses[b][level]++;
+            }
+            st->last_edge[b] = at + 1;
+        }
+    }
+
+    if (n > 0)
+        st->prev = s[n - 1];
+    st->samples += n;
+}
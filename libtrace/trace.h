@@ -0,0 +1,72 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Analysis of dense pin traces: one 16-bit word per sample, GPIOA in the
+ * low byte and GPIOB in the high byte, bit n being pin n.
+ *
+ * The inner loops come in a scalar reference and in SSE2, AVX2 and NEON
+ * versions, picked at run time by trace_kernel(). All of them give the
+ * same results; trace_bench checks this and times them.
+ */
+
+#define TRACE_PINS      16
+
+struct trace_kernel {
+    const char *name;
+    /* Indices i with s[i] != s[i - 1], s[-1] being prev. Returns how many */
+    size_t (*edges)(const uint16_t *s, size_t n, uint16_t prev, uint32_t *idx);
+    /* Bit planes: bit j of planes[b * stride + w] is pin b of s[64 * w + j] */
+    void (*transpose)(const uint16_t *s, size_t n, uint64_t *planes, size_t stride);
+    /* Add, per pin, the samples high and the changes from the sample before */
+    void (*count)(const uint16_t *s, size_t n, uint16_t prev, uint64_t *high, uint64_t *toggles);
+};
+
+extern const struct trace_kernel trace_scalar;
+#if defined(__SSE2__)
+extern const struct trace_kernel trace_sse2;
+extern const struct trace_kernel trace_avx2;
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+extern const struct trace_kernel trace_neon;
+#endif
+
+/* Fastest kernel this CPU runs */
+const struct trace_kernel *trace_kernel(void);
+/* Every kernel this CPU runs, scalar first, NULL terminated */
+const struct trace_kernel **trace_kernels(void);
+
+/*
+ * Pin statistics, updated one chunk of samples at a time so a capture
+ * never needs to be in memory whole. Pulse widths are in samples; a pulse
+ * is counted once both its edges were seen.
+ */
+struct trace_stats {
+    uint64_t samples;
+    uint64_t high[TRACE_PINS];
+    uint64_t toggles[TRACE_PINS];
+    uint64_t pulses[TRACE_PINS][2];     /* [pin][level] */
+    uint64_t min_width[TRACE_PINS][2];
+    uint64_t max_width[TRACE_PINS][2];
+
+    /* Carried across chunks */
+    uint16_t prev;
+    uint64_t last_edge[TRACE_PINS];     /* sample index + 1, 0 for none */
+};
+
+void trace_stats_init(struct trace_stats *st, uint16_t first);
+/* Edge indices go through idx, which must have room for n */
+void trace_stats_update(struct trace_stats *st, const uint16_t *s, size_t n, uint32_t *idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
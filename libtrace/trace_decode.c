@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "decode.h"
+
+/* Changes handed to the decoders at a time */
+#define CHUNK       65536
+
+static struct {
+    char id[16];
+    char name[32];
+} var[DECODE_MAX_PINS];
+static unsigned int nvars;
+
+static const char *names[] = {
+    [DECODE_UART] = "uart", [DECODE_I2C] = "i2c", [DECODE_SPI] = "spi", [DECODE_QUAD] = "quad",
+};
+#define MAX_DECODERS 64
+static enum decode_kind kinds[MAX_DECODERS];
+
+static void
+usage(const char *pname)
+{
+    fprintf(stderr, "Usage: %s [-j <threads>] <file.vcd> <decoder>...\n", pname);
+    fprintf(stderr, "   Decoders:   uart:rx=<pin>,baud=<n>[,invert]\n");
+    fprintf(stderr, "               i2c:scl=<pin>,sda=<pin>\n");
+    fprintf(stderr, "               spi:clk=<pin>,mosi=<pin>[,miso=<pin>][,cs=<pin>][,mode=<0-3>]\n");
+    fprintf(stderr, "               quad:a=<pin>,b=<pin>\n");
+    fprintf(stderr, "   Pins are signal names of the trace, like DI03.\n");
+
+    exit(1);
+}
+
+static int
+var_find(const char *id, const char *name)
+{
+    for (unsigned int i = 0; i < nvars; i++) {
+        if ((id && strcmp(var[i].id, id) == 0) || (name && strcmp(var[i].name, name) == 0))
+            return i;
+    }
+
+    return -1;
+}
+
+static int
+parse_decoder(const char *spec, struct decode_config *cfg)
+{
+    static const char *keys[][4] = {
+        [DECODE_UART] = { "rx" },
+        [DECODE_I2C] = { "scl", "sda" },
+        [DECODE_SPI] = { "clk", "mosi", "miso", "cs" },
+        [DECODE_QUAD] = { "a", "b" },
+    };
+    char buf[256], *kind, *opt, *save;
+
+    snprintf(buf, sizeof(buf), "%s", spec);
+    memset(cfg, 0, sizeof(*cfg));
+    memset(cfg->pin, DECODE_NO_PIN, sizeof(cfg->pin));
+
+    if ((kind = strtok_r(buf, ":", &save)) == NULL)
+        return -1;
+    for (cfg->kind = 0; cfg->kind <= DECODE_QUAD; cfg->kind++) {
+        if (strcmp(kind, names[cfg->kind]) == 0)
+            break;
+    }
+    if (cfg->kind > DECODE_QUAD)
+        return -1;
+
+    while ((opt = strtok_r(NULL, ",", &save)) != NULL) {
+        char *val = strchr(opt, '=');
+        int i;
+
+        if (strcmp(opt, "invert") == 0) {
+            cfg->invert = 1;
+            continue;
+        }
+        if (val == NULL)
+            return -1;
+        *val++ = '\0';
+
+        if (strcmp(opt, "baud") == 0) {
+            cfg->baud = strtoul(val, NULL, 0);
+            continue;
+        }
+        if (strcmp(opt, "mode") == 0) {
+            cfg->mode = strtoul(val, NULL, 0);
+            continue;
+        }
+
+        for (i = 0; i < 4; i++) {
+            if (keys[cfg->kind][i] && strcmp(opt, keys[cfg->kind][i]) == 0)
+                break;
+        }
+        if (i == 4 || (cfg->pin[i] = var_find(NULL, val)) == DECODE_NO_PIN) {
+            fprintf(stderr, "No signal %s in the trace\n", val);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+print_frame(unsigned int decoder, const struct decode_frame *f, void *arg)
+{
+    static const char *types[] = { "byte", "start", "stop", "ack", "nack", "position", "error" };
+    double us = f->t / 1e3;
+
+    switch (f->type) {
+        case DECODE_BYTE :
+            if (kinds[decoder] == DECODE_SPI)
+                printf("%14.3f %s%u byte 0x%02x 0x%02x\n", us, names[kinds[decoder]], decoder,
+                       f->value & 0xFF, f->value >> 8);
+            else
+                printf("%14.3f %s%u byte 0x%02x\n", us, names[kinds[decoder]], decoder, f->value);
+        break;
+        case DECODE_POSITION :
+            printf("%14.3f %s%u position %d\n", us, names[kinds[decoder]], decoder, (int32_t)f->value);
+        break;
+        default :
+            printf("%14.3f %s%u %s\n", us, names[kinds[decoder]], decoder, types[f->type]);
+        break;
+    }
+}
+
+/* Nanoseconds per unit of "$timescale <n><unit>" */
+static uint64_t
+timescale(const char *s)
+{
+    static const struct { const char *unit; uint64_t ns; } units[] = {
+        { "s", 1000000000ull }, { "ms", 1000000 }, { "us", 1000 }, { "ns", 1 },
+    };
+    char unit[4] = "";
+    unsigned long n = 1;
+
+    if (sscanf(s, " %lu %3s", &n, unit) < 1)
+        return 0;
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        if (strcmp(unit, units[i].unit) == 0)
+            return n * units[i].ns;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct decode_edge edges[CHUNK];
+    static char outbuf[256 * 1024];
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    decode_pool_t *pool;
+    char line[512];
+    uint64_t scale = 1, t = 0, pins = 0;
+    size_t nedges = 0;
+    int opt, header = 1, started = 0, changed = 0;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        if (opt != 'j' || (nthreads = atol(optarg)) < 1)
+            usage(argv[0]);
+    }
+    if (argc - optind < 2)
+        usage(argv[0]);
+
+    if ((f = fopen(argv[optind], "r")) == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        exit(1);
+    }
+
+    /* Signals first, the decoders refer to them by name */
+    while (header && fgets(line, sizeof(line), f)) {
+        char id[16], name[32];
+        unsigned int size;
+
+        if (strncmp(line, "$timescale", 10) == 0) {
+            if ((scale = timescale(line + 10)) == 0 &&
+                (!fgets(line, sizeof(line), f) || (scale = timescale(line)) == 0)) {
+                fprintf(stderr, "Unknown timescale\n");
+                exit(1);
+            }
+        }
+        else if (sscanf(line, "$var %*s %u %15s %31s", &size, id, name) == 3 && size == 1) {
+            if (nvars == DECODE_MAX_PINS) {
+                fprintf(stderr, "More than %d signals\n", DECODE_MAX_PINS);
+                exit(1);
+            }
+            strcpy(var[nvars].id, id);
+            strcpy(var[nvars].name, name);
+            nvars++;
+        }
+        else if (strncmp(line, "$enddefinitions", 15) == 0)
+            header = 0;
+    }
+
+    if ((pool = decode_pool_new(nthreads)) == NULL) {
+        perror("decode_pool_new");
+        exit(1);
+    }
+    if (argc - optind - 1 > MAX_DECODERS) {
+        fprintf(stderr, "More than %d decoders\n", MAX_DECODERS);
+        exit(1);
+    }
+    for (int i = optind + 1; i < argc; i++) {
+        struct decode_config cfg;
+        int n;
+
+        if (parse_decoder(argv[i], &cfg) < 0 || (n = decode_add(pool, &cfg, print_frame, NULL)) < 0 ||
+            n >= MAX_DECODERS) {
+            fprintf(stderr, "Bad decoder %s\n", argv[i]);
+            usage(argv[0]);
+        }
+        kinds[n] = cfg.kind;
+    }
+
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+    /* Changes: what was set by the first timestamp is where decoding starts */
+    while (fgets(line, sizeof(line), f)) {
+        int i;
+
+        if (line[0] == '#') {
+            uint64_t next = strtoull(line + 1, NULL, 10) * scale;
+
+            if (!started && changed) {
+                if (decode_start(pool, t, pins) < 0) {
+                    perror("decode_start");
+                    exit(1);
+                }
+                started = 1;
+            }
+            else if (changed) {
+                edges[nedges].t = t;
+                edges[nedges].pins = pins;
+                if (++nedges == CHUNK) {
+                    decode_feed(pool, edges, nedges);
+                    nedges = 0;
+                }
+            }
+            t = next;
+            changed = 0;
+            continue;
+        }
+
+        if (!strchr("01xzXZ", line[0]) || line[0] == '\0')
+            continue;
+        line[strcspn(line, " \r\n")] = '\0';
+        if ((i = var_find(line + 1, NULL)) < 0)
+            continue;
+
+        if (line[0] == '1')
+            pins |= 1ull << i;
+        else
+            pins &= ~(1ull << i);
+        changed = 1;
+    }
+    fclose(f);
+
+    if (!started && decode_start(pool, t, pins) < 0) {
+        perror("decode_start");
+        exit(1);
+    }
+    if (changed) {
+        edges[nedges].t = t;
+        edges[nedges].pins = pins;
+        nedges++;
+    }
+    decode_feed(pool, edges, nedges);
+    decode_finish(pool);
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "trace.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+/*
+ * NEON has no movemask. The top bit of each byte is spread over the byte,
+ * weighted by its lane, and the pairwise adds sum each half into one byte.
+ * This only uses ARMv7 instructions, so it runs on the A20.
+ */
+static inline uint16_t
+neon_movemask(uint8x16_t x)
+{
+    static const uint8_t weight[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t top = vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(x), 7));
+    uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vandq_u8(top, vld1q_u8(weight)))));
+
+    return (uint16_t)(vgetq_lane_u64(sum, 0) | vgetq_lane_u64(sum, 1) << 8);
+}
+
+static inline void
+neon_planes(const uint16_t *s, uint16_t *out)
+{
+    uint16x8_t a = vld1q_u16(s);
+    uint16x8_t b = vld1q_u16(s + 8);
+    uint8x16_t lo = vcombine_u8(vmovn_u16(a), vmovn_u16(b));
+    uint8x16_t hi = vcombine_u8(vshrn_n_u16(a, 8), vshrn_n_u16(b, 8));
+
+    for (int bit = 7; bit >= 0; bit--) {
+        out[bit] = neon_movemask(lo);
+        out[bit + 8] = neon_movemask(hi);
+        lo = vaddq_u8(lo, lo);
+        hi = vaddq_u8(hi, hi);
+    }
+}
+
+static size_t
+neon_edges(const uint16_t *s, size_t n, uint16_t prev, uint32_t *idx)
+{
+    size_t i = 1, k = 0;
+
+    if (n == 0)
+        return 0;
+    if (s[0] != prev)
+        idx[k++] = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t eq = vceqq_u16(vld1q_u16(s + i), vld1q_u16(s + i - 1));
+        /* One byte per sample, all ones where it changed */
+        uint64_t m = ~vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(eq)), 0);
+
+        while (m) {
+            unsigned int byte = __builtin_ctzll(m) / 8;
+            idx[k++] = i + byte;
+            m &= ~(0xFFull << (byte * 8));
+        }
+    }
+
+    for (; i < n; i++) {
+        if (s[i] != s[i - 1])
+            idx[k++] = i;
+    }
+
+    return k;
+}
+
+static void
+neon_transpose(const uint16_t *s, size_t n, uint64_t *planes, size_t stride)
+{
+    uint16_t p[4][16];
+    size_t w = 0;
+
+    for (; (w + 1) * 64 <= n; w++) {
+        for (int q = 0; q < 4; q++)
+            neon_planes(s + w * 64 + q * 16, p[q]);
+        for (int b = 0; b < TRACE_PINS; b++)
+            planes[b * stride + w] = p[0][b] | (uint64_t)p[1][b] << 16 |
+                                     (uint64_t)p[2][b] << 32 | (uint64_t)p[3][b] << 48;
+    }
+
+    if (w * 64 < n) {
+        for (int b = 0; b < TRACE_PINS; b++)
+            planes[b * stride + w] = 0;
+        for (size_t i = w * 64; i < n; i++) {
+            for (int b = 0; b < TRACE_PINS; b++)
+                planes[b * stride + w] |= (uint64_t)((s[i] >> b) & 1) << (i % 64);
+        }
+    }
+}
+
+static void
+neon_count(const uint16_t *s, size_t n, uint16_t prev, uint64_t *high, uint64_t *toggles)
+{
+    uint16_t p[16], d[16];
+    size_t i = 1;
+
+    if (n == 0)
+        return;
+
+    for (int b = 0; b < TRACE_PINS; b++) {
+        high[b] += (s[0] >> b) & 1;
+        toggles[b] += ((s[0] ^ prev) >> b) & 1;
+    }
+
+    for (; i + 16 <= n; i += 16) {
+        vst1q_u16(d, veorq_u16(vld1q_u16(s + i), vld1q_u16(s + i - 1)));
+        vst1q_u16(d + 8, veorq_u16(vld1q_u16(s + i + 8), vld1q_u16(s + i + 7)));
+        neon_planes(s + i, p);
+        neon_planes(d, d);
+        for (int b = 0; b < TRACE_PINS; b++) {
+            high[b] += __builtin_popcount(p[b]);
+            toggles[b] += __builtin_popcount(d[b]);
+        }
+    }
+
+    for (; i < n; i++) {
+        for (int b = 0; b < TRACE_PINS; b++) {
+            high[b] += (s[i] >> b) & 1;
+            toggles[b] += ((s[i] ^ s[i - 1]) >> b) & 1;
+        }
+    }
+}
+
+const struct trace_kernel trace_neon = {
+    "neon", neon_edges, neon_transpose, neon_count
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "trace.h"
+
+#if defined(__SSE2__)
+
+#include <immintrin.h>
+
+/*
+ * Bit planes of 16 samples: the low and high bytes of each sample are
+ * packed into two byte vectors, and movemask takes the top bit of every
+ * byte. Adding a vector to itself moves the next bit to the top.
+ */
+static inline void
+sse2_planes(const uint16_t *s, uint16_t *out)
+{
+    const __m128i lo8 = _mm_set1_epi16(0x00FF);
+    __m128i a = _mm_loadu_si128((const __m128i *)s);
+    __m128i b = _mm_loadu_si128((const __m128i *)(s + 8));
+    __m128i lo = _mm_packus_epi16(_mm_and_si128(a, lo8), _mm_and_si128(b, lo8));
+    __m128i hi = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+
+    for (int bit = 7; bit >= 0; bit--) {
+        out[bit] = _mm_movemask_epi8(lo);
+        out[bit + 8] = _mm_movemask_epi8(hi);
+        lo = _mm_add_epi8(lo, lo);
+        hi = _mm_add_epi8(hi, hi);
+    }
+}
+
+/* Samples xor the one before, so planes of it count changes */
+static inline void
+sse2_diff(const uint16_t *s, uint16_t *d)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)s);
+    __m128i b = _mm_loadu_si128((const __m128i *)(s + 8));
+
+    _mm_storeu_si128((__m128i *)d, _mm_xor_si128(a, _mm_loadu_si128((const __m128i *)(s - 1))));
+    _mm_storeu_si128((__m128i *)(d + 8), _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)(s + 7))));
+}
+
+static size_t
+sse2_edges(const uint16_t *s, size_t n, uint16_t prev, uint32_t *idx)
+{
+    size_t i = 1, k = 0;
+
+    if (n == 0)
+        return 0;
+    if (s[0] != prev)
+        idx[k++] = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(s + i)),
+                                     _mm_loadu_si128((const __m128i *)(s + i - 1)));
+        /* Two mask bits per sample */
+        unsigned int m = _mm_movemask_epi8(eq) ^ 0xFFFF;
+
+        for (; m; m &= m - 1, m &= m - 1)
+            idx[k++] = i + __builtin_ctz(m) / 2;
+    }
+
+    for (; i < n; i++) {
+        if (s[i] != s[i - 1])
+            idx[k++] = i;
+    }
+
+    return k;
+}
+
+static void
+sse2_transpose(const uint16_t *s, size_t n, uint64_t *planes, size_t stride)
+{
+    uint16_t p[4][16];
+    size_t w = 0;
+
+    for (; (w + 1) * 64 <= n; w++) {
+        for (int q = 0; q < 4; q++)
+            sse2_planes(s + w * 64 + q * 16, p[q]);
+        for (int b = 0; b < TRACE_PINS; b++)
+            planes[b * stride + w] = p[0][b] | (uint64_t)p[1][b] << 16 |
+                                     (uint64_t)p[2][b] << 32 | (uint64_t)p[3][b] << 48;
+    }
+
+    if (w * 64 < n) {
+        for (int b = 0; b < TRACE_PINS; b++)
+            planes[b * stride + w] = 0;
+        for (size_t i = w * 64; i < n; i++) {
+            for (int b = 0; b < TRACE_PINS; b++)
+                planes[b * stride + w] |= (uint64_t)((s[i] >> b) & 1) << (i % 64);
+        }
+    }
+}
+
+static void
+sse2_count(const uint16_t *s, size_t n, uint16_t prev, uint64_t *high, uint64_t *toggles)
+{
+    uint16_t p[16], d[16];
+    size_t i = 1;
+
+    if (n == 0)
+        return;
+
+    /* The first sample against prev, then each against the one before */
+    for (int b = 0; b < TRACE_PINS; b++) {
+        high[b] += (s[0] >> b) & 1;
+        toggles[b] += ((s[0] ^ prev) >> b) & 1;
+    }
+
+    for (; i + 16 <= n; i += 16) {
+        sse2_planes(s + i, p);
+        sse2_diff(s + i, d);
+        sse2_planes(d, d);
+        for (int b = 0; b < TRACE_PINS; b++) {
+            high[b] += __builtin_popcount(p[b]);
+            toggles[b] += __builtin_popcount(d[b]);
+        }
+    }
+
+    for (; i < n; i++) {
+        for (int b = 0; b < TRACE_PINS; b++) {
+            high[b] += (s[i] >> b) & 1;
+            toggles[b] += ((s[i] ^ s[i - 1]) >> b) & 1;
+        }
+    }
+}
+
+const struct trace_kernel trace_sse2 = {
+    "sse2", sse2_edges, sse2_transpose, sse2_count
+};
+
+/*
+ * AVX2 works on 32 samples at a time. The packs work within each 128-bit
+ * half, a permute puts the samples back in order. Built with a target
+ * attribute and only used when the CPU has it.
+ */
+#define AVX2 __attribute__((target("avx2,popcnt")))
+
+static inline AVX2 void
+avx2_planes(const uint16_t *s, uint32_t *out)
+{
+    const __m256i lo8 = _mm256_set1_epi16(0x00FF);
+    __m256i a = _mm256_loadu_si256((const __m256i *)s);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(s + 16));
+    __m256i lo = _mm256_packus_epi16(_mm256_and_si256(a, lo8), _mm256_and_si256(b, lo8));
+    __m256i hi = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+
+    lo = _mm256_permute4x64_epi64(lo, 0xD8);
+    hi = _mm256_permute4x64_epi64(hi, 0xD8);
+
+    for (int bit = 7; bit >= 0; bit--) {
+        out[bit] = _mm256_movemask_epi8(lo);
+        out[bit + 8] = _mm256_movemask_epi8(hi);
+        lo = _mm256_add_epi8(lo, lo);
+        hi = _mm256_add_epi8(hi, hi);
+    }
+}
+
+static AVX2 size_t
+avx2_edges(const uint16_t *s, size_t n, uint16_t prev, uint32_t *idx)
+{
+    size_t i = 1, k = 0;
+
+    if (n == 0)
+        return 0;
+    if (s[0] != prev)
+        idx[k++] = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i eq = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(s + i)),
+                                        _mm256_loadu_si256((const __m256i *)(s + i - 1)));
+        uint32_t m = ~(uint32_t)_mm256_movemask_epi8(eq);
+
+        for (; m; m &= m - 1, m &= m - 1)
+            idx[k++] = i + __builtin_ctz(m) / 2;
+    }
+
+    for (; i < n; i++) {
+        if (s[i] != s[i - 1])
+            idx[k++] = i;
+    }
+
+    return k;
+}
+
+static AVX2 void
+avx2_transpose(const uint16_t *s, size_t n, uint64_t *planes, size_t stride)
+{
+    uint32_t p[2][16];
+    size_t w = 0;
+
+    for (; (w + 1) * 64 <= n; w++) {
+        avx2_planes(s + w * 64, p[0]);
+        avx2_planes(s + w * 64 + 32, p[1]);
+        for (int b = 0; b < TRACE_PINS; b++)
+            planes[b * stride + w] = p[0][b] | (uint64_t)p[1][b] << 32;
+    }
+
+    if (w * 64 < n) {
+        for (int b = 0; b < TRACE_PINS; b++)
+            planes[b * stride + w] = 0;
+        for (size_t i = w * 64; i < n; i++) {
+            for (int b = 0; b < TRACE_PINS; b++)
+                planes[b * stride + w] |= (uint64_t)((s[i] >> b) & 1) << (i % 64);
+        }
+    }
+}
+
+static AVX2 void
+avx2_count(const uint16_t *s, size_t n, uint16_t prev, uint64_t *high, uint64_t *toggles)
+{
+    uint32_t p[16], d[16];
+    uint16_t x[32];
+    size_t i = 1;
+
+    if (n == 0)
+        return;
+
+    for (int b = 0; b < TRACE_PINS; b++) {
+        high[b] += (s[0] >> b) & 1;
+        toggles[b] += ((s[0] ^ prev) >> b) & 1;
+    }
+
+    for (; i + 32 <= n; i += 32) {
+        for (int h = 0; h < 2; h++) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(s + i + h * 16));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + h * 16 - 1));
+            _mm256_storeu_si256((__m256i *)(x + h * 16), _mm256_xor_si256(a, b));
+        }
+        avx2_planes(s + i, p);
+        avx2_planes(x, d);
+        for (int b = 0; b < TRACE_PINS; b++) {
+            high[b] += __builtin_popcount(p[b]);
+            toggles[b] += __builtin_popcount(d[b]);
+        }
+    }
+
+    for (; i < n; i++) {
+        for (int b = 0; b < TRACE_PINS; b++) {
+            high[b] += (s[i] >> b) & 1;
+            toggles[b] += ((s[i] ^ s[i - 1]) >> b) & 1;
+        }
+    }
+}
+
+const struct trace_kernel trace_avx2 = {
+    "avx2", avx2_edges, avx2_transpose, avx2_count
+};
+
+#endif
@@ -8,36 +8,13 @@
 #include <poll.h>
 #include <time.h>
 #include "i2c.h"
+#include "mcp23017.h"
 
 #define SYSFS_GPIO_DIR "/sys/class/gpio"
 #define MAX_BUF 64
 #define TEST_CYCLE_NUM 100
 
 #define I2C_ADDR 0x20
-/* MCP12X017 registers when IOCON.BANK = 0 */
-
-#define MCP23017_IODIRA    0x00
-#define MCP23017_IODIRB    0x01
-#define MCP23017_IPOLA     0x02
-#define MCP23017_IPOLB     0x03
-#define MCP23017_GPINTENA  0x04
-#define MCP23017_GPINTENB  0x05
-#define MCP23017_DEFVALA   0x06
-#define MCP23017_DEFVALB   0x07
-#define MCP23017_INTCONA   0x08
-#define MCP23017_INTCONB   0x09
-#define MCP23017_IOCONA    0x0A
-#define MCP23017_IOCONB    0x0B
-#define MCP23017_GPPUA     0x0C
-#define MCP23017_GPPUB     0x0D
-#define MCP23017_INTFA     0x0E
-#define MCP23017_INTFB     0x0F
-#define MCP23017_INTCAPA   0x10
-#define MCP23017_INTCAPB   0x11
-#define MCP23017_GPIOA     0x12
-#define MCP23017_GPIOB     0x13
-#define MCP23017_OLATA     0x14
-#define MCP23017_OLATB     0x15
 
 /****************************************************************
  * gpio_export
@@ -156,8 +133,10 @@ int gpio_fd_close(int fd)
 
 int main(void) {
     i2c_t i2c;
+    mcp23017_t mcp;
+    struct mcp23017_events ev;
     struct pollfd fdset;
-    uint8_t data, v;
+    uint8_t v;
     int gpio_fd, rc;
     char *buf[MAX_BUF];
     int len, cnt;
@@ -168,41 +147,17 @@ int main(void) {
         exit(1);
     }
 
-    /* Enable interrupts on Port A */
-    uint8_t inta[] = { MCP23017_GPINTENA, 0xFF };
-    /* Port B 0-3 to output */
-    uint8_t portb_dir[] = { MCP23017_IODIRB, 0xF0 };
-    uint8_t porta_dir[] = { MCP23017_IODIRA, 0xFF };
-    /* Enable pull-ups Port A 4-7 */
-    uint8_t pulla[] = { MCP23017_GPPUA, 0xF0 };
-    uint8_t outp[] = { MCP23017_GPIOB, 0x00 };
-
-    struct i2c_msg conf[] =
-        {
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = portb_dir },
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = porta_dir },
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = pulla },
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = inta }
-        };
-
-    uint8_t AADR = 0x12;
-    struct i2c_msg padata[] =
-        {
-            { .addr = I2C_ADDR, .flags = 0, .len = 1, .buf = &AADR },
-            { .addr = I2C_ADDR, .flags = I2C_M_RD, .len = 1, .buf = &data }
-        };
-
-    struct i2c_msg output[] =
-        {
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = outp }
-        };
-
-    /* Transfer I2C messages */
-    for (size_t i = 0; i < 4; i++) {
-        if (i2c_transfer(&i2c, &conf[i], 1) < 0) {
-            fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-            exit(1);
-        }
+    mcp23017_open(&mcp, &i2c, I2C_ADDR);
+
+    /* Port B 0-3 to output, off */
+    if (mcp23017_write(&mcp, MCP23017_OLAT, MCP23017_PORT_B, 0x00) < 0 ||
+        mcp23017_write_pair(&mcp, MCP23017_IODIR, 0xFF, 0xF0) < 0 ||
+        /* Enable pull-ups Port A 4-7 */
+        mcp23017_write(&mcp, MCP23017_GPPU, MCP23017_PORT_A, 0xF0) < 0 ||
+        /* Enable interrupts on Port A */
+        mcp23017_write(&mcp, MCP23017_GPINTEN, MCP23017_PORT_A, 0xFF) < 0) {
+        fprintf(stderr, "mcp23017_write(): %s\n", mcp23017_errmsg(&mcp));
+        exit(1);
     }
 
     gpio_export(241);
@@ -221,14 +176,13 @@ int main(void) {
             continue;
         }
 
-        outp[1] = (0x00 | 1 << r);
         v = r;
         cnt++;
-        if (i2c_transfer(&i2c, output, 1) < 0) {
-            fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
+        if (mcp23017_update(&mcp, MCP23017_OLAT, MCP23017_PORT_B, 0x0F, 1 << r) < 0) {
+            fprintf(stderr, "mcp23017_update(): %s\n", mcp23017_errmsg(&mcp));
             exit(1);
         }
-        printf("O: 0x%.2x\n", outp[1]);
+        printf("O: 0x%.2x\n", mcp23017_shadow(&mcp, MCP23017_OLAT, MCP23017_PORT_B));
 
         rc = poll(&fdset, 1, -1);
         if (rc < 0) {
@@ -239,16 +193,15 @@ int main(void) {
 			lseek(fdset.fd, 0, SEEK_SET);
 			len = read(fdset.fd, buf, MAX_BUF);
 
-            for (size_t i = 0; i < 2; i++) {
-                if (i2c_transfer(&i2c, &padata[i], 1) < 0) {
-                    fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                    exit(1);
-                }
+            if (mcp23017_read_events(&mcp, &ev) < 0) {
+                fprintf(stderr, "mcp23017_read_events(): %s\n", mcp23017_errmsg(&mcp));
+                exit(1);
             }
-            printf("I: 0x%.2x\n\n", data & 0x0F);
+            printf("I: 0x%.2x\n\n", ev.gpio[MCP23017_PORT_A] & 0x0F);
 		}
     }
 
+    mcp23017_close(&mcp);
     i2c_close(&i2c);
 
     return 0;
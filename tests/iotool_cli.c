@@ -4,33 +4,16 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <sys/un.h>
 #include <poll.h>
-#include <linux/can.h>
 #include <stdint.h>
 
-#define SOCK_PATH "/var/run/iotool.sock"
+#include "iotool.h"
 
 uint8_t inputs[]  = {0x01, 0x02, 0x04, 0x08};
 uint8_t scout[]   = {0x10, 0x20, 0x40, 0x80};
 
-typedef struct iotool {
-    uint8_t command;
-    uint8_t input_bits;
-    uint8_t output_bits;
-} io_t;
-
-enum {
-    INPUT_INFO,
-    OUTPUT_INFO,
-    SHORT_CIRCUIT,
-    SET_OUTPUT_BIT,
-    SET_ALL_OUTPUT_BIT,
-    CLEAR_OUTPUT_BIT,
-    CLEAR_ALL_OUTPUT_BIT
-};
+/* Oldest input state we accept for the initial query */
+#define QUERY_MAX_AGE_MS 100
 
 volatile sig_atomic_t exit_flag = 0;
 
@@ -40,70 +23,81 @@ signal_handler(int s)
     exit_flag = 1;
 }
 
+void
+print_record(const io_t *rec, void *arg)
+{
+    switch (IO_CMD(rec->command)) {
+        case INPUT_INFO :
+            for (size_t i = 0; i < 4; i++) {
+                printf("DI%zu -> %d\n", i, (rec->input_bits & inputs[i]) ? 1 : 0);
+            }
+            printf("\n");
+        break;
+        case OUTPUT_INFO :
+            for (size_t i = 0; i < 4; i++) {
+                printf("DI%zu -> %d\n", i, (rec->input_bits & inputs[i]) ? 1 : 0);
+            }
+            for (size_t i = 0; i < 4; i++) {
+                printf("DO%zu -> %d\n", i, (rec->output_bits & (1 << i)) ? 1 : 0);
+            }
+            printf("\n");
+        break;
+        case SHORT_CIRCUIT :
+            for (size_t i = 0; i < 4; i++) {
+                if (rec->input_bits & inputs[i])
+                    printf("DO%zu was in short circuit\n", i);
+            }
+        break;
+        default : break;
+    }
+}
+
 int
 main(void)
 {
-    int s, t, len;
-    struct sockaddr_un remote;
-    io_t iotool_data;
+    iotool_t c;
+    struct pollfd pfd[1];
+    int connected = 0;
 
     signal(SIGINT, signal_handler);
 
-    if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-        perror("socket");
+    printf("Trying to connect...\n");
+
+    if (iotool_open(&c, IOTOOL_SOCK_PATH) < 0) {
+        perror("iotool_open");
         exit(1);
     }
 
-    printf("Trying to connect...\n");
-
-    remote.sun_family = AF_UNIX;
-    strcpy(remote.sun_path, SOCK_PATH);
-    len = strlen(remote.sun_path) + sizeof(remote.sun_family);
-    if (connect(s, (struct sockaddr *)&remote, len) == -1) {
-        perror("connect");
+    /* Current state, rather than waiting for the next interrupt */
+    if (iotool_query(&c, 0, QUERY_MAX_AGE_MS) < 0) {
+        perror("iotool_query");
         exit(1);
     }
 
-    printf("Connected.\n");
+    while (!exit_flag) {
+        /* The library reconnects by itself and asks the query again */
+        if ((iotool_fd(&c) >= 0) != connected) {
+            connected = !connected;
+            printf(connected ? "Connected.\n" : "Server closed connection, reconnecting...\n");
+        }
 
-    int ret_poll;
-    struct pollfd input[1]; input[0].fd = s; input[0].events = POLLIN;
+        pfd[0].fd = iotool_fd(&c);
+        pfd[0].events = POLLIN | (iotool_want_write(&c) ? POLLOUT : 0);
 
-    while(!exit_flag) {
-        ret_poll = poll(input, 1, -1);
-        if (ret_poll < 0) {
-            exit_flag = 1;
+        if (poll(pfd, 1, iotool_timeout_ms(&c)) < 0) {
+            if (errno != EINTR)
+                perror("poll");
             continue;
         }
 
-        t=recv(s, &iotool_data, sizeof(struct iotool), 0);
-
-        if (t > 0) {
-            switch (iotool_data.command) {
-                case INPUT_INFO :
-                    for (size_t i = 0; i < 4; i++) {
-                        printf("DI%zu -> %d\n", i, (iotool_data.input_bits & inputs[i]) ? 1 : 0);
-                    }
-                    printf("\n");
-                break;
-                case OUTPUT_INFO :
-                break;
-                case SHORT_CIRCUIT :
-                    for (size_t i = 0; i < 4; i++) {
-                        if (iotool_data.input_bits & inputs[i])
-                            printf("DO%zu was in short circuit\n");
-                    }
-                break;
-                default : break;
-            }
-        } else {
-            if (t < 0) perror("recv");
-            else printf("Server closed connection\n");
+        /* Everything the daemon sent since, in one read */
+        if (iotool_dispatch(&c, print_record, NULL) < 0) {
+            perror("iotool_dispatch");
             exit(1);
         }
     }
 
-    close(s);
+    iotool_close(&c);
 
     return 0;
 }
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "analyzer.h"
+
+/* Longest record: ten bytes of LEB128, expander, two ports */
+#define RECORD_MAX  13
+
+int
+analyzer_init(analyzer_t *a, const struct board *b, size_t size)
+{
+    memset(a, 0, sizeof(*a));
+    a->board = b;
+    a->size = size < 1024 ? 1024 : size;
+
+    if ((a->ring = malloc(a->size)) == NULL)
+        return -1;
+
+    return 0;
+}
+
+void
+analyzer_free(analyzer_t *a)
+{
+    free(a->ring);
+    a->ring = NULL;
+}
+
+int
+analyzer_cond_parse(const struct board *b, const char *spec, struct analyzer_cond *c)
+{
+    const struct board_pin *pin = NULL;
+    unsigned int n, e, bit;
+    char port, when, *end;
+
+    memset(c, 0, sizeof(*c));
+
+    if ((end = strchr(spec, '=')) == NULL || end[1] == '\0' || end[2] != '\0')
+        goto inval;
+    when = end[1];
+
+    if (sscanf(spec, "DI%u=", &n) == 1 && n < b->ninputs)
+        pin = &b->input[n];
+    else if (sscanf(spec, "DO%u=", &n) == 1 && n < b->noutputs)
+        pin = &b->output[n];
+    else if (sscanf(spec, "SC%u=", &n) == 1 && n < b->noutputs && b->fault[n].mask)
+        pin = &b->fault[n];
+    else if (sscanf(spec, "X%u_%c%u=", &e, &port, &bit) == 3 && e < b->nexpanders &&
+             (port == 'A' || port == 'B') && bit < 8) {
+        c->exp = e;
+        c->port = port == 'A' ? BOARD_PORT_A : BOARD_PORT_B;
+        c->mask = 1u << bit;
+    }
+    else
+        goto inval;
+
+    if (pin) {
+        c->exp = pin->exp;
+        c->port = pin->port;
+        c->mask = pin->mask;
+    }
+
+    switch (when) {
+        case '0' : c->when = ANALYZER_LOW; break;
+        case '1' : c->when = ANALYZER_HIGH; break;
+        case 'r' : c->when = ANALYZER_RISE; break;
+        case 'f' : c->when = ANALYZER_FALL; break;
+        default : goto inval;
+    }
+
+    return 0;
+
+inval:
+    errno = EINVAL;
+    return -1;
+}
+
+static int
+cond_met(const struct analyzer_cond *c, uint8_t (*prev)[2], uint8_t (*now)[2])
+{
+    int was = (prev[c->exp][c->port] & c->mask) != 0;
+    int is = (now[c->exp][c->port] & c->mask) != 0;
+
+    switch (c->when) {
+        case ANALYZER_LOW : return !is;
+        case ANALYZER_HIGH : return is;
+        case ANALYZER_RISE : return !was && is;
+        case ANALYZER_FALL : return was && !is;
+    }
+
+    return 0;
+}
+
+static inline uint8_t
+ring_byte(const analyzer_t *a, size_t off)
+{
+    return a->ring[off % a->size];
+}
+
+/* Decode the record at off, returns its length */
+static size_t
+ring_record(const analyzer_t *a, size_t off, uint64_t *dt, uint8_t *exp, uint8_t gpio[2])
+{
+    size_t n = 0;
+    unsigned int shift = 0;
+    uint8_t byte;
+
+    *dt = 0;
+    do {
+        byte = ring_byte(a, off + n++);
+        *dt |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    *exp = ring_byte(a, off + n++);
+    gpio[0] = ring_byte(a, off + n++);
+    gpio[1] = ring_byte(a, off + n++);
+
+    return n;
+}
+
+/* Fold the oldest record into the base state */
+static void
+ring_drop(analyzer_t *a)
+{
+    size_t tail = a->head + a->size - a->used;
+    uint64_t dt;
+    uint8_t e, gpio[2];
+    size_t n = ring_record(a, tail, &dt, &e, gpio);
+
+    a->base_us += dt;
+    a->base[e][0] = gpio[0];
+    a->base[e][1] = gpio[1];
+    a->used -= n;
+    a->dropped++;
+}
+
+static void
+ring_put(analyzer_t *a, uint64_t t, unsigned int e, const uint8_t gpio[2])
+{
+    uint8_t rec[RECORD_MAX];
+    uint64_t dt = t - a->last_us;
+    size_t n = 0;
+
+    do {
+        rec[n] = dt & 0x7F;
+        dt >>= 7;
+        if (dt)
+            rec[n] |= 0x80;
+        n++;
+    } while (dt);
+    rec[n++] = e;
+    rec[n++] = gpio[0];
+    rec[n++] = gpio[1];
+
+    while (a->used + n > a->size)
+        ring_drop(a);
+
+    for (size_t i = 0; i < n; i++)
+        a->ring[(a->head + i) % a->size] = rec[i];
+    a->head = (a->head + n) % a->size;
+    a->used += n;
+    a->last_us = t;
+    a->records++;
+}
+
+int
+analyzer_sample(analyzer_t *a, const struct timespec *ts, uint8_t (*gpio)[2])
+{
+    unsigned int nexp = a->board->nexpanders;
+    uint64_t t;
+
+    a->samples++;
+
+    if (!a->started) {
+        /* No edge on the first sample: it is its own previous one */
+        if (a->start.mask && !cond_met(&a->start, a->samples > 1 ? a->cur : gpio, gpio)) {
+            memcpy(a->cur, gpio, nexp * sizeof(gpio[0]));
+            return 0;
+        }
+
+        a->started = 1;
+        a->t0 = *ts;
+        memcpy(a->base, gpio, nexp * sizeof(gpio[0]));
+        memcpy(a->cur, gpio, nexp * sizeof(gpio[0]));
+        return 0;
+    }
+
+    t = (uint64_t)(ts->tv_sec - a->t0.tv_sec) * 1000000 + (ts->tv_nsec - a->t0.tv_nsec) / 1000;
+    a->end_us = t;
+
+    for (unsigned int e = 0; e < nexp; e++) {
+        if (gpio[e][0] == a->cur[e][0] && gpio[e][1] == a->cur[e][1])
+            continue;
+        ring_put(a, t, e, gpio[e]);
+    }
+
+    if (a->stop.mask && cond_met(&a->stop, a->cur, gpio)) {
+        memcpy(a->cur, gpio, nexp * sizeof(gpio[0]));
+        return 1;
+    }
+    memcpy(a->cur, gpio, nexp * sizeof(gpio[0]));
+
+    return 0;
+}
+
+/* VCD identifier of pin i, from the printable range */
+static char *
+vcd_id(char *buf, unsigned int i)
+{
+    char *p = buf;
+
+    do {
+        *p++ = '!' + i % 94;
+        i /= 94;
+    } while (i);
+    *p = '\0';
+
+    return buf;
+}
+
+static void
+pin_name(const struct board *b, unsigned int e, unsigned int port, unsigned int bit, char *buf, size_t len)
+{
+    const struct board_expander *x = &b->exp[e];
+    uint8_t m = 1u << bit;
+
+    if (x->input[port] & m)
+        snprintf(buf, len, "DI%02u", x->chan[port][bit]);
+    else if (x->output[port] & m)
+        snprintf(buf, len, "DO%02u", x->chan[port][bit]);
+    else if (x->fault[port] & m)
+        snprintf(buf, len, "SC%02u", x->chan[port][bit]);
+    else
+        snprintf(buf, len, "X%u_%c%u", e, port == BOARD_PORT_A ? 'A' : 'B', bit);
+}
+
+static void
+vcd_changes(FILE *f, unsigned int e, const uint8_t old[2], const uint8_t new[2], int all)
+{
+    char id[8];
+
+    for (unsigned int port = 0; port < 2; port++) {
+        uint8_t diff = all ? 0xFF : old[port] ^ new[port];
+
+        for (; diff; diff &= diff - 1) {
+            unsigned int bit = __builtin_ctz(diff);
+            fprintf(f, "%d%s\n", (new[port] >> bit) & 1, vcd_id(id, e * 16 + port * 8 + bit));
+        }
+    }
+}
+
+int
+analyzer_write_vcd(analyzer_t *a, FILE *f)
+{
+    const struct board *b = a->board;
+    uint8_t state[BOARD_MAX_EXPANDERS][2];
+    size_t off = a->head + a->size - a->used, left = a->used;
+    uint64_t t = a->base_us, shown = a->base_us;
+    char id[8], name[16];
+
+    fprintf(f, "$comment iotool capture: %lu samples, %lu changes, %lu dropped $end\n",
+            a->samples, a->records, a->dropped);
+    fprintf(f, "$timescale 1us $end\n");
+    fprintf(f, "$scope module iotool $end\n");
+    for (unsigned int e = 0; e < b->nexpanders; e++) {
+        for (unsigned int port = 0; port < 2; port++) {
+            for (unsigned int bit = 0; bit < 8; bit++) {
+                pin_name(b, e, port, bit, name, sizeof(name));
+                fprintf(f, "$var wire 1 %s %s $end\n", vcd_id(id, e * 16 + port * 8 + bit), name);
+            }
+        }
+    }
+    fprintf(f, "$upscope $end\n$enddefinitions $end\n");
+
+    memcpy(state, a->base, sizeof(state));
+    fprintf(f, "#%llu\n$dumpvars\n", (unsigned long long)t);
+    for (unsigned int e = 0; e < b->nexpanders; e++)
+        vcd_changes(f, e, state[e], state[e], 1);
+    fprintf(f, "$end\n");
+
+    while (left > 0) {
+        uint64_t dt;
+        uint8_t e, gpio[2];
+        size_t n = ring_record(a, off, &dt, &e, gpio);
+
+        t += dt;
+        if (t != shown) {
+            fprintf(f, "#%llu\n", (unsigned long long)t);
+            shown = t;
+        }
+        vcd_changes(f, e, state[e], gpio, 0);
+        state[e][0] = gpio[0];
+        state[e][1] = gpio[1];
+
+        off += n;
+        left -= n;
+    }
+
+    /* Mark the end so the last levels show */
+    if (a->end_us > shown)
+        fprintf(f, "#%llu\n", (unsigned long long)a->end_us);
+
+    return ferror(f) ? -1 : 0;
+}
@@ -0,0 +1,82 @@
+#ifndef _IOTOOL_ANALYZER_H
+#define _IOTOOL_ANALYZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "board.h"
+
+/*
+ * Logic analyzer over all 16 pins of every expander. Samples go in as
+ * GPIOA/GPIOB pairs, as fast as they can be read; only changes are kept.
+ * Each change is one record in a byte ring:
+ *
+ *   LEB128 time since the previous record in us, expander, GPIOA, GPIOB
+ *
+ * so a quiet line costs nothing and a change usually costs 4 or 5 bytes.
+ * When the ring is full the oldest records are folded into the base
+ * state, and the trace keeps the most recent part of the capture.
+ */
+
+/* Default ring size */
+#define ANALYZER_RING       (4 * 1024 * 1024)
+
+enum analyzer_when {
+    ANALYZER_LOW,
+    ANALYZER_HIGH,
+    ANALYZER_RISE,
+    ANALYZER_FALL,
+};
+
+/* Trigger condition on one pin */
+struct analyzer_cond {
+    uint8_t exp;
+    uint8_t port;
+    uint8_t mask;               /* 0: no condition */
+    uint8_t when;
+};
+
+typedef struct analyzer {
+    const struct board *board;
+
+    uint8_t *ring;
+    size_t size, head, used;    /* the oldest record is at head - used */
+
+    /* Pins and time, in us from the start, before the oldest record */
+    uint8_t base[BOARD_MAX_EXPANDERS][2];
+    uint64_t base_us;
+    /* After the newest record, and the last sample */
+    uint8_t cur[BOARD_MAX_EXPANDERS][2];
+    uint64_t last_us, end_us;
+
+    struct analyzer_cond start, stop;
+    struct timespec t0;
+    int started;
+
+    unsigned long samples;
+    unsigned long records;
+    unsigned long dropped;      /* records folded into the base */
+} analyzer_t;
+
+int analyzer_init(analyzer_t *a, const struct board *b, size_t size);
+void analyzer_free(analyzer_t *a);
+
+/*
+ * Parse "<pin>=<when>" into c: pin is DI<n>, DO<n>, SC<n> (short circuit
+ * sense of output n) or X<exp>_<A|B><bit>, when is 0, 1, r or f. 0 or -1.
+ */
+int analyzer_cond_parse(const struct board *b, const char *spec, struct analyzer_cond *c);
+
+/*
+ * One sample taken at ts: gpio[e] are GPIOA and GPIOB of expander e.
+ * Recording begins with the first sample meeting the start condition.
+ * Returns 1 once a sample meets the stop condition, 0 otherwise.
+ */
+int analyzer_sample(analyzer_t *a, const struct timespec *ts, uint8_t (*gpio)[2]);
+
+/* Trace as a Value Change Dump, 1 us time scale */
+int analyzer_write_vcd(analyzer_t *a, FILE *f);
+
+#endif
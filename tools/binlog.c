@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "binlog.h"
+
+#define MASK    (BINLOG_RING - 1)
+
+/* Head and tail on lines of their own, producer and drainer write one each */
+struct ring {
+    uint64_t w[BINLOG_RING];
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long dropped;
+    unsigned long tail __attribute__((aligned(64)));
+    int owner;
+};
+
+static struct ring rings[BINLOG_THREADS];
+static __thread struct ring *mine;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static int running;
+static const struct binlog_format *formats;
+static unsigned int nformats;
+static int out = -1;
+
+static pthread_t drainer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static int stopping;
+
+/* A thread gone, its ring goes to the next one once drained or not */
+static void
+ring_release(void *p)
+{
+    __atomic_store_n(&((struct ring *)p)->owner, 0, __ATOMIC_RELEASE);
+}
+
+static void
+ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+static struct ring *
+ring_claim(void)
+{
+    pthread_once(&ring_once, ring_key_create);
+
+    for (unsigned int i = 0; i < BINLOG_THREADS; i++) {
+        int free = 0;
+
+        if (__atomic_compare_exchange_n(&rings[i].owner, &free, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            mine = &rings[i];
+            pthread_setspecific(ring_key, mine);
+            return mine;
+        }
+    }
+
+    return NULL;
+}
+
+void
+binlog_put(unsigned int id, const uint64_t *args, unsigned int nargs)
+{
+    struct ring *r = mine;
+    struct timespec ts;
+    unsigned long head, tail;
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return;
+    if (r == NULL && (r = ring_claim()) == NULL)
+        return;
+    if (nargs > BINLOG_ARGS)
+        nargs = BINLOG_ARGS;
+
+    head = r->head;
+    tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (BINLOG_RING - (head - tail) < 2 + nargs) {
+        __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    r->w[head & MASK] = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    r->w[(head + 1) & MASK] = id | (uint64_t)nargs << 32 | (uint64_t)(r - rings) << 40;
+    for (unsigned int i = 0; i < nargs; i++)
+        r->w[(head + 2 + i) & MASK] = args[i];
+
+    __atomic_store_n(&r->head, head + 2 + nargs, __ATOMIC_RELEASE);
+}
+
+static void
+write_all(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    ssize_t ret;
+
+    while (len > 0) {
+        if ((ret = write(out, p, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "Binary log: write(): %s", strerror(errno));
+            return;
+        }
+        p += ret;
+        len -= ret;
+    }
+}
+
+/* One ring to the file or to syslog, and what it dropped */
+static void
+drain(struct ring *r)
+{
+    static uint64_t buf[BINLOG_RING + 3];
+    unsigned long head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), tail = r->tail, dropped;
+    size_t n = 0;
+    char line[512];
+
+    while (tail != head) {
+        uint64_t ts = r->w[tail & MASK], hdr = r->w[(tail + 1) & MASK];
+        unsigned int nargs = BINLOG_NARGS(hdr);
+        uint64_t args[BINLOG_ARGS];
+
+        for (unsigned int i = 0; i < nargs; i++)
+            args[i] = r->w[(tail + 2 + i) & MASK];
+        tail += 2 + nargs;
+
+        if (out >= 0) {
+            buf[n++] = ts;
+            buf[n++] = hdr;
+            memcpy(&buf[n], args, nargs * sizeof(args[0]));
+            n += nargs;
+        }
+        else if (BINLOG_ID(hdr) < nformats) {
+            binlog_snprint(line, sizeof(line), formats[BINLOG_ID(hdr)].fmt, args, nargs);
+            syslog(formats[BINLOG_ID(hdr)].level, "%s", line);
+        }
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+    if ((dropped = __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED)) > 0) {
+        if (out >= 0) {
+            struct timespec now;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            buf[n++] = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+            buf[n++] = BINLOG_DROPPED | 1ull << 32 | (uint64_t)(r - rings) << 40;
+            buf[n++] = dropped;
+        }
+        else {
+            syslog(LOG_WARNING, "%lu log record(s) dropped", dropped);
+        }
+    }
+
+    if (n > 0)
+        write_all(buf, n * sizeof(buf[0]));
+}
+
+static void *
+drain_loop(void *arg)
+{
+    struct timespec at;
+    int stop;
+
+    do {
+        clock_gettime(CLOCK_REALTIME, &at);
+        at.tv_nsec += BINLOG_DRAIN_MS * 1000000L;
+        if (at.tv_nsec >= 1000000000L) {
+            at.tv_sec++;
+            at.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&lock);
+        while (!stopping && pthread_cond_timedwait(&wake, &lock, &at) == 0)
+            ;
+        stop = stopping;
+        pthread_mutex_unlock(&lock);
+
+        for (unsigned int i = 0; i < BINLOG_THREADS; i++)
+            drain(&rings[i]);
+    } while (!stop);
+
+    return NULL;
+}
+
+/* Header: magic, version, number of formats, then level, length and text of each, to 8 bytes */
+static void
+write_header(void)
+{
+    uint32_t hdr[4] = { 0, BINLOG_VERSION, nformats, 0 };
+
+    memcpy(&hdr[0], BINLOG_MAGIC, 4);
+    write_all(hdr, sizeof(hdr));
+
+    for (unsigned int i = 0; i < nformats; i++) {
+        uint32_t len = strlen(formats[i].fmt), f[2] = { formats[i].level, len };
+        char pad[8] = { 0 };
+
+        write_all(f, sizeof(f));
+        write_all(formats[i].fmt, len);
+        write_all(pad, -len & 7);
+    }
+}
+
+int
+binlog_start(const struct binlog_format *f, unsigned int n, const char *path)
+{
+    int err;
+
+    formats = f;
+    nformats = n;
+    stopping = 0;
+
+    if (path != NULL && path[0] != '\0') {
+        if ((out = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+            return -1;
+        write_header();
+    }
+
+    if ((err = pthread_create(&drainer, NULL, drain_loop, NULL)) != 0) {
+        if (out >= 0)
+            close(out);
+        out = -1;
+        errno = err;
+        return -1;
+    }
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void
+binlog_stop(void)
+{
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return;
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(drainer, NULL);
+
+    if (out >= 0)
+        close(out);
+    out = -1;
+}
+
+int
+binlog_snprint(char *buf, size_t len, const char *fmt, const uint64_t *args, unsigned int nargs)
+{
+    size_t n = 0;
+    unsigned int a = 0;
+    int ret;
+
+    while (*fmt) {
+        char spec[32], conv;
+        size_t s = 0;
+        uint64_t v;
+
+        if (*fmt != '%' || fmt[1] == '%') {
+            if (n + 1 < len)
+                buf[n] = *fmt;
+            n++;
+            fmt += (*fmt == '%') ? 2 : 1;
+            continue;
+        }
+
+        /* Flags, width and precision as they are, length modifier dropped */
+        spec[s++] = *fmt++;
+        while (*fmt && strchr("-+ #0123456789.", *fmt) && s < sizeof(spec) - 4)
+            spec[s++] = *fmt++;
+        while (*fmt && strchr("hlLqjzt", *fmt))
+            fmt++;
+        if ((conv = *fmt) == '\0')
+            break;
+        fmt++;
+
+        v = a < nargs ? args[a] : 0;
+        a++;
+
+        switch (conv) {
+            case 'd' : case 'i' :
+                memcpy(spec + s, "ll", 2);
+                spec[s + 2] = conv;
+                spec[s + 3] = '\0';
+                ret = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, spec, (long long)v);
+            break;
+            case 'u' : case 'o' : case 'x' : case 'X' :
+                memcpy(spec + s, "ll", 2);
+                spec[s + 2] = conv;
+                spec[s + 3] = '\0';
+                ret = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, spec, (unsigned long long)v);
+            break;
+            case 'c' :
+                spec[s] = conv;
+                spec[s + 1] = '\0';
+                ret = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, spec, (int)v);
+            break;
+            case 'p' :
+                spec[s] = conv;
+                spec[s + 1] = '\0';
+                ret = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, spec, (void *)(uintptr_t)v);
+            break;
+            case 'f' : case 'F' : case 'e' : case 'E' : case 'g' : case 'G' : case 'a' : case 'A' : {
+                double d;
+
+                memcpy(&d, &v, sizeof(d));
+                spec[s] = conv;
+                spec[s + 1] = '\0';
+                ret = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, spec, d);
+            }
+            break;
+            default :
+                ret = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, "(%%%c?)", conv);
+            break;
+        }
+        if (ret > 0)
+            n += ret;
+    }
+
+    if (len > 0)
+        buf[n < len ? n : len - 1] = '\0';
+
+    return n;
+}
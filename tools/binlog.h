@@ -0,0 +1,75 @@
+#ifndef _IOTOOL_BINLOG_H
+#define _IOTOOL_BINLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Binary logging for the event path. A record is a timestamp, the index
+ * of a printf format in a table given at start, and its arguments as raw
+ * 64-bit words, no formatting. Each thread writes its own ring, single
+ * producer and single consumer, so logging takes no lock and no system
+ * call: a clock read and a few stores.
+ *
+ * A drainer thread empties the rings every BINLOG_DRAIN_MS. Without a
+ * file it formats the records and passes them to syslog, at the level of
+ * their format. With one, it appends them as they are, after a header
+ * holding the format table, for binlog_decode to format offline.
+ *
+ * Arguments are integers, or doubles passed through binlog_double().
+ * Strings cannot be logged, there is no telling how long they live.
+ */
+
+#define BINLOG_THREADS      16      /* threads logging at once */
+#define BINLOG_RING         2048    /* words per thread, a power of two */
+#define BINLOG_ARGS         6       /* arguments of a record, at most */
+#define BINLOG_DRAIN_MS     100
+
+/* Record in a ring and in the file: ts, then id | nargs << 32 | thread << 40 */
+#define BINLOG_ID(w)        ((uint32_t)(w))
+#define BINLOG_NARGS(w)     ((unsigned int)((w) >> 32) & 0xFF)
+#define BINLOG_THREAD(w)    ((unsigned int)((w) >> 40) & 0xFF)
+/* Pseudo format of the file: records dropped on a full ring, in arg 0 */
+#define BINLOG_DROPPED      0xFFFFFFFFu
+
+#define BINLOG_MAGIC        "iblg"
+#define BINLOG_VERSION      1
+
+struct binlog_format {
+    int level;              /* syslog priority */
+    const char *fmt;
+};
+
+/*
+ * Start the drainer, writing to path, or to syslog when path is NULL or
+ * empty. The format table must stay valid until binlog_stop()
+ */
+int binlog_start(const struct binlog_format *formats, unsigned int nformats, const char *path);
+/* Drain what is left, then stop. Records logged meanwhile are dropped */
+void binlog_stop(void);
+
+/* Log format id, from any thread. Dropped when the ring is full */
+void binlog_put(unsigned int id, const uint64_t *args, unsigned int nargs);
+
+#define BINLOG0(id)         binlog_put((id), NULL, 0)
+#define BINLOG(id, ...)     binlog_put((id), (const uint64_t []){ __VA_ARGS__ }, \
+                                       sizeof((uint64_t []){ __VA_ARGS__ }) / sizeof(uint64_t))
+
+static inline uint64_t
+binlog_double(double v)
+{
+    uint64_t w;
+
+    memcpy(&w, &v, sizeof(w));
+    return w;
+}
+
+/*
+ * Format a record like snprintf(), taking each conversion of fmt from the
+ * next argument word: integers of any length modifier, %c, %p and the
+ * floating point ones, whose words hold binlog_double() bits
+ */
+int binlog_snprint(char *buf, size_t len, const char *fmt, const uint64_t *args, unsigned int nargs);
+
+#endif
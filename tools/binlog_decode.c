@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "binlog.h"
+
+/*
+ * Format a binary log written by the daemon (binlog_path), oldest record
+ * first: seconds since boot, thread and message, one per line.
+ */
+
+struct record {
+    uint64_t ts;
+    uint64_t seq;
+    uint32_t id;
+    unsigned int thread, nargs;
+    uint64_t args[BINLOG_ARGS];
+    unsigned int table;         /* format table in force */
+};
+
+struct table {
+    char **fmt;
+    unsigned int n;
+};
+
+static int
+by_time(const void *a, const void *b)
+{
+    const struct record *x = a, *y = b;
+
+    /* The clock starts over with each boot, only compare within a start */
+    if (x->table != y->table)
+        return x->table < y->table ? -1 : 1;
+    if (x->ts != y->ts)
+        return x->ts < y->ts ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void
+usage(const char *pname)
+{
+    fprintf(stderr, "Usage: %s <binary log>\n", pname);
+    exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct table *tables = NULL;
+    struct record *rec = NULL;
+    size_t nrec = 0, cap = 0;
+    unsigned int ntables = 0;
+    uint64_t w[2];
+    char line[1024];
+    FILE *f;
+
+    if (argc != 2)
+        usage(argv[0]);
+    if ((f = fopen(argv[1], "rb")) == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        exit(1);
+    }
+
+    /* A header each time the daemon started writing, records after it */
+    while (fread(w, sizeof(w[0]), 1, f) == 1) {
+        struct record *r;
+
+        if (memcmp(w, BINLOG_MAGIC, 4) == 0 && (uint32_t)(w[0] >> 32) == BINLOG_VERSION) {
+            uint32_t n;
+
+            if (fread(w, sizeof(w[0]), 1, f) != 1)
+                break;
+            n = (uint32_t)w[0];
+            tables = realloc(tables, (ntables + 1) * sizeof(*tables));
+            tables[ntables].fmt = calloc(n, sizeof(char *));
+            tables[ntables].n = n;
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t hdr[2];
+
+                if (fread(hdr, sizeof(hdr), 1, f) != 1)
+                    break;
+                tables[ntables].fmt[i] = calloc(1, hdr[1] + 8);
+                if (fread(tables[ntables].fmt[i], (hdr[1] + 7) & ~7u, 1, f) != 1 && hdr[1] > 0)
+                    break;
+            }
+            ntables++;
+            continue;
+        }
+
+        if (ntables == 0) {
+            fprintf(stderr, "%s: not a binary log\n", argv[1]);
+            exit(1);
+        }
+        if (fread(&w[1], sizeof(w[1]), 1, f) != 1)
+            break;
+
+        if (nrec == cap) {
+            cap = cap ? cap * 2 : 4096;
+            if ((rec = realloc(rec, cap * sizeof(*rec))) == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+        }
+        r = &rec[nrec];
+        r->ts = w[0];
+        r->seq = nrec;
+        r->id = BINLOG_ID(w[1]);
+        r->thread = BINLOG_THREAD(w[1]);
+        r->nargs = BINLOG_NARGS(w[1]);
+        r->table = ntables - 1;
+        if (r->nargs > BINLOG_ARGS || fread(r->args, sizeof(r->args[0]), r->nargs, f) != r->nargs) {
+            fprintf(stderr, "%s: truncated record at %zu\n", argv[1], nrec);
+            break;
+        }
+        nrec++;
+    }
+    fclose(f);
+
+    /* Each drain writes thread after thread, put them back in order, start by start */
+    qsort(rec, nrec, sizeof(*rec), by_time);
+
+    for (size_t i = 0; i < nrec; i++) {
+        const struct record *r = &rec[i];
+        const struct table *t = &tables[r->table];
+
+        if (r->id == BINLOG_DROPPED)
+            snprintf(line, sizeof(line), "%lu record(s) dropped", (unsigned long)r->args[0]);
+        else if (r->id < t->n)
+            binlog_snprint(line, sizeof(line), t->fmt[r->id], r->args, r->nargs);
+        else
+            snprintf(line, sizeof(line), "unknown format %u", r->id);
+
+        printf("%llu.%06llu [%u] %s\n", (unsigned long long)(r->ts / 1000000000),
+               (unsigned long long)(r->ts % 1000000000 / 1000), r->thread, line);
+    }
+
+    return 0;
+}
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "mcp23017.h"
+
+#include "board.h"
+
+enum { K_INPUT, K_OUTPUT, K_FAULT };
+
+static int
+add_bus(struct board *b, const char *path)
+{
+    for (unsigned int i = 0; i < b->nbuses; i++) {
+        if (strcmp(b->bus[i], path) == 0)
+            return i;
+    }
+
+    if (b->nbuses == BOARD_MAX_BUSES || strlen(path) >= sizeof(b->bus[0]))
+        return -1;
+
+    strcpy(b->bus[b->nbuses], path);
+
+    return b->nbuses++;
+}
+
+int
+board_find_expander(const struct board *b, const char *bus, unsigned int addr)
+{
+    for (unsigned int i = 0; i < b->nexpanders; i++) {
+        if (b->exp[i].addr == addr && strcmp(b->bus[b->exp[i].bus], bus) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static int
+add_expander(struct board *b, const char *bus, unsigned int addr)
+{
+    struct board_expander *x;
+    int i, n;
+
+    if ((i = board_find_expander(b, bus, addr)) >= 0)
+        return i;
+
+    if (b->nexpanders == BOARD_MAX_EXPANDERS || (n = add_bus(b, bus)) < 0)
+        return -1;
+
+    x = &b->exp[b->nexpanders];
+    memset(x, 0, sizeof(*x));
+    x->bus = n;
+    x->addr = addr;
+    x->irq = BOARD_NO_IRQ;
+    /* Power on defaults: all inputs */
+    x->iodir[BOARD_PORT_A] = x->iodir[BOARD_PORT_B] = 0xFF;
+
+    return b->nexpanders++;
+}
+
+static int
+add_irq(struct board *b, unsigned int gpio, int e)
+{
+    unsigned int i;
+
+    for (i = 0; i < b->nirqs; i++) {
+        if (b->irq_gpio[i] == gpio)
+            break;
+    }
+
+    if (i == b->nirqs) {
+        if (b->nirqs == BOARD_MAX_IRQS)
+            return -1;
+        b->irq_gpio[b->nirqs++] = gpio;
+    }
+
+    b->exp[e].irq = i;
+    b->irq_expanders[i] |= 1u << e;
+
+    return 0;
+}
+
+static int
+add_channel(struct board *b, int kind, unsigned int n, int e, int port, int bit,
+            int pullup, char *err, size_t errlen)
+{
+    struct board_expander *x = &b->exp[e];
+    struct board_pin *table;
+    uint8_t m = 1 << bit;
+
+    if (n >= BOARD_MAX_CHANNELS) {
+        snprintf(err, errlen, "channel %u out of range", n);
+        return -1;
+    }
+
+    if ((x->input[port] | x->output[port] | x->fault[port]) & m) {
+        snprintf(err, errlen, "pin %c%d used twice", 'A' + port, bit);
+        return -1;
+    }
+
+    table = (kind == K_INPUT) ? b->input : (kind == K_OUTPUT) ? b->output : b->fault;
+    if (table[n].mask) {
+        snprintf(err, errlen, "channel %u defined twice", n);
+        return -1;
+    }
+
+    table[n].exp = e;
+    table[n].port = port;
+    table[n].mask = m;
+    x->chan[port][bit] = n;
+
+    switch (kind) {
+        case K_INPUT :
+            x->input[port] |= m;
+            x->gpinten[port] |= m;
+        break;
+        case K_OUTPUT :
+            x->output[port] |= m;
+            x->iodir[port] &= ~m;
+        break;
+        case K_FAULT :
+            x->fault[port] |= m;
+            x->gpinten[port] |= m;
+        break;
+    }
+
+    if (pullup)
+        x->gppu[port] |= m;
+
+    return 0;
+}
+
+static unsigned int
+count_channels(const struct board_pin *table)
+{
+    unsigned int n = 0;
+
+    while (n < BOARD_MAX_CHANNELS && table[n].mask)
+        n++;
+
+    return n;
+}
+
+static int
+finish(struct board *b, char *err, size_t errlen)
+{
+    b->ninputs = count_channels(b->input);
+    b->noutputs = count_channels(b->output);
+
+    for (unsigned int n = 0; n < BOARD_MAX_CHANNELS; n++) {
+        if ((n >= b->ninputs && b->input[n].mask) || (n >= b->noutputs && b->output[n].mask)) {
+            snprintf(err, errlen, "channel numbers must be contiguous from 0");
+            return -1;
+        }
+        if (n >= b->noutputs && b->fault[n].mask) {
+            snprintf(err, errlen, "fault %u has no output", n);
+            return -1;
+        }
+    }
+
+    if (b->nexpanders == 0) {
+        snprintf(err, errlen, "no expanders");
+        return -1;
+    }
+
+    /* An interrupt line is served by the worker of one bus */
+    for (unsigned int i = 0; i < b->nirqs; i++) {
+        for (unsigned int e = 0; e < b->nexpanders; e++) {
+            if ((b->irq_expanders[i] & (1u << e)) &&
+                b->exp[e].bus != b->exp[__builtin_ctz(b->irq_expanders[i])].bus) {
+                snprintf(err, errlen, "interrupt line %u shared by expanders on different buses",
+                         b->irq_gpio[i]);
+                return -1;
+            }
+        }
+    }
+
+    /* INTA has to carry port B too, and not fight the other expanders on its line */
+    for (unsigned int e = 0; e < b->nexpanders; e++) {
+        struct board_expander *x = &b->exp[e];
+
+        x->iocon = 0;
+        if (x->irq == BOARD_NO_IRQ)
+            continue;
+        if (x->gpinten[BOARD_PORT_B])
+            x->iocon |= MCP23017_IOCON_MIRROR;
+        if (b->irq_expanders[x->irq] & ~(1u << e))
+            x->iocon |= MCP23017_IOCON_ODR;
+    }
+
+    return 0;
+}
+
+void
+board_default(struct board *b, const char *bus, unsigned int addr,
+              unsigned int irq_gpio, uint8_t gppu_a, uint8_t gpinten_a)
+{
+    char err[64];
+    int e;
+
+    memset(b, 0, sizeof(*b));
+
+    e = add_expander(b, bus, addr);
+    add_irq(b, irq_gpio, e);
+    for (int i = 0; i < 4; i++) {
+        add_channel(b, K_INPUT, i, e, BOARD_PORT_A, i, 0, err, sizeof(err));
+        add_channel(b, K_FAULT, i, e, BOARD_PORT_A, i + 4, 1, err, sizeof(err));
+        add_channel(b, K_OUTPUT, i, e, BOARD_PORT_B, i, 0, err, sizeof(err));
+    }
+    finish(b, err, sizeof(err));
+
+    b->exp[e].gppu[BOARD_PORT_A] = gppu_a;
+    b->exp[e].gpinten[BOARD_PORT_A] = gpinten_a;
+}
+
+static int
+parse_uint(const char *s, unsigned long max, unsigned long *v)
+{
+    char *end;
+
+    if (s == NULL)
+        return -1;
+
+    errno = 0;
+    *v = strtoul(s, &end, 0);
+
+    return (errno || *s == '\0' || *end != '\0' || *v > max) ? -1 : 0;
+}
+
+int
+board_load(struct board *b, const char *path, char *err, size_t errlen)
+{
+    FILE *f;
+    char line[256], msg[96];
+    int lineno = 0;
+
+    memset(b, 0, sizeof(*b));
+
+    if ((f = fopen(path, "r")) == NULL) {
+        snprintf(err, errlen, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *tok[8], *save, *c;
+        unsigned long n = 0, addr, v;
+        int ntok = 0, kind, e;
+
+        lineno++;
+
+        if ((c = strchr(line, '#')) != NULL)
+            *c = '\0';
+        for (c = strtok_r(line, " \t\r\n", &save); c != NULL && ntok < 8; c = strtok_r(NULL, " \t\r\n", &save))
+            tok[ntok++] = c;
+        if (ntok == 0)
+            continue;
+
+        if (strcmp(tok[0], "expander") == 0) {
+            if ((ntok != 3 && ntok != 5) || parse_uint(tok[2], 0x77, &addr) < 0 ||
+                (ntok == 5 && (strcmp(tok[3], "irq") != 0 || parse_uint(tok[4], 1023, &v) < 0))) {
+                snprintf(msg, sizeof(msg), "expected: expander <bus> <addr> [irq <gpio>]");
+                goto fail;
+            }
+            if ((e = add_expander(b, tok[1], addr)) < 0) {
+                snprintf(msg, sizeof(msg), "too many expanders or buses");
+                goto fail;
+            }
+            if (ntok == 5 && add_irq(b, v, e) < 0) {
+                snprintf(msg, sizeof(msg), "too many interrupt lines");
+                goto fail;
+            }
+            continue;
+        }
+
+        if (strcmp(tok[0], "input") == 0)
+            kind = K_INPUT;
+        else if (strcmp(tok[0], "output") == 0)
+            kind = K_OUTPUT;
+        else if (strcmp(tok[0], "fault") == 0)
+            kind = K_FAULT;
+        else {
+            snprintf(msg, sizeof(msg), "unknown item '%s'", tok[0]);
+            goto fail;
+        }
+
+        if ((ntok != 5 && ntok != 6) || parse_uint(tok[1], BOARD_MAX_CHANNELS - 1, &n) < 0 ||
+            parse_uint(tok[3], 0x77, &addr) < 0 ||
+            strlen(tok[4]) != 2 || strchr("AaBb", tok[4][0]) == NULL ||
+            tok[4][1] < '0' || tok[4][1] > '7' ||
+            (ntok == 6 && (kind == K_OUTPUT || strcmp(tok[5], "pullup") != 0))) {
+            snprintf(msg, sizeof(msg), "expected: %s <n> <bus> <addr> <A|B><bit>%s", tok[0],
+                     (kind == K_OUTPUT) ? "" : " [pullup]");
+            goto fail;
+        }
+
+        if ((e = add_expander(b, tok[2], addr)) < 0) {
+            snprintf(msg, sizeof(msg), "too many expanders or buses");
+            goto fail;
+        }
+
+        if (add_channel(b, kind, n, e, toupper((unsigned char)tok[4][0]) - 'A',
+                        tok[4][1] - '0', ntok == 6, msg, sizeof(msg)) < 0)
+            goto fail;
+    }
+
+    fclose(f);
+
+    if (finish(b, msg, sizeof(msg)) < 0) {
+        snprintf(err, errlen, "%s: %s", path, msg);
+        return -1;
+    }
+
+    return 0;
+
+fail:
+    fclose(f);
+    snprintf(err, errlen, "%s:%d: %s", path, lineno, msg);
+    return -1;
+}
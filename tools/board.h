@@ -0,0 +1,99 @@
+#ifndef _IOTOOL_BOARD_H
+#define _IOTOOL_BOARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Board description: which MCP23017 pin on which bus carries each logical
+ * input, output and short circuit sense channel. It is parsed once into
+ * flat tables, so the interrupt and command paths index by channel or by
+ * (expander, port, bit) and never touch strings or lists.
+ *
+ * File format, one item per line, '#' starts a comment:
+ *
+ *   expander <bus> <addr> [irq <gpio>]
+ *   input    <n> <bus> <addr> <A|B><bit> [pullup]
+ *   output   <n> <bus> <addr> <A|B><bit>
+ *   fault    <n> <bus> <addr> <A|B><bit> [pullup]
+ *
+ * A fault line is the active low short circuit sense of output n. Channel
+ * numbers of each kind must be contiguous from 0. Expanders sharing an
+ * interrupt line must sit on the same bus.
+ *
+ * Only INTA is wired. An expander with inputs or faults on port B has its
+ * interrupt outputs mirrored (IOCON.MIRROR), and expanders sharing a line
+ * drive it open drain (IOCON.ODR), the line then needs a pull-up.
+ */
+
+#define BOARD_MAX_BUSES         4
+#define BOARD_MAX_EXPANDERS     16
+#define BOARD_MAX_IRQS          BOARD_MAX_EXPANDERS
+#define BOARD_MAX_CHANNELS      128
+#define BOARD_WORDS             (BOARD_MAX_CHANNELS / 32)
+#define BOARD_NO_IRQ            0xFF
+
+enum {
+    BOARD_PORT_A,
+    BOARD_PORT_B
+};
+
+/* Bitset over logical channels */
+typedef uint32_t board_bits_t[BOARD_WORDS];
+
+static inline void board_bit_set(uint32_t *b, unsigned int n)   { b[n >> 5] |= 1u << (n & 31); }
+static inline void board_bit_clear(uint32_t *b, unsigned int n) { b[n >> 5] &= ~(1u << (n & 31)); }
+static inline int board_bit_test(const uint32_t *b, unsigned int n) { return (b[n >> 5] >> (n & 31)) & 1; }
+/* Eight channels starting at bank * 8, as carried on the wire */
+static inline uint8_t board_bank(const uint32_t *b, unsigned int bank) { return (uint8_t)(b[bank >> 2] >> ((bank & 3) * 8)); }
+
+/* Where a logical channel lives */
+struct board_pin {
+    uint8_t exp;                /* index into board.exp[] */
+    uint8_t port;               /* BOARD_PORT_A or BOARD_PORT_B */
+    uint8_t mask;               /* single bit, 0 if unused */
+};
+
+struct board_expander {
+    uint8_t bus;                /* index into board.bus[] */
+    uint8_t addr;
+    uint8_t irq;                /* index into board.irq_gpio[] or BOARD_NO_IRQ */
+    /* Register images derived from the channel map, per port */
+    uint8_t iocon;              /* one register, MIRROR and ODR as wired */
+    uint8_t iodir[2];
+    uint8_t gppu[2];
+    uint8_t gpinten[2];
+    /* What each port bit is */
+    uint8_t input[2];
+    uint8_t output[2];
+    uint8_t fault[2];
+    /* Logical channel of each bit (the protected output for fault bits) */
+    uint8_t chan[2][8];
+};
+
+struct board {
+    unsigned int nbuses;
+    unsigned int nexpanders;
+    unsigned int nirqs;
+    unsigned int ninputs;
+    unsigned int noutputs;
+    char bus[BOARD_MAX_BUSES][64];
+    unsigned int irq_gpio[BOARD_MAX_IRQS];
+    uint32_t irq_expanders[BOARD_MAX_IRQS];     /* bit e: expander e */
+    struct board_expander exp[BOARD_MAX_EXPANDERS];
+    struct board_pin input[BOARD_MAX_CHANNELS];
+    struct board_pin output[BOARD_MAX_CHANNELS];
+    struct board_pin fault[BOARD_MAX_CHANNELS];  /* indexed by output */
+};
+
+/*
+ * The original board: one expander, DI0-3 on A0-3, short circuit sense
+ * on A4-7 and DO0-3 on B0-3. gppu_a and gpinten_a override port A.
+ */
+void board_default(struct board *b, const char *bus, unsigned int addr,
+                   unsigned int irq_gpio, uint8_t gppu_a, uint8_t gpinten_a);
+int board_load(struct board *b, const char *path, char *err, size_t errlen);
+/* Expander index or -1 */
+int board_find_expander(const struct board *b, const char *bus, unsigned int addr);
+
+#endif
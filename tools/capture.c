@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "capture.h"
+
+/* Longest record: NDJSON with every channel */
+#define RECORD_MAX  (64 + BOARD_MAX_CHANNELS * 12)
+
+static const char *formats[] = {
+    [CAPTURE_TEXT] = "text",
+    [CAPTURE_CSV] = "csv",
+    [CAPTURE_NDJSON] = "ndjson",
+    [CAPTURE_BIN] = "bin",
+};
+
+int
+capture_format(const char *name)
+{
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (strcmp(name, formats[i]) == 0)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+static int
+put(capture_t *c, const void *p, size_t n)
+{
+    if (c->len + n > c->size && capture_flush(c) < 0)
+        return -1;
+    memcpy(c->buf + c->len, p, n);
+    c->len += n;
+
+    return 0;
+}
+
+/* Decimal without printf(), for the per-channel fields */
+static char *
+put_u64(char *p, uint64_t v)
+{
+    char tmp[20];
+    int n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = tmp[--n];
+
+    return p;
+}
+
+int
+capture_open(capture_t *c, enum capture_format fmt, const char *path, unsigned int ninputs)
+{
+    memset(c, 0, sizeof(*c));
+    c->fmt = fmt;
+    c->ninputs = ninputs;
+    c->size = path ? CAPTURE_FILE_BUF : CAPTURE_BUF;
+
+    if (path == NULL)
+        c->fd = STDOUT_FILENO;
+    else if ((c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return -1;
+
+    if ((c->buf = malloc(c->size)) == NULL) {
+        if (path)
+            close(c->fd);
+        return -1;
+    }
+
+    if (fmt == CAPTURE_CSV) {
+        char line[RECORD_MAX], *p = line;
+
+        p += sprintf(p, "t_ns,seq");
+        for (unsigned int n = 0; n < ninputs; n++)
+            p += sprintf(p, ",DI%02u", n);
+        *p++ = '\n';
+        return put(c, line, p - line);
+    }
+
+    if (fmt == CAPTURE_BIN) {
+        struct capture_header h = { CAPTURE_MAGIC, CAPTURE_VERSION, ninputs };
+
+        return put(c, &h, sizeof(h));
+    }
+
+    return 0;
+}
+
+int
+capture_record(capture_t *c, const struct timespec *ts, const uint32_t *inputs)
+{
+    char rec[RECORD_MAX], *p = rec;
+    uint64_t t = (uint64_t)ts->tv_sec * 1000000000u + ts->tv_nsec;
+
+    switch (c->fmt) {
+        case CAPTURE_TEXT :
+            for (unsigned int n = 0; n < c->ninputs; n++)
+                p += sprintf(p, "DI%02u -> %d\n", n, board_bit_test(inputs, n));
+            *p++ = '\n';
+        break;
+
+        case CAPTURE_CSV :
+            p = put_u64(p, t);
+            *p++ = ',';
+            p = put_u64(p, c->seq);
+            for (unsigned int n = 0; n < c->ninputs; n++) {
+                *p++ = ',';
+                *p++ = '0' + board_bit_test(inputs, n);
+            }
+            *p++ = '\n';
+        break;
+
+        case CAPTURE_NDJSON :
+            memcpy(p, "{\"t_ns\":", 8);
+            p = put_u64(p + 8, t);
+            memcpy(p, ",\"seq\":", 7);
+            p = put_u64(p + 7, c->seq);
+            memcpy(p, ",\"di\":[", 7);
+            p += 7;
+            for (unsigned int n = 0; n < c->ninputs; n++) {
+                if (n)
+                    *p++ = ',';
+                *p++ = '0' + board_bit_test(inputs, n);
+            }
+            memcpy(p, "]}\n", 3);
+            p += 3;
+        break;
+
+        case CAPTURE_BIN :
+            memcpy(p, &t, sizeof(t));
+            p += sizeof(t);
+            for (unsigned int n = 0; n < c->ninputs; n += 8)
+                *p++ = (inputs[n >> 5] >> (n & 31)) & 0xFF;
+            /* Unused bits of the last byte read as 0 */
+            if (c->ninputs & 7)
+                p[-1] &= (1u << (c->ninputs & 7)) - 1;
+        break;
+    }
+
+    c->seq++;
+
+    return put(c, rec, p - rec);
+}
+
+size_t
+capture_pending(capture_t *c)
+{
+    return c->len;
+}
+
+int
+capture_flush(capture_t *c)
+{
+    size_t off = 0;
+
+    while (off < c->len) {
+        ssize_t ret = write(c->fd, c->buf + off, c->len - off);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        off += ret;
+    }
+    c->len = 0;
+
+    return 0;
+}
+
+int
+capture_close(capture_t *c)
+{
+    int ret = capture_flush(c);
+
+    if (c->fd != STDOUT_FILENO && close(c->fd) < 0)
+        ret = -1;
+    free(c->buf);
+    c->buf = NULL;
+
+    return ret;
+}
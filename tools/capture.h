@@ -0,0 +1,61 @@
+#ifndef _IOTOOL_CAPTURE_H
+#define _IOTOOL_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "board.h"
+
+/*
+ * Input capture for the -p poll mode. Records are formatted into a
+ * buffer of our own and written out with write() only when it fills up,
+ * when the capture goes idle, or on close; stdio is not involved.
+ */
+
+enum capture_format {
+    CAPTURE_TEXT,       /* "DI00 -> 1" lines, no timestamp */
+    CAPTURE_CSV,        /* t_ns,seq,DI00,DI01,... */
+    CAPTURE_NDJSON,     /* {"t_ns":..,"seq":..,"di":[0,1,..]} */
+    CAPTURE_BIN,        /* struct capture_header, then fixed size records */
+};
+
+/* Buffer sizes, for stdout and for -w <file> */
+#define CAPTURE_BUF         (64 * 1024)
+#define CAPTURE_FILE_BUF    (4 * 1024 * 1024)
+
+/*
+ * Binary capture: the header, then one record per sample of a uint64_t
+ * CLOCK_MONOTONIC time in ns followed by (ninputs + 7) / 8 bytes of input
+ * bits, DI00 in bit 0 of the first byte. Host byte order, no padding.
+ */
+#define CAPTURE_MAGIC       0x70616369      /* "icap" */
+#define CAPTURE_VERSION     1
+
+struct capture_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t ninputs;
+} __attribute__((packed));
+
+typedef struct capture {
+    enum capture_format fmt;
+    int fd;
+    unsigned int ninputs;
+    unsigned long seq;
+    char *buf;
+    size_t len, size;
+} capture_t;
+
+/* 0 and the format, -1 if name is none of text, csv, ndjson, bin */
+int capture_format(const char *name);
+/* Capture to path, or to stdout for NULL, and write the header */
+int capture_open(capture_t *c, enum capture_format fmt, const char *path, unsigned int ninputs);
+/* One sample of the inputs taken at ts */
+int capture_record(capture_t *c, const struct timespec *ts, const uint32_t *inputs);
+/* Records buffered and not written */
+size_t capture_pending(capture_t *c);
+int capture_flush(capture_t *c);
+int capture_close(capture_t *c);
+
+#endif
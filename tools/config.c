@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "config.h"
+
+enum { T_STR, T_UINT };
+
+static const struct config_key {
+    const char *name;
+    int type;
+    size_t offset;
+    size_t size;
+    unsigned long min, max;     /* T_STR: min 1 when it may not be empty */
+    unsigned int change;
+} keys[] = {
+    { "socket_path",  T_STR,  offsetof(struct config, socket_path),  sizeof(((struct config *)0)->socket_path),  1, 0,       CONFIG_SOCKET },
+    { "urgent_socket", T_STR, offsetof(struct config, urgent_socket), sizeof(((struct config *)0)->urgent_socket), 0, 0,   CONFIG_URGENT },
+    { "state_path",   T_STR,  offsetof(struct config, state_path),   sizeof(((struct config *)0)->state_path),   1, 0,       CONFIG_STATE },
+    { "board",        T_STR,  offsetof(struct config, board),        sizeof(((struct config *)0)->board),        0, 0,       CONFIG_BOARD },
+    { "i2c_bus",      T_STR,  offsetof(struct config, i2c_bus),      sizeof(((struct config *)0)->i2c_bus),      1, 0,       CONFIG_BOARD },
+    { "i2c_addr",     T_UINT, offsetof(struct config, i2c_addr),     sizeof(unsigned int), 0x03, 0x77,                  CONFIG_BOARD },
+    { "int_gpio",     T_UINT, offsetof(struct config, int_gpio),     sizeof(unsigned int), 0, 1023,                     CONFIG_BOARD },
+    { "debounce_us",  T_UINT, offsetof(struct config, debounce_us),  sizeof(unsigned int), 0, 1000000,                  CONFIG_DEBOUNCE },
+    { "short_confirm_us", T_UINT, offsetof(struct config, short_confirm_us), sizeof(unsigned int), 0, 100000,      CONFIG_DEBOUNCE },
+    { "scrub_ms",     T_UINT, offsetof(struct config, scrub_ms),     sizeof(unsigned int), 0, 3600000,                  CONFIG_SCRUB },
+    { "max_clients",  T_UINT, offsetof(struct config, max_clients),  sizeof(unsigned int), 1, CONFIG_CLIENTS_MAX,       CONFIG_MAX_CLIENTS },
+    { "pullup_a",     T_UINT, offsetof(struct config, pullup_a),     sizeof(unsigned int), 0, 0xFF,                     CONFIG_BOARD },
+    { "int_enable_a", T_UINT, offsetof(struct config, int_enable_a), sizeof(unsigned int), 0, 0xFF,                     CONFIG_BOARD },
+    { "history_kb",   T_UINT, offsetof(struct config, history_kb),   sizeof(unsigned int), 0, 65536,                    CONFIG_HISTORY },
+    { "history_socket", T_STR, offsetof(struct config, history_socket), sizeof(((struct config *)0)->history_socket), 0, 0, CONFIG_HISTORY },
+    { "tc0",          T_STR,  offsetof(struct config, tc[0]),        sizeof(((struct config *)0)->tc[0]),        0, 0,       CONFIG_HISTORY },
+    { "tc1",          T_STR,  offsetof(struct config, tc[1]),        sizeof(((struct config *)0)->tc[1]),        0, 0,       CONFIG_HISTORY },
+    { "tc_ms",        T_UINT, offsetof(struct config, tc_ms),        sizeof(unsigned int), 100, 3600000,                CONFIG_HISTORY },
+    { "metrics_addr", T_STR,  offsetof(struct config, metrics_addr), sizeof(((struct config *)0)->metrics_addr), 1, 0,       CONFIG_METRICS },
+    { "metrics_port", T_UINT, offsetof(struct config, metrics_port), sizeof(unsigned int), 0, 65535,                    CONFIG_METRICS },
+    { "binlog_path",  T_STR,  offsetof(struct config, binlog_path),  sizeof(((struct config *)0)->binlog_path),  0, 0,       CONFIG_BINLOG },
+    { "cmd_rate",     T_UINT, offsetof(struct config, cmd_rate),     sizeof(unsigned int), 0, 100000,                   CONFIG_LIMITS },
+    { "cmd_burst",    T_UINT, offsetof(struct config, cmd_burst),    sizeof(unsigned int), 1, 100000,                   CONFIG_LIMITS },
+    { "query_rate",   T_UINT, offsetof(struct config, query_rate),   sizeof(unsigned int), 0, 100000,                   CONFIG_LIMITS },
+    { "query_burst",  T_UINT, offsetof(struct config, query_burst),  sizeof(unsigned int), 1, 100000,                   CONFIG_LIMITS },
+    { "plugin0",      T_STR,  offsetof(struct config, plugin[0]),    sizeof(((struct config *)0)->plugin[0]),    0, 0,       CONFIG_PLUGINS },
+    { "plugin1",      T_STR,  offsetof(struct config, plugin[1]),    sizeof(((struct config *)0)->plugin[1]),    0, 0,       CONFIG_PLUGINS },
+    { "plugin2",      T_STR,  offsetof(struct config, plugin[2]),    sizeof(((struct config *)0)->plugin[2]),    0, 0,       CONFIG_PLUGINS },
+    { "plugin3",      T_STR,  offsetof(struct config, plugin[3]),    sizeof(((struct config *)0)->plugin[3]),    0, 0,       CONFIG_PLUGINS },
+    { "plugin_budget_us", T_UINT, offsetof(struct config, plugin_budget_us), sizeof(unsigned int), 1, 1000000,     CONFIG_PLUGINS },
+    { "plugin_hang_ms", T_UINT, offsetof(struct config, plugin_hang_ms), sizeof(unsigned int), 10, 60000,          CONFIG_PLUGINS },
+};
+
+#define NKEYS (sizeof(keys) / sizeof(keys[0]))
+
+void
+config_defaults(struct config *c)
+{
+    memset(c, 0, sizeof(*c));
+    strcpy(c->socket_path, "/var/run/iotool.sock");
+    strcpy(c->urgent_socket, "/var/run/iotool-urgent.sock");
+    strcpy(c->state_path, "/var/lib/iotool/state");
+    strcpy(c->i2c_bus, "/dev/i2c-1");
+    c->i2c_addr = 0x20;
+    c->int_gpio = 241;          /* PH17 */
+    c->debounce_us = 1000;
+    c->short_confirm_us = 1000;
+    c->scrub_ms = 1000;
+    c->max_clients = 5;
+    c->pullup_a = 0xF0;         /* short circuit inputs 4-7 */
+    c->int_enable_a = 0xFF;
+    c->history_kb = 256;
+    strcpy(c->history_socket, "/var/run/iotool-history.sock");
+    c->tc_ms = 1000;
+    strcpy(c->metrics_addr, "127.0.0.1");
+    c->metrics_port = 9464;
+    c->cmd_rate = 100;
+    c->cmd_burst = 20;
+    c->query_rate = 200;
+    c->query_burst = 50;
+    c->plugin_budget_us = 500;
+    c->plugin_hang_ms = 1000;
+}
+
+static char *
+trim(char *s)
+{
+    char *e;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    e = s + strlen(s);
+    while (e > s && isspace((unsigned char)e[-1]))
+        *--e = '\0';
+
+    return s;
+}
+
+int
+config_load(struct config *c, const char *path, char *err, size_t errlen)
+{
+    FILE *f;
+    char line[512];
+    int lineno = 0;
+
+    config_defaults(c);
+
+    if ((f = fopen(path, "r")) == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        snprintf(err, errlen, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        const struct config_key *k = NULL;
+        char *key, *val, *eq, *end;
+
+        lineno++;
+
+        if ((end = strchr(line, '#')) != NULL)
+            *end = '\0';
+        key = trim(line);
+        if (*key == '\0')
+            continue;
+
+        if ((eq = strchr(key, '=')) == NULL) {
+            snprintf(err, errlen, "%s:%d: expected key = value", path, lineno);
+            goto fail;
+        }
+        *eq = '\0';
+        key = trim(key);
+        val = trim(eq + 1);
+
+        for (size_t i = 0; i < NKEYS; i++) {
+            if (strcmp(keys[i].name, key) == 0) {
+                k = &keys[i];
+                break;
+            }
+        }
+        if (k == NULL) {
+            snprintf(err, errlen, "%s:%d: unknown key '%s'", path, lineno, key);
+            goto fail;
+        }
+
+        if (k->type == T_STR) {
+            if ((*val == '\0' && k->min) || strlen(val) >= k->size) {
+                snprintf(err, errlen, "%s:%d: bad value for %s", path, lineno, key);
+                goto fail;
+            }
+            strcpy((char *)c + k->offset, val);
+        }
+        else {
+            unsigned long v;
+
+            errno = 0;
+            v = strtoul(val, &end, 0);
+            if (errno || *val == '\0' || *end != '\0' || v < k->min || v > k->max) {
+                snprintf(err, errlen, "%s:%d: %s must be %lu..%lu", path, lineno, key, k->min, k->max);
+                goto fail;
+            }
+            *(unsigned int *)((char *)c + k->offset) = (unsigned int)v;
+        }
+    }
+
+    fclose(f);
+
+    return 0;
+
+fail:
+    fclose(f);
+    return -1;
+}
+
+unsigned int
+config_diff(const struct config *a, const struct config *b)
+{
+    unsigned int changed = 0;
+
+    for (size_t i = 0; i < NKEYS; i++) {
+        const char *pa = (const char *)a + keys[i].offset;
+        const char *pb = (const char *)b + keys[i].offset;
+
+        if (keys[i].type == T_STR ? strcmp(pa, pb) != 0 : memcmp(pa, pb, keys[i].size) != 0)
+            changed |= keys[i].change;
+    }
+
+    return changed;
+}
@@ -0,0 +1,69 @@
+#ifndef _IOTOOL_CONFIG_H
+#define _IOTOOL_CONFIG_H
+
+#include <stddef.h>
+
+/*
+ * Daemon configuration, read at startup and again on SIGHUP. The file is
+ * a list of "key = value" lines, '#' starts a comment. See iotool.conf.
+ */
+
+#define CONFIG_PATH         "/etc/iotool.conf"
+/* Capacity of the client table, max_clients can be set up to this */
+#define CONFIG_CLIENTS_MAX  16
+
+struct config {
+    char socket_path[108];
+    char urgent_socket[108];    /* emergency clients, served first */
+    char state_path[256];
+    char board[256];            /* board description, see board.h */
+    /* Single expander board used when there is no board file */
+    char i2c_bus[64];
+    unsigned int i2c_addr;
+    unsigned int int_gpio;      /* MCP23017 INTA line */
+    unsigned int debounce_us;   /* settle time before reading the inputs */
+    unsigned int short_confirm_us;  /* short circuit sense still active after this */
+    unsigned int scrub_ms;      /* expander configuration check period, 0 off */
+    unsigned int max_clients;
+    unsigned int pullup_a;      /* GPPUA */
+    unsigned int int_enable_a;  /* GPINTENA */
+    /* Channel history, see history.h */
+    unsigned int history_kb;    /* point storage of all series, 0 off */
+    char history_socket[108];
+    char tc[2][64];             /* MAX31855 thermocouple spidev, "" none */
+    unsigned int tc_ms;         /* thermocouple sample period */
+    /* Prometheus endpoint, see metrics.h */
+    char metrics_addr[108];     /* IPv4 address, or a Unix socket path */
+    unsigned int metrics_port;  /* TCP port, 0 off */
+    char binlog_path[256];      /* event path debug log, see binlog.h; "" syslog */
+    /* Per client rate limits, requests per second (0 none) and burst */
+    unsigned int cmd_rate, cmd_burst;
+    unsigned int query_rate, query_burst;
+    /* In-process plugins, see plugin.h */
+    char plugin[4][256];        /* shared objects, "" none */
+    unsigned int plugin_budget_us;  /* per callback */
+    unsigned int plugin_hang_ms;    /* callback not back, abort */
+};
+
+/* What a reload has to touch, see config_diff() */
+enum config_change {
+    CONFIG_SOCKET       = 1 << 0,
+    CONFIG_STATE        = 1 << 1,
+    CONFIG_BOARD        = 1 << 2,   /* board file or single expander keys */
+    CONFIG_DEBOUNCE     = 1 << 3,
+    CONFIG_MAX_CLIENTS  = 1 << 4,
+    CONFIG_SCRUB        = 1 << 5,
+    CONFIG_HISTORY      = 1 << 6,
+    CONFIG_METRICS      = 1 << 7,
+    CONFIG_BINLOG       = 1 << 8,
+    CONFIG_URGENT       = 1 << 9,
+    CONFIG_LIMITS       = 1 << 10,  /* taken up by the next request */
+    CONFIG_PLUGINS      = 1 << 11,
+};
+
+void config_defaults(struct config *c);
+/* A missing file leaves the defaults. On error c is partially updated */
+int config_load(struct config *c, const char *path, char *err, size_t errlen);
+unsigned int config_diff(const struct config *a, const struct config *b);
+
+#endif
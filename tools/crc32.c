@@ -0,0 +1,32 @@
+#include <pthread.h>
+
+#include "crc32.h"
+
+static uint32_t table[256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+/* Once for the process, bus workers may get here at the same time */
+static void
+table_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+}
+
+uint32_t
+crc32_update(uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    pthread_once(&table_once, table_init);
+
+    crc = ~crc;
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
@@ -0,0 +1,10 @@
+#ifndef _IOTOOL_CRC32_H
+#define _IOTOOL_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC-32 (IEEE 802.3), start with crc = 0 */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+#endif
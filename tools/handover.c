@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "handover.h"
+
+int
+handover_spawn(const char *exe, char *const argv[], pid_t *pid)
+{
+    int sv[2];
+    char buf[16];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+        return -1;
+
+    if ((*pid = fork()) < 0) {
+        int errsv = errno;
+        close(sv[0]);
+        close(sv[1]);
+        errno = errsv;
+        return -1;
+    }
+
+    if (*pid == 0) {
+        /* Everything the new process needs arrives over the socket */
+        long maxfd = sysconf(_SC_OPEN_MAX);
+        for (int fd = 3; fd < maxfd; fd++)
+            if (fd != sv[1])
+                close(fd);
+
+        if (fcntl(sv[1], F_SETFD, 0) < 0)
+            _exit(127);
+        snprintf(buf, sizeof(buf), "%d", sv[1]);
+        setenv(HANDOVER_ENV, buf, 1);
+        execv(exe, argv);
+        _exit(127);
+    }
+
+    close(sv[1]);
+
+    return sv[0];
+}
+
+int
+handover_send(int sock, const struct handover_state *st, const int *fds, size_t nfds)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+        struct cmsghdr align;
+    } u;
+
+    if (nfds == 0 || nfds > HANDOVER_MAX_FDS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&u, 0, sizeof(u));
+    iov.iov_base = (void *)st;
+    iov.iov_len = sizeof(*st);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(*st))
+        return -1;
+
+    return 0;
+}
+
+int
+handover_wait_ack(int sock, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    char ack;
+    int ret;
+
+    while ((ret = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+        ;
+    if (ret <= 0) {
+        if (ret == 0)
+            errno = ETIMEDOUT;
+        return -1;
+    }
+
+    if (read(sock, &ack, 1) != 1 || ack != 'R') {
+        errno = EPROTO;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+handover_inherited(void)
+{
+    const char *e;
+    char *end;
+    long fd;
+
+    if ((e = getenv(HANDOVER_ENV)) == NULL)
+        return -1;
+
+    fd = strtol(e, &end, 10);
+    unsetenv(HANDOVER_ENV);
+    if (*end != '\0' || fd < 3)
+        return -1;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    return (int)fd;
+}
+
+int
+handover_recv(int sock, struct handover_state *st, int *fds, size_t *nfds)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+        struct cmsghdr align;
+    } u;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = st;
+    iov.iov_len = sizeof(*st);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof(u.buf);
+
+    while ((ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    if (ret < 0)
+        return -1;
+
+    *nfds = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *nfds);
+        }
+    }
+
+    if (ret != (ssize_t)sizeof(*st) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+        st->magic != HANDOVER_MAGIC || st->version != HANDOVER_VERSION ||
+        st->size != sizeof(*st) || st->nclients > HANDOVER_CLIENTS ||
+        *nfds != 1 + (size_t)!!st->urgent_socket + st->nbuses + st->nirqs + st->nclients) {
+        for (size_t i = 0; i < *nfds; i++)
+            close(fds[i]);
+        *nfds = 0;
+        errno = EPROTO;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+handover_ack(int sock)
+{
+    char ack = 'R';
+
+    return (write(sock, &ack, 1) == 1) ? 0 : -1;
+}
@@ -0,0 +1,59 @@
+#ifndef _IOTOOL_HANDOVER_H
+#define _IOTOOL_HANDOVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "session.h"
+
+/*
+ * Live upgrade: the running daemon starts a fresh copy of the binary and
+ * passes it its open file descriptors (SCM_RIGHTS) and shadow state over a
+ * socketpair, so neither clients nor the expander notice the restart.
+ */
+
+#define HANDOVER_ENV        "IOTOOL_HANDOVER_FD"
+#define HANDOVER_MAGIC      0x696f686f      /* "ioho" */
+#define HANDOVER_VERSION    5
+#define HANDOVER_MAX_FDS    64
+#define HANDOVER_CLIENTS    32      /* bits of urgent */
+#define HANDOVER_TIMEOUT_MS 5000
+
+/*
+ * The fd array holds the listening socket, the urgent one when
+ * urgent_socket is set, then nbuses I2C buses and nirqs interrupt GPIOs
+ * in board order, then the clients.
+ */
+struct handover_state {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;          /* sizeof(struct handover_state) of the sender */
+    uint16_t nbuses;
+    uint16_t nirqs;
+    uint16_t nclients;
+    uint16_t urgent_socket; /* 1 when the urgent listening socket is passed */
+    uint32_t urgent;        /* bit n: client n is on the urgent lane */
+    uint8_t input_bits[16]; /* last input state, bit n is channel n */
+    uint8_t output_bits[16];/* commanded outputs */
+    /* What each client asked for and was not answered yet, in fd order */
+    struct handover_client {
+        uint16_t query;     /* banks waiting for a fresh input read */
+        uint8_t eof;        /* closed by the client, requests still to run */
+        uint8_t unlimited;  /* the command line broker */
+        uint8_t len;
+        uint8_t buf[SESSION_BUF * sizeof(io_t)];    /* requests read ahead */
+    } client[HANDOVER_CLIENTS];
+};
+
+/* Old process: fork/exec exe with the handover socket in the environment */
+int handover_spawn(const char *exe, char *const argv[], pid_t *pid);
+int handover_send(int sock, const struct handover_state *st, const int *fds, size_t nfds);
+int handover_wait_ack(int sock, int timeout_ms);
+
+/* New process: inherited handover socket or -1 */
+int handover_inherited(void);
+int handover_recv(int sock, struct handover_state *st, int *fds, size_t *nfds);
+int handover_ack(int sock);
+
+#endif
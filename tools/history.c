@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "history.h"
+
+/* Longest point: a 32-bit time code and a float with a new window */
+#define POINT_BITS_MAX  (4 + 32 + 2 + 5 + 5 + 32)
+
+/* Values are written from the end of a block, times from the start */
+static void
+put_bits(uint8_t *d, uint16_t *pos, unsigned int n, uint64_t v, int back)
+{
+    while (n--) {
+        unsigned int p = (*pos)++;
+        uint8_t *byte = &d[back ? HISTORY_BLOCK - 1 - p / 8 : p / 8];
+        uint8_t m = 0x80 >> (p % 8);
+
+        if ((v >> n) & 1)
+            *byte |= m;
+        else
+            *byte &= ~m;
+    }
+}
+
+static uint64_t
+get_bits(const uint8_t *d, unsigned int *pos, unsigned int n, int back)
+{
+    uint64_t v = 0;
+
+    while (n--) {
+        unsigned int p = (*pos)++;
+        uint8_t byte = d[back ? HISTORY_BLOCK - 1 - p / 8 : p / 8];
+
+        v = v << 1 | ((byte >> (7 - p % 8)) & 1);
+    }
+
+    return v;
+}
+
+static uint32_t
+float_bits(float v)
+{
+    uint32_t b;
+
+    memcpy(&b, &v, sizeof(b));
+    return b;
+}
+
+static float
+bits_float(uint32_t b)
+{
+    float v;
+
+    memcpy(&v, &b, sizeof(v));
+    return v;
+}
+
+/* Delta of delta: 0 in one bit, small ones in 9 to 16, the rest in 36 */
+static void
+put_time(struct history_block *b, int64_t dod)
+{
+    if (dod == 0)
+        put_bits(b->data, &b->tbits, 1, 0, 0);
+    else if (dod >= -63 && dod <= 64)
+        put_bits(b->data, &b->tbits, 2 + 7, 0x2 << 7 | (dod + 63), 0);
+    else if (dod >= -255 && dod <= 256)
+        put_bits(b->data, &b->tbits, 3 + 9, 0x6 << 9 | (dod + 255), 0);
+    else if (dod >= -2047 && dod <= 2048)
+        put_bits(b->data, &b->tbits, 4 + 12, 0xE << 12 | (dod + 2047), 0);
+    else
+        put_bits(b->data, &b->tbits, 4 + 32, 0xFull << 32 | (uint32_t)dod, 0);
+}
+
+static int64_t
+get_time(const struct history_block *b, unsigned int *pos)
+{
+    if (!get_bits(b->data, pos, 1, 0))
+        return 0;
+    if (!get_bits(b->data, pos, 1, 0))
+        return (int64_t)get_bits(b->data, pos, 7, 0) - 63;
+    if (!get_bits(b->data, pos, 1, 0))
+        return (int64_t)get_bits(b->data, pos, 9, 0) - 255;
+    if (!get_bits(b->data, pos, 1, 0))
+        return (int64_t)get_bits(b->data, pos, 12, 0) - 2047;
+    return (int32_t)get_bits(b->data, pos, 32, 0);
+}
+
+/*
+ * Floats XOR the one before: 0 when equal, otherwise the meaningful bits,
+ * inside the window of the last value when they fit in it.
+ */
+static void
+put_value(struct history_series *s, struct history_block *b, float v)
+{
+    uint32_t bits = float_bits(v), x = bits ^ s->bits;
+    int lead, trail;
+
+    s->bits = bits;
+
+    if (s->kind == HISTORY_DIGITAL) {
+        put_bits(b->data, &b->vbits, 1, v != 0, 1);
+        return;
+    }
+    if (x == 0) {
+        put_bits(b->data, &b->vbits, 1, 0, 1);
+        return;
+    }
+
+    lead = __builtin_clz(x);
+    trail = __builtin_ctz(x);
+    if (lead > 31)
+        lead = 31;
+
+    if (s->lead >= 0 && lead >= s->lead && trail >= s->trail) {
+        put_bits(b->data, &b->vbits, 2, 0x2, 1);
+        put_bits(b->data, &b->vbits, 32 - s->lead - s->trail, x >> s->trail, 1);
+        return;
+    }
+
+    put_bits(b->data, &b->vbits, 2, 0x3, 1);
+    put_bits(b->data, &b->vbits, 5, lead, 1);
+    put_bits(b->data, &b->vbits, 5, 32 - lead - trail - 1, 1);
+    put_bits(b->data, &b->vbits, 32 - lead - trail, x >> trail, 1);
+    s->lead = lead;
+    s->trail = trail;
+}
+
+struct decoder {
+    const struct history_block *b;
+    unsigned int tpos, vpos, k;
+    int64_t delta;
+    uint32_t bits;
+    int lead, trail;
+    uint64_t t;
+    float v;
+};
+
+static void
+decode_start(struct decoder *d, const struct history_block *b)
+{
+    memset(d, 0, sizeof(*d));
+    d->b = b;
+    d->t = b->t0;
+    d->v = b->v0;
+    d->bits = float_bits(b->v0);
+    d->lead = -1;
+}
+
+/* Next point into d->t and d->v, 0 at the end of the block */
+static int
+decode_next(struct decoder *d, enum history_kind kind)
+{
+    const struct history_block *b = d->b;
+
+    if (++d->k >= b->npoints)
+        return 0;
+
+    d->delta += get_time(b, &d->tpos);
+    d->t += d->delta;
+
+    if (kind == HISTORY_DIGITAL) {
+        d->v = get_bits(b->data, &d->vpos, 1, 1);
+        return 1;
+    }
+
+    if (get_bits(b->data, &d->vpos, 1, 1)) {
+        if (get_bits(b->data, &d->vpos, 1, 1)) {
+            d->lead = get_bits(b->data, &d->vpos, 5, 1);
+            d->trail = 32 - d->lead - (get_bits(b->data, &d->vpos, 5, 1) + 1);
+        }
+        d->bits ^= get_bits(b->data, &d->vpos, 32 - d->lead - d->trail, 1) << d->trail;
+        d->v = bits_float(d->bits);
+    }
+
+    return 1;
+}
+
+static struct history_bucket *
+bucket(struct history_tier *tr, uint64_t slot)
+{
+    struct history_bucket *bk = &tr->b[slot % tr->n];
+
+    if (bk->slot != slot + 1) {
+        memset(bk, 0, sizeof(*bk));
+        bk->slot = slot + 1;
+        bk->min = FLT_MAX;
+        bk->max = -FLT_MAX;
+    }
+
+    return bk;
+}
+
+/* A digital level held over [t1, t2) */
+static void
+tier_hold(struct history_tier *tr, uint64_t t1, uint64_t t2, float v)
+{
+    uint64_t w = tr->width_ms;
+
+    /* Older buckets would be overwritten anyway */
+    if (t2 - t1 > (uint64_t)tr->n * w)
+        t1 = t2 - (uint64_t)tr->n * w;
+
+    while (t1 < t2) {
+        struct history_bucket *bk = bucket(tr, t1 / w);
+        uint64_t end = (t1 / w + 1) * w;
+
+        if (end > t2)
+            end = t2;
+        if (v < bk->min)
+            bk->min = v;
+        if (v > bk->max)
+            bk->max = v;
+        bk->covered_ms += end - t1;
+        if (v != 0)
+            bk->high_ms += end - t1;
+        t1 = end;
+    }
+}
+
+static void
+tier_point(struct history_tier *tr, uint64_t t, float v, enum history_kind kind)
+{
+    struct history_bucket *bk = bucket(tr, t / tr->width_ms);
+
+    bk->count++;
+    if (kind == HISTORY_DIGITAL)
+        return;
+    if (v < bk->min)
+        bk->min = v;
+    if (v > bk->max)
+        bk->max = v;
+    bk->sum += v;
+}
+
+void
+history_init(history_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void
+history_free(history_t *h)
+{
+    for (unsigned int i = 0; i < h->n; i++) {
+        free(h->s[i].block);
+        free(h->s[i].tier[0].b);
+        free(h->s[i].tier[1].b);
+    }
+    free(h->s);
+    memset(h, 0, sizeof(*h));
+}
+
+int
+history_add(history_t *h, const char *name, enum history_kind kind, unsigned int nblocks)
+{
+    static const struct { unsigned int n; uint32_t width_ms; } tiers[2] = {
+        { HISTORY_SECONDS, 1000 }, { HISTORY_MINUTES, 60000 },
+    };
+    struct history_series *s;
+
+    if ((s = realloc(h->s, (h->n + 1) * sizeof(*s))) == NULL)
+        return -1;
+    h->s = s;
+
+    s = &h->s[h->n];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->kind = kind;
+    s->nblocks = nblocks < 2 ? 2 : nblocks;
+    s->lead = -1;
+    s->block = calloc(s->nblocks, sizeof(*s->block));
+    for (int i = 0; i < 2; i++) {
+        s->tier[i].n = tiers[i].n;
+        s->tier[i].width_ms = tiers[i].width_ms;
+        s->tier[i].b = calloc(tiers[i].n, sizeof(struct history_bucket));
+    }
+    if (!s->block || !s->tier[0].b || !s->tier[1].b) {
+        free(s->block);
+        free(s->tier[0].b);
+        free(s->tier[1].b);
+        return -1;
+    }
+
+    return h->n++;
+}
+
+int
+history_find(history_t *h, const char *name)
+{
+    for (unsigned int i = 0; i < h->n; i++) {
+        if (strcmp(h->s[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+void
+history_put(history_t *h, unsigned int series, uint64_t t, float v)
+{
+    struct history_series *s = &h->s[series];
+    struct history_block *b = &s->block[s->head];
+    int64_t delta = 0;
+
+    if (s->has_last && t < s->last_t)
+        t = s->last_t;
+
+    for (int i = 0; i < 2; i++) {
+        if (s->kind == HISTORY_DIGITAL && s->has_last)
+            tier_hold(&s->tier[i], s->last_t, t, s->last_v);
+        tier_point(&s->tier[i], t, v, s->kind);
+    }
+
+    if (s->used > 0)
+        delta = t - b->t1;
+
+    /* A full block, or a gap the time codes cannot span, starts a new one */
+    if (s->used == 0 || b->tbits + b->vbits + POINT_BITS_MAX > HISTORY_BLOCK * 8 ||
+        delta - s->delta < INT32_MIN || delta - s->delta > INT32_MAX) {
+        if (s->used > 0)
+            s->head = (s->head + 1) % s->nblocks;
+        if (s->used < s->nblocks)
+            s->used++;
+
+        b = &s->block[s->head];
+        b->t0 = b->t1 = t;
+        b->v0 = b->v1 = v;
+        b->npoints = 1;
+        b->tbits = b->vbits = 0;
+        s->delta = 0;
+        s->bits = float_bits(v);
+        s->lead = -1;
+    }
+    else {
+        put_time(b, delta - s->delta);
+        s->delta = delta;
+        put_value(s, b, v);
+        b->t1 = t;
+        b->v1 = v;
+        b->npoints++;
+    }
+
+    s->last_t = t;
+    s->last_v = v;
+    s->has_last = 1;
+}
+
+struct acc {
+    double min, max, sum;
+    unsigned long count;
+    uint64_t covered, high;
+};
+
+static void
+acc_hold(struct acc *a, uint64_t t1, uint64_t t2, float v)
+{
+    if (t2 <= t1)
+        return;
+    if (v < a->min)
+        a->min = v;
+    if (v > a->max)
+        a->max = v;
+    a->covered += t2 - t1;
+    if (v != 0)
+        a->high += t2 - t1;
+}
+
+/* Decode the points of [from, to) */
+static void
+query_points(struct history_series *s, uint64_t from, uint64_t to, struct acc *a)
+{
+    struct decoder d;
+    uint64_t held_t = 0;
+    float held_v = 0;
+    int held = 0;
+
+    for (unsigned int k = 0; k < s->used; k++) {
+        const struct history_block *b = &s->block[(s->head + s->nblocks - (s->used - 1) + k) % s->nblocks];
+
+        if (b->t0 >= to)
+            break;
+        /* Only the level it ends on, for a digital series */
+        if (b->t1 < from) {
+            held_t = b->t1;
+            held_v = b->v1;
+            held = 1;
+            continue;
+        }
+
+        decode_start(&d, b);
+        do {
+            if (d.t >= to)
+                break;
+            if (s->kind == HISTORY_DIGITAL) {
+                if (held)
+                    acc_hold(a, held_t > from ? held_t : from, d.t, held_v);
+                if (d.t >= from)
+                    a->count++;
+                held_t = d.t;
+                held_v = d.v;
+                held = 1;
+            }
+            else if (d.t >= from) {
+                if (d.v < a->min)
+                    a->min = d.v;
+                if (d.v > a->max)
+                    a->max = d.v;
+                a->sum += d.v;
+                a->count++;
+            }
+        } while (decode_next(&d, s->kind));
+    }
+
+    if (s->kind == HISTORY_DIGITAL && held)
+        acc_hold(a, held_t > from ? held_t : from, to, held_v);
+}
+
+/* Whole buckets of tier level, what is left over from the finer ones */
+static void
+query_range(struct history_series *s, int level, uint64_t from, uint64_t to, struct acc *a)
+{
+    struct history_tier *tr;
+    uint64_t w, first, last;
+
+    if (from >= to)
+        return;
+    if (level < 0) {
+        query_points(s, from, to, a);
+        return;
+    }
+
+    tr = &s->tier[level];
+    w = tr->width_ms;
+    first = (from + w - 1) / w;
+    last = to / w;
+    if (first >= last) {
+        query_range(s, level - 1, from, to, a);
+        return;
+    }
+
+    query_range(s, level - 1, from, first * w, a);
+    for (uint64_t slot = first; slot < last; slot++) {
+        const struct history_bucket *bk = &tr->b[slot % tr->n];
+
+        if (bk->slot != slot + 1) {
+            query_range(s, level - 1, slot * w, slot * w + w, a);
+            continue;
+        }
+        if (bk->min < a->min)
+            a->min = bk->min;
+        if (bk->max > a->max)
+            a->max = bk->max;
+        a->sum += bk->sum;
+        a->count += bk->count;
+        a->covered += bk->covered_ms;
+        a->high += bk->high_ms;
+    }
+    query_range(s, level - 1, last * w, to, a);
+}
+
+int
+history_query(history_t *h, unsigned int series, uint64_t from, uint64_t to, uint64_t now,
+              struct history_agg *agg)
+{
+    struct history_series *s = &h->s[series];
+    struct acc a = { FLT_MAX, -FLT_MAX, 0, 0, 0, 0 };
+
+    memset(agg, 0, sizeof(*agg));
+    agg->duty = -1;
+
+    if (!s->has_last)
+        return -1;
+
+    if (s->kind == HISTORY_DIGITAL) {
+        /* Buckets are complete up to the last change, the level holds since */
+        query_range(s, 1, from, to < s->last_t ? to : s->last_t, &a);
+        if (s->last_t >= from && s->last_t < to)
+            a.count++;
+        acc_hold(&a, from > s->last_t ? from : s->last_t, to < now ? to : now, s->last_v);
+        if (a.covered == 0)
+            return -1;
+        agg->duty = (double)a.high / a.covered;
+        agg->mean = agg->duty;
+        agg->covered_ms = a.covered;
+    }
+    else {
+        query_range(s, 1, from, to, &a);
+        if (a.count == 0)
+            return -1;
+        agg->mean = a.sum / a.count;
+    }
+
+    agg->min = a.min;
+    agg->max = a.max;
+    agg->count = a.count;
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef _IOTOOL_HISTORY_H
+#define _IOTOOL_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * In-memory history of the I/O channels and temperatures, so clients can
+ * ask what a channel did over the last minutes or hours.
+ *
+ * Each series keeps its points in a ring of fixed size blocks, the oldest
+ * block giving way to a new one. A block holds two columns: timestamps
+ * as delta-of-delta codes from the front, and values from the back, one
+ * bit per point for digital series and XOR-compressed floats for analog
+ * ones. Blocks decode on their own, from the first point in the header.
+ *
+ * Next to the points, every series keeps 1 s and 1 min buckets of min,
+ * max, sum and high time. A query takes whole minutes from the minute
+ * buckets, the seconds around them from the second buckets, and decodes
+ * points only for the fractions of a second at either end.
+ */
+
+#define HISTORY_BLOCK       256     /* bytes of points per block */
+#define HISTORY_SECONDS     600     /* 1 s buckets kept */
+#define HISTORY_MINUTES     1440    /* 1 min buckets kept */
+
+enum history_kind {
+    HISTORY_DIGITAL,        /* 0 or 1, held until the next point */
+    HISTORY_ANALOG,         /* samples */
+};
+
+struct history_block {
+    uint64_t t0, t1;        /* first and last point, ms */
+    float v0, v1;
+    uint32_t npoints;
+    uint16_t tbits, vbits;  /* bits used by each column */
+    uint8_t data[HISTORY_BLOCK];
+};
+
+struct history_bucket {
+    uint32_t slot;          /* start / width + 1, 0 when unused */
+    float min, max, sum;
+    uint32_t count;         /* samples, or changes of a digital series */
+    uint16_t covered_ms;    /* digital: time with a known level */
+    uint16_t high_ms;
+};
+
+struct history_tier {
+    struct history_bucket *b;
+    unsigned int n;
+    uint32_t width_ms;
+};
+
+struct history_series {
+    char name[16];
+    enum history_kind kind;
+
+    struct history_block *block;
+    unsigned int nblocks, head, used;
+
+    /* Encoder state of the head block */
+    int64_t delta;
+    uint32_t bits;
+    int lead, trail;
+
+    struct history_tier tier[2];    /* 1 s, 1 min */
+
+    uint64_t last_t;
+    float last_v;
+    int has_last;
+};
+
+typedef struct history {
+    struct history_series *s;
+    unsigned int n;
+} history_t;
+
+struct history_agg {
+    double min, max, mean;
+    double duty;            /* digital only, -1 otherwise */
+    unsigned long count;    /* samples or changes */
+    uint64_t covered_ms;    /* digital: time the level was known */
+};
+
+void history_init(history_t *h);
+void history_free(history_t *h);
+/* New series with nblocks blocks of points. Its index, or -1 */
+int history_add(history_t *h, const char *name, enum history_kind kind, unsigned int nblocks);
+/* Series by name, or -1 */
+int history_find(history_t *h, const char *name);
+/* A point at t ms. Times going backwards are taken as the last one */
+void history_put(history_t *h, unsigned int series, uint64_t t, float v);
+/*
+ * What series did over [from, to) ms. now is the current time, up to
+ * which a digital series holds its last level. 0, or -1 with no data.
+ */
+int history_query(history_t *h, unsigned int series, uint64_t from, uint64_t to, uint64_t now,
+                  struct history_agg *agg);
+
+#endif
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "i2cplan.h"
+
+/* Segments per ioctl, a write/read pair is never split */
+#define SEGS_PER_CALL   (I2C_RDWR_IOCTL_MAX_MSGS / 2)
+
+void
+i2cplan_init(i2cplan_t *plan)
+{
+    plan->nreads = 0;
+    plan->nsegs = 0;
+    plan->used = 0;
+    plan->calls = 0;
+}
+
+int
+i2cplan_read(i2cplan_t *plan, uint16_t addr, uint8_t reg, uint8_t *dst, size_t len)
+{
+    size_t s;
+
+    if (plan->nreads == I2CPLAN_MAX_READS || len == 0)
+        return -1;
+
+    /* Already covered, or extending a segment of the same device */
+    for (s = 0; s < plan->nsegs; s++) {
+        if (plan->seg[s].addr != addr || reg < plan->seg[s].reg)
+            continue;
+        if (reg + len <= plan->seg[s].reg + plan->seg[s].len)
+            break;
+        if (reg == plan->seg[s].reg + plan->seg[s].len && s == plan->nsegs - 1 &&
+            plan->used + len <= I2CPLAN_MAX_BYTES) {
+            plan->seg[s].len += len;
+            plan->used += len;
+            break;
+        }
+    }
+
+    if (s == plan->nsegs) {
+        if (plan->used + len > I2CPLAN_MAX_BYTES)
+            return -1;
+        plan->seg[s].addr = addr;
+        plan->seg[s].reg = reg;
+        plan->seg[s].off = plan->used;
+        plan->seg[s].len = len;
+        plan->used += len;
+        plan->nsegs++;
+    }
+
+    plan->read[plan->nreads].dst = dst;
+    plan->read[plan->nreads].off = plan->seg[s].off + (reg - plan->seg[s].reg);
+    plan->read[plan->nreads].len = len;
+    plan->nreads++;
+
+    return 0;
+}
+
+int
+i2cplan_run(i2cplan_t *plan, i2c_t *bus)
+{
+    struct i2c_msg msgs[SEGS_PER_CALL * 2];
+    uint8_t regs[SEGS_PER_CALL];
+
+    plan->calls = 0;
+
+    for (size_t s = 0; s < plan->nsegs; s += SEGS_PER_CALL) {
+        size_t n = plan->nsegs - s;
+
+        if (n > SEGS_PER_CALL)
+            n = SEGS_PER_CALL;
+
+        for (size_t i = 0; i < n; i++) {
+            regs[i] = plan->seg[s + i].reg;
+            msgs[2 * i].addr = plan->seg[s + i].addr;
+            msgs[2 * i].flags = 0;
+            msgs[2 * i].len = 1;
+            msgs[2 * i].buf = &regs[i];
+            msgs[2 * i + 1].addr = plan->seg[s + i].addr;
+            msgs[2 * i + 1].flags = I2C_M_RD;
+            msgs[2 * i + 1].len = plan->seg[s + i].len;
+            msgs[2 * i + 1].buf = &plan->data[plan->seg[s + i].off];
+        }
+
+        if (i2c_transfer(bus, msgs, 2 * n) < 0)
+            return -1;
+        plan->calls++;
+    }
+
+    for (size_t r = 0; r < plan->nreads; r++)
+        memcpy(plan->read[r].dst, &plan->data[plan->read[r].off], plan->read[r].len);
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef _IOTOOL_I2CPLAN_H
+#define _IOTOOL_I2CPLAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2c.h"
+
+/*
+ * Register reads of several devices on one bus, packed into as few
+ * I2C_RDWR calls as the kernel allows. Each read is a register address
+ * write followed by a repeated start read; reads of adjacent registers of
+ * the same device are merged, relying on the register pointer to
+ * auto-increment. Gaps are never bridged, as reading a register can have
+ * side effects (GPIO and INTCAP clear the MCP23017 interrupt).
+ */
+
+#ifndef I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_RDWR_IOCTL_MAX_MSGS 42
+#endif
+
+#define I2CPLAN_MAX_READS   64
+#define I2CPLAN_MAX_BYTES   256
+
+typedef struct i2cplan {
+    size_t nreads;
+    struct {
+        uint8_t *dst;
+        uint16_t off;           /* into data */
+        uint16_t len;
+    } read[I2CPLAN_MAX_READS];
+    size_t nsegs;
+    struct {
+        uint16_t addr;
+        uint8_t reg;
+        uint16_t off;
+        uint16_t len;
+    } seg[I2CPLAN_MAX_READS];
+    size_t used;
+    uint8_t data[I2CPLAN_MAX_BYTES];
+    unsigned int calls;         /* ioctls made by the last i2cplan_run() */
+} i2cplan_t;
+
+void i2cplan_init(i2cplan_t *plan);
+/* Read len bytes from reg of the device at addr into dst. -1 if full */
+int i2cplan_read(i2cplan_t *plan, uint16_t addr, uint8_t reg, uint8_t *dst, size_t len);
+int i2cplan_run(i2cplan_t *plan, i2c_t *bus);
+
+#endif
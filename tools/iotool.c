@@ -1,7 +1,10 @@
 /**
-gcc -Wall -I../c-periphery/src iotool.c ../c-periphery/periphery.a -o iotool
+make iotool
 **/
 
+/* struct ucred */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -11,115 +14,2399 @@ gcc -Wall -I../c-periphery/src iotool.c ../c-periphery/periphery.a -o iotool
 #include <fcntl.h>
 #include <time.h>
 #include <signal.h>
+#include <limits.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <syslog.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "i2c.h"
+#include "gpio.h"
+#include "spi.h"
+#include "sdnotify.h"
+#include "handover.h"
+#include "persist.h"
+#include "config.h"
+#include "mcp23017.h"
+#include "board.h"
+#include "worker.h"
+#include "i2cplan.h"
+#include "capture.h"
+#include "analyzer.h"
+#include "history.h"
+#include "metrics.h"
+#include "session.h"
+#include "plugin.h"
+#include "binlog.h"
+#include "probe.h"
+#include "iotool.h"
+
+/* Slots kept for the urgent socket on top of max_clients, so a full normal lane never locks it out */
+#define URGENT_CLIENTS 4
+#define MAX_CLIENTS (CONFIG_CLIENTS_MAX + URGENT_CLIENTS)
+
+volatile sig_atomic_t exit_flag = 0;
+volatile sig_atomic_t handover_flag = 0;
+volatile sig_atomic_t reload_flag = 0;
+/* Binary to exec on handover, resolved at startup */
+char self_exe[PATH_MAX];
+/* Startup phase timing */
+struct timespec boot_start, boot_last;
+
+/* Running configuration */
+const char *config_path = CONFIG_PATH;
+struct config cfg;
+struct board board;
+
+/* Hardware and daemon state */
+i2c_t bus[BOARD_MAX_BUSES];
+gpio_t irq[BOARD_MAX_IRQS];
+int master_socket = -1;
+int socket_activated = 0;
+int client_socket[MAX_CLIENTS];
+/* Emergency clients, whose requests go ahead of everything else */
+int urgent_socket = -1;
+int client_lane[MAX_CLIENTS];
+/* Requests read ahead, rate limits and round robin of each client */
+struct session session[MAX_CLIENTS];
+unsigned int session_next;
+/* Requests that had to wait for their bucket, commands then queries */
+unsigned long throttled[2];
+/* Last input state and commanded outputs, bit n is channel n */
+board_bits_t input_state;
+board_bits_t outputs;
+/* Output latch image of each expander port, and which need writing */
+uint8_t olat[BOARD_MAX_EXPANDERS][2];
+/* Latch bits changed since the last output_flush() */
+uint8_t olat_dirty[BOARD_MAX_EXPANDERS][2];
+/* Expander handles with their register shadows, used by the bus workers */
+mcp23017_t mcp[BOARD_MAX_EXPANDERS];
+/* Bus workers, the daemon loop only queues I/O to them while they run */
+struct worker worker[BOARD_MAX_BUSES];
+int workers_running;
+/* Expanders found reset and configured again, see scrub_bus() */
+unsigned long scrub_repairs;
+/* Transfers the bus workers failed and carried on after */
+unsigned long i2c_errors[BOARD_MAX_BUSES];
+/* Latency buckets of metrics and command lanes, in seconds */
+const double latency_bounds[] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1 };
+#define NLATENCY (sizeof(latency_bounds) / sizeof(latency_bounds[0]))
+/* Command to latch write time of each lane, kept by the bus workers */
+unsigned long lane_buckets[LANES][NLATENCY + 1];
+unsigned long long lane_sum_ns[LANES];
+persist_t persist = { .fd = -1 };
+/* When the inputs of each expander were last read */
+struct timespec input_ts[BOARD_MAX_EXPANDERS];
+/* Banks each client asked for and since when, waiting for a fresh read */
+struct {
+    uint16_t banks;
+    struct timespec since;
+} query[MAX_CLIENTS];
+/* JOB_SAMPLE reads not yet back */
+unsigned int sampling;
+/* Channel history and what it last recorded, see hist_start() */
+history_t hist;
+int hist_socket = -1;
+board_bits_t hist_inputs, hist_outputs;
+/* Thermocouples, spi.fd is 0 when not in use */
+spi_t tc[2];
+int tc_series[2];
+struct timespec tc_next;
+/* Prometheus metrics, ids of their samples and what they last showed */
+metrics_t met;
+int met_socket = -1;
+int met_input, met_output, met_edges, met_trips, met_i2c_errors;
+int met_temp[2], met_tc_faults[2], met_spi_errors[2];
+int met_clients, met_repairs, met_lost, met_irq_latency, met_cut_latency;
+int met_lane[LANES];
+int met_throttled;
+int met_plugin_calls, met_plugin_seconds, met_plugin_overruns, met_plugin_disabled;
+board_bits_t met_inputs;
+/*
+ * History queries and metrics scrapes being served. Their sockets are
+ * non-blocking and in the select set, so a peer slow to ask or to read
+ * holds up nothing; one taking longer than PEER_TIMEOUT_MS is dropped.
+ */
+#define PEERS           8
+#define PEER_TIMEOUT_MS 1000
+enum { PEER_HISTORY, PEER_METRICS };
+struct peer {
+    int fd;                 /* 0 when free */
+    int kind;
+    struct timespec since;
+    char rep[256];          /* reply, or the head of the metrics one */
+    size_t len, off;        /* reply, 0 until the request came; bytes written */
+    size_t body;            /* met.text follows the reply, this long */
+} peer[PEERS];
+
+/* Messages of the event path, logged through binlog.h */
+enum {
+    BL_INPUT,
+    BL_SHORT,
+    BL_CUTOFF,
+    BL_CLIENT_NEW,
+    BL_CLIENT_GONE,
+    BL_THROTTLED,
+};
+
+const struct binlog_format log_formats[] = {
+    [BL_INPUT]       = { LOG_DEBUG, "Input, expanders 0x%x" },
+    [BL_SHORT]       = { LOG_DEBUG, "Short circuit" },
+    [BL_CUTOFF]      = { LOG_DEBUG, "Short circuit, cut off in %.3f ms (worst %.3f ms)" },
+    [BL_CLIENT_NEW]  = { LOG_DEBUG, "New client." },
+    [BL_CLIENT_GONE] = { LOG_DEBUG, "Client disconnected." },
+    [BL_THROTTLED]   = { LOG_DEBUG, "Client %u throttled (query %u)" },
+};
+
+
+void
+usage(const char *pname)
+{
+    fprintf(stderr, "Usage: %s <options> \n", pname);
+    fprintf(stderr, "   Options:    -o <n|x,y>      Digital output number or comma separated list.\n");
+    fprintf(stderr, "               -l <0|1>        Output level.\n");
+    fprintf(stderr, "               -p <ms>         Polling inputs. Negative means infinite.\n");
+    fprintf(stderr, "               -s              Read the inputs and exit.\n");
+    fprintf(stderr, "               -f <format>     Input format with -p and -s: text (default), csv,\n");
+    fprintf(stderr, "                               ndjson or bin. All but text carry timestamps.\n");
+    fprintf(stderr, "               -w <file>       Write inputs to file rather than stdout.\n");
+    fprintf(stderr, "               -a <file>       Logic analyzer: sample every expander pin until ^C,\n");
+    fprintf(stderr, "                               keep the changes and write them to file as VCD.\n");
+    fprintf(stderr, "               -t <pin>=<c>    Analyzer start condition, c is 0, 1, r or f and pin\n");
+    fprintf(stderr, "                               is DI<n>, DO<n>, SC<n> or X<exp>_<A|B><bit>.\n");
+    fprintf(stderr, "               -T <pin>=<c>    Analyzer stop condition.\n");
+    fprintf(stderr, "               -b <KiB>        Analyzer buffer, the latest changes are kept (default %d).\n",
+            ANALYZER_RING / 1024);
+    fprintf(stderr, "               -i <ms>         Pulse mode. Time is the period time. Use with -o and -c\n");
+    fprintf(stderr, "               -c <num>        Number of periods in pulse mode.\n");
+    fprintf(stderr, "                               With the daemon running, -o and -i go through it.\n");
+    fprintf(stderr, "               -d              Daemon mode. SIGHUP reloads the configuration,\n");
+    fprintf(stderr, "                               SIGUSR2 hands over to a fresh binary.\n");
+    fprintf(stderr, "               -C <file>       Configuration file (default %s).\n", CONFIG_PATH);
+
+    exit(0);
+}
+
+void
+exit_program(int sig)
+{
+    exit_flag = 1;
+}
+
+void
+request_handover(int sig)
+{
+    handover_flag = 1;
+}
+
+void
+request_reload(int sig)
+{
+    reload_flag = 1;
+}
+
+double
+elapsed_ms(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+/* CLOCK_MONOTONIC in ns, what bpftrace has in nsecs */
+static inline uint64_t
+ts_ns(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/* Log how long a startup phase took and report it to the service manager */
+void
+boot_phase(const char *phase)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    syslog(LOG_INFO, "Startup: %s took %.1f ms (%.1f ms total)", phase,
+           elapsed_ms(&boot_last, &now), elapsed_ms(&boot_start, &now));
+    sdnotify_sendf("STATUS=Startup: %s done", phase);
+    boot_last = now;
+}
+
+/* Board from the board file, or the single expander one */
+int
+load_board(struct board *b, const struct config *c, char *err, size_t errlen)
+{
+    if (c->board[0] != '\0')
+        return board_load(b, c->board, err, errlen);
+
+    board_default(b, c->i2c_bus, c->i2c_addr, c->int_gpio, c->pullup_a, c->int_enable_a);
+
+    return 0;
+}
+
+/*
+ * Handles for the expanders of the running board. The shadows come from
+ * the devices, so a restart only writes what differs.
+ */
+int
+expanders_open(void)
+{
+    for (unsigned int e = 0; e < board.nexpanders; e++) {
+        if (mcp23017_open(&mcp[e], &bus[board.exp[e].bus], board.exp[e].addr) < 0 ||
+            mcp23017_refresh(&mcp[e]) < 0) {
+            fprintf(stderr, "mcp23017_refresh(): %s\n", mcp23017_errmsg(&mcp[e]));
+            syslog(LOG_ERR, "mcp23017_refresh(): %s", mcp23017_errmsg(&mcp[e]));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Expanders having any pin of the kinds in pins */
+enum { PINS_INPUT = 1, PINS_OUTPUT = 2, PINS_FAULT = 4 };
+
+uint32_t
+expanders_with(unsigned int pins)
+{
+    uint32_t exps = 0;
+
+    for (unsigned int e = 0; e < board.nexpanders; e++) {
+        for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+            if (((pins & PINS_INPUT) && board.exp[e].input[p]) ||
+                ((pins & PINS_OUTPUT) && board.exp[e].output[p]) ||
+                ((pins & PINS_FAULT) && board.exp[e].fault[p]))
+                exps |= 1u << e;
+        }
+    }
+
+    return exps;
+}
+
+/* Expanders on bus b having input pins */
+uint32_t
+inputs_on(unsigned int b)
+{
+    uint32_t exps = expanders_with(PINS_INPUT);
+
+    for (unsigned int e = 0; e < board.nexpanders; e++) {
+        if (board.exp[e].bus != b)
+            exps &= ~(1u << e);
+    }
+
+    return exps;
+}
+
+/*
+ * Read nregs registers from first, both ports, of the expanders in exps
+ * into out[e], one planned transfer per bus. The expanders are left in
+ * IOCON.BANK = 0 sequential mode, where that is a single burst with the
+ * ports interleaved. On error *failed is the bus, or SNAPSHOT_PLAN_FULL
+ * when the reads did not fit in one plan and nothing was transferred;
+ * snapshot_errmsg() tells which.
+ */
+#define SNAPSHOT_PLAN_FULL BOARD_MAX_BUSES
+
+int
+snapshot(uint32_t exps, enum mcp23017_reg first, size_t nregs, void *out, size_t size, unsigned int *failed)
+{
+    i2cplan_t plan;
+
+    for (unsigned int b = 0; b < board.nbuses; b++) {
+        i2cplan_init(&plan);
+
+        for (uint32_t m = exps; m; m &= m - 1) {
+            unsigned int e = __builtin_ctz(m);
+            /* A full plan would leave stale registers in out */
+            if (board.exp[e].bus == b &&
+                i2cplan_read(&plan, board.exp[e].addr, mcp23017_reg_addr(&mcp[e], first, MCP23017_PORT_A),
+                             (uint8_t *)out + e * size, 2 * nregs) < 0) {
+                *failed = SNAPSHOT_PLAN_FULL;
+                return -1;
+            }
+        }
+
+        if (plan.nreads > 0 && i2cplan_run(&plan, &bus[b]) < 0) {
+            *failed = b;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+const char *
+snapshot_errmsg(unsigned int failed)
+{
+    if (failed == SNAPSHOT_PLAN_FULL)
+        return "more registers than one read plan holds, nothing read";
+
+    return i2c_errmsg(&bus[failed]);
+}
+
+/* Write the configuration registers of expander e that differ from the board */
+int
+expander_setup(unsigned int e)
+{
+    const struct board_expander *x = &board.exp[e];
+    const struct {
+        enum mcp23017_reg reg;
+        const uint8_t *val;
+    } regs[] = {
+        /* Both halves are the one register */
+        { MCP23017_IOCON, (const uint8_t[2]){ x->iocon, x->iocon } },
+        { MCP23017_IODIR, x->iodir },
+        { MCP23017_GPPU, x->gppu },
+        { MCP23017_GPINTEN, x->gpinten },
+    };
+
+    for (size_t i = 0; i < sizeof(regs) / sizeof(regs[0]); i++) {
+        if (mcp23017_shadow(&mcp[e], regs[i].reg, MCP23017_PORT_A) == regs[i].val[BOARD_PORT_A] &&
+            mcp23017_shadow(&mcp[e], regs[i].reg, MCP23017_PORT_B) == regs[i].val[BOARD_PORT_B])
+            continue;
+        if (mcp23017_write_pair(&mcp[e], regs[i].reg, regs[i].val[BOARD_PORT_A], regs[i].val[BOARD_PORT_B]) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int
+interrupt_setup(gpio_t *gpio, unsigned int pin)
+{
+    bool dummy;
+
+    if (gpio_open(gpio, pin, GPIO_DIR_IN) < 0)
+        return -1;
+
+    if (gpio_set_edge(gpio, GPIO_EDGE_FALLING) < 0 ||
+        gpio_read(gpio, &dummy) < 0) {
+        gpio_close(gpio);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Command output channel n, the latch is written by output_flush() */
+void
+output_set(unsigned int n, int on)
+{
+    const struct board_pin *pin = &board.output[n];
+    uint8_t *l = &olat[pin->exp][pin->port];
+    uint8_t v = on ? (*l | pin->mask) : (*l & ~pin->mask);
+
+    if (on)
+        board_bit_set(outputs, n);
+    else
+        board_bit_clear(outputs, n);
+
+    olat_dirty[pin->exp][pin->port] |= v ^ *l;
+    *l = v;
+}
+
+/* Recompute all latch images from the commanded outputs */
+void
+output_rebuild(void)
+{
+    memset(olat, 0, sizeof(olat));
+    memset(olat_dirty, 0, sizeof(olat_dirty));
+
+    for (unsigned int n = 0; n < BOARD_MAX_CHANNELS; n++) {
+        if (n >= board.noutputs)
+            board_bit_clear(outputs, n);
+        else if (board_bit_test(outputs, n))
+            olat[board.output[n].exp][board.output[n].port] |= board.output[n].mask;
+    }
+}
+
+/* Output masks per expander port for the channels in set */
+void
+output_masks(const uint32_t *set, uint8_t mask[][2])
+{
+    memset(mask, 0, sizeof(uint8_t) * 2 * BOARD_MAX_EXPANDERS);
+
+    for (unsigned int n = 0; n < board.noutputs; n++) {
+        if (board_bit_test(set, n))
+            mask[board.output[n].exp][board.output[n].port] |= board.output[n].mask;
+    }
+}
+
+/* Any latch bits waiting for output_flush() */
+int
+output_pending(void)
+{
+    for (unsigned int e = 0; e < board.nexpanders; e++) {
+        if (olat_dirty[e][BOARD_PORT_A] | olat_dirty[e][BOARD_PORT_B])
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the changed latch bits, through the bus workers when they run.
+ * Only the changed bits: a worker may have cut off others meanwhile.
+ * On error *failed is the expander.
+ */
+int
+output_flush(unsigned int lane, const struct timespec *ts, unsigned int *failed)
+{
+    for (unsigned int e = 0; e < board.nexpanders; e++) {
+        for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+            struct job j = { JOB_WRITE, e, p, olat_dirty[e][p], olat[e][p], lane };
+
+            if (ts)
+                j.ts = *ts;
+
+            if (!olat_dirty[e][p])
+                continue;
+            if (workers_running) {
+                worker_push(&worker[board.exp[e].bus], &j);
+            }
+            else if (mcp23017_update(&mcp[e], MCP23017_OLAT, p, olat_dirty[e][p], olat[e][p]) < 0) {
+                *failed = e;
+                return -1;
+            }
+            olat_dirty[e][p] = 0;
+        }
+    }
+
+    return 0;
+}
+
+/* Record the commanded outputs so a restart can put them back */
+void
+save_outputs(void)
+{
+    struct persist_state st;
+
+    memcpy(st.output_bits, outputs, sizeof(st.output_bits));
+    if (persist_store(&persist, &st) < 0)
+        syslog(LOG_ERR, "persist_store(): %s", strerror(errno));
+}
+
+/* Close the socket and mark as 0 in list for reuse */
+void
+client_close(size_t i)
+{
+    close(client_socket[i]);
+    client_socket[i] = 0;
+    client_lane[i] = LANE_NORMAL;
+    query[i].banks = 0;
+}
+
+/*
+ * Send one record to every client. Those that hung up, with requests
+ * still to run, are skipped; one found gone on the way is closed.
+ */
+void
+broadcast(uint8_t command, uint8_t input_bits, uint8_t output_bits)
+{
+    io_t iotool_data = { command, input_bits, output_bits };
+
+    PERIPHERY_PROBE3(iotool, fanout_start, command, input_bits, output_bits);
+    for (size_t i = 0; i < MAX_CLIENTS; i++) {
+        if (client_socket[i] != 0 && !session[i].eof) {
+            int ret = send(client_socket[i], &iotool_data, sizeof(struct iotool), MSG_NOSIGNAL);
+            if (ret < 0 && (errno == EPIPE || errno == ECONNRESET)) {
+                syslog(LOG_DEBUG, "Client gone while sending data, closing it");
+                client_close(i);
+            }
+            else if (ret < 0) {
+                syslog(LOG_ERR, "Failed to send data. send(): %s", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    PERIPHERY_PROBE1(iotool, fanout_done, command);
+}
+
+int
+bind_socket(const char *path)
+{
+    struct sockaddr_un local;
+    int fd, len;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        syslog(LOG_CRIT, "socket(): %s", strerror(errno));
+        return -1;
+    }
+
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, path);
+    unlink(local.sun_path);
+    len = strlen(local.sun_path) + sizeof(local.sun_family);
+    if (bind(fd, (struct sockaddr *)&local, len) == -1) {
+        syslog(LOG_CRIT, "bind(): %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    /* As iotool.socket does it, whatever the umask */
+    if (chmod(local.sun_path, 0660) == -1)
+        syslog(LOG_WARNING, "chmod(%s): %s", local.sun_path, strerror(errno));
+
+    if (listen(fd, 5) == -1) {
+        syslog(LOG_CRIT, "listen(): %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Socket passed by systemd (see iotool.socket), or our own one */
+int
+listen_socket(void)
+{
+    int fd, n;
+
+    if ((n = sdnotify_listen_fds()) < 0) {
+        syslog(LOG_CRIT, "sdnotify_listen_fds(): %s", strerror(-n));
+        return -1;
+    }
+
+    if (n > 0) {
+        fd = SDNOTIFY_LISTEN_FDS_START;
+        if (n > 1)
+            syslog(LOG_WARNING, "%d sockets passed, using fd %d only", n, fd);
+        if (!sdnotify_is_unix_listener(fd)) {
+            syslog(LOG_CRIT, "Inherited fd %d is not a listening unix socket", fd);
+            return -1;
+        }
+        syslog(LOG_INFO, "Using socket passed by the service manager");
+        socket_activated = 1;
+        return fd;
+    }
+
+    return bind_socket(cfg.socket_path);
+}
+
+/* Adopt the descriptors and shadow state of the daemon we replace */
+int
+resume_handover(int hsock)
+{
+    struct handover_state st;
+    int fds[HANDOVER_MAX_FDS];
+    size_t nfds, k = 0;
+    struct timespec now;
+
+    if (handover_recv(hsock, &st, fds, &nfds) < 0) {
+        syslog(LOG_CRIT, "handover_recv(): %s", strerror(errno));
+        return -1;
+    }
+
+    /* Descriptors come in board order, the board must not have changed */
+    if (st.nbuses != board.nbuses || st.nirqs != board.nirqs) {
+        syslog(LOG_CRIT, "Handover: board has %u buses/%u interrupts, got %u/%u",
+               board.nbuses, board.nirqs, st.nbuses, st.nirqs);
+        for (size_t i = 0; i < nfds; i++)
+            close(fds[i]);
+        return -1;
+    }
+
+    master_socket = fds[k++];
+    if (st.urgent_socket)
+        urgent_socket = fds[k++];
+
+    for (unsigned int i = 0; i < board.nbuses; i++) {
+        memset(&bus[i], 0, sizeof(bus[i]));
+        bus[i].fd = fds[k++];
+    }
+
+    for (unsigned int i = 0; i < board.nirqs; i++) {
+        memset(&irq[i], 0, sizeof(irq[i]));
+        irq[i].pin = board.irq_gpio[i];
+        irq[i].fd = fds[k++];
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (size_t i = 0; i < st.nclients; i++, k++) {
+        if (i < MAX_CLIENTS) {
+            const struct handover_client *c = &st.client[i];
+
+            client_socket[i] = fds[k];
+            client_lane[i] = (st.urgent >> i) & 1 ? LANE_URGENT : LANE_NORMAL;
+            /* Requests already read and queries waiting carry on, the buckets start full */
+            session_init(&session[i], cfg.cmd_burst, cfg.query_burst);
+            session[i].len = c->len < sizeof(session[i].buf) ? c->len : sizeof(session[i].buf);
+            memcpy(session[i].buf, c->buf, session[i].len);
+            session[i].eof = c->eof;
+            session[i].unlimited = c->unlimited;
+            query[i].banks = c->query;
+            query[i].since = now;
+        }
+        else {
+            syslog(LOG_WARNING, "Too many clients handed over, dropping one");
+            close(fds[k]);
+        }
+    }
+
+    memcpy(input_state, st.input_bits, sizeof(st.input_bits));
+    memcpy(outputs, st.output_bits, sizeof(st.output_bits));
+
+    syslog(LOG_INFO, "Took over %u client(s) from the previous instance", st.nclients);
+
+    return 0;
+}
+
+/*
+ * Start a fresh copy of the binary and pass it everything it needs to
+ * carry on. Returns 0 once the new process has taken over, in which case
+ * the caller just exits; on failure we keep serving.
+ */
+int
+hand_over(char *const argv[])
+{
+    struct handover_state st;
+    int fds[HANDOVER_MAX_FDS];
+    size_t nfds = 0;
+    pid_t pid;
+    int hsock;
+
+    memset(&st, 0, sizeof(st));
+    st.magic = HANDOVER_MAGIC;
+    st.version = HANDOVER_VERSION;
+    st.size = sizeof(st);
+    st.nbuses = board.nbuses;
+    st.nirqs = board.nirqs;
+    memcpy(st.input_bits, input_state, sizeof(st.input_bits));
+    memcpy(st.output_bits, outputs, sizeof(st.output_bits));
+
+    fds[nfds++] = master_socket;
+    if (urgent_socket >= 0) {
+        fds[nfds++] = urgent_socket;
+        st.urgent_socket = 1;
+    }
+    for (unsigned int i = 0; i < board.nbuses; i++)
+        fds[nfds++] = i2c_fd(&bus[i]);
+    for (unsigned int i = 0; i < board.nirqs; i++)
+        fds[nfds++] = gpio_fd(&irq[i]);
+    for (size_t i = 0; i < MAX_CLIENTS && st.nclients < HANDOVER_CLIENTS; i++) {
+        if (client_socket[i] != 0) {
+            struct handover_client *c = &st.client[st.nclients];
+
+            fds[nfds++] = client_socket[i];
+            if (client_lane[i] == LANE_URGENT)
+                st.urgent |= 1u << st.nclients;
+            c->query = query[i].banks;
+            c->eof = session[i].eof;
+            c->unlimited = session[i].unlimited;
+            c->len = session[i].len;
+            memcpy(c->buf, session[i].buf, session[i].len);
+            st.nclients++;
+        }
+    }
+
+    if ((hsock = handover_spawn(self_exe, argv, &pid)) < 0) {
+        syslog(LOG_ERR, "handover_spawn(): %s", strerror(errno));
+        return -1;
+    }
+
+    syslog(LOG_INFO, "Handing over to %s (pid %d)", self_exe, (int)pid);
+
+    if (handover_send(hsock, &st, fds, nfds) < 0 ||
+        handover_wait_ack(hsock, HANDOVER_TIMEOUT_MS) < 0) {
+        syslog(LOG_ERR, "Handover failed: %s, carrying on", strerror(errno));
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(hsock);
+        return -1;
+    }
+
+    close(hsock);
+
+    return 0;
+}
+
+static uint64_t
+ts_ms(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+}
+
+/* Record the channels that changed since the last call, at ts */
+void
+hist_record(const struct timespec *ts)
+{
+    if (hist.n == 0)
+        return;
+
+    for (unsigned int n = 0; n < board.ninputs; n++) {
+        int v = board_bit_test(input_state, n);
+
+        if (v != board_bit_test(hist_inputs, n))
+            history_put(&hist, n, ts_ms(ts), v);
+    }
+    for (unsigned int n = 0; n < board.noutputs; n++) {
+        int v = board_bit_test(outputs, n);
+
+        if (v != board_bit_test(hist_outputs, n))
+            history_put(&hist, board.ninputs + n, ts_ms(ts), v);
+    }
+
+    memcpy(hist_inputs, input_state, sizeof(hist_inputs));
+    memcpy(hist_outputs, outputs, sizeof(hist_outputs));
+}
+
+/*
+ * MAX31855 thermocouple temperature: 14 bits signed in 0.25 C steps at
+ * the top, fault flag in bit 16. -1 if the transfer failed, 1 on a
+ * fault (open or shorted probe), nothing is recorded then.
+ */
+int
+tc_read(spi_t *spi, float *temp)
+{
+    uint8_t buf[4];
+    int16_t raw;
+
+    if (spi_transfer(spi, NULL, buf, sizeof(buf)) < 0)
+        return -1;
+    if (buf[1] & 0x01)
+        return 1;
+
+    raw = (int16_t)(buf[0] << 8 | buf[1]) >> 2;
+    *temp = raw / 4.0f;
+
+    return 0;
+}
+
+/* Sample the thermocouples when due, ms until the next time or -1 */
+int
+hist_sample(void)
+{
+    struct timespec now;
+    float temp;
+    double ms;
+
+    if (!tc[0].fd && !tc[1].fd)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((ms = elapsed_ms(&now, &tc_next)) > 0)
+        return (int)ms + 1;
+
+    for (int i = 0; i < 2; i++) {
+        if (!tc[i].fd)
+            continue;
+        switch (tc_read(&tc[i], &temp)) {
+            case 0 :
+                history_put(&hist, tc_series[i], ts_ms(&now), temp);
+                metrics_set(&met, met_temp[i], temp);
+            break;
+            case 1 :
+                metrics_add(&met, met_tc_faults[i], 1);
+            break;
+            default :
+                metrics_add(&met, met_spi_errors[i], 1);
+            break;
+        }
+    }
+
+    tc_next.tv_sec = now.tv_sec + cfg.tc_ms / 1000;
+    tc_next.tv_nsec = now.tv_nsec + (cfg.tc_ms % 1000) * 1000000L;
+    if (tc_next.tv_nsec >= 1000000000L) {
+        tc_next.tv_sec++;
+        tc_next.tv_nsec -= 1000000000L;
+    }
+
+    return cfg.tc_ms;
+}
+
+void
+peer_close(struct peer *pr)
+{
+    close(pr->fd);
+    memset(pr, 0, sizeof(*pr));
+}
+
+/* Drop the peers of a kind, their listener is going away */
+void
+peer_drop(int kind)
+{
+    for (unsigned int i = 0; i < PEERS; i++) {
+        if (peer[i].fd > 0 && peer[i].kind == kind)
+            peer_close(&peer[i]);
+    }
+}
+
+/*
+ * Set up a series for each input, output and thermocouple, sharing the
+ * history_kb point budget, and the query socket. History starts empty.
+ */
+void
+hist_start(void)
+{
+    unsigned int nseries = board.ninputs + board.noutputs, nblocks;
+    struct timespec now;
+    char name[16];
+
+    if (cfg.history_kb == 0)
+        return;
+
+    for (int i = 0; i < 2; i++) {
+        memset(&tc[i], 0, sizeof(tc[i]));
+        if (cfg.tc[i][0] == '\0')
+            continue;
+        if (spi_open(&tc[i], cfg.tc[i], 0, 1000000) < 0) {
+            syslog(LOG_ERR, "Thermocouple %s: %s", cfg.tc[i], spi_errmsg(&tc[i]));
+            memset(&tc[i], 0, sizeof(tc[i]));
+            continue;
+        }
+        nseries++;
+    }
+    if (nseries == 0)
+        return;
+
+    nblocks = cfg.history_kb * 1024 / sizeof(struct history_block) / nseries;
+    history_init(&hist);
+    for (unsigned int n = 0; n < board.ninputs; n++) {
+        snprintf(name, sizeof(name), "DI%02u", n);
+        history_add(&hist, name, HISTORY_DIGITAL, nblocks);
+    }
+    for (unsigned int n = 0; n < board.noutputs; n++) {
+        snprintf(name, sizeof(name), "DO%02u", n);
+        history_add(&hist, name, HISTORY_DIGITAL, nblocks);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (tc[i].fd) {
+            snprintf(name, sizeof(name), "TC%d", i);
+            tc_series[i] = history_add(&hist, name, HISTORY_ANALOG, nblocks);
+        }
+    }
+    if (hist.n != nseries) {
+        syslog(LOG_ERR, "History: out of memory, turned off");
+        history_free(&hist);
+        return;
+    }
+
+    /* Every channel starts at its current level */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (unsigned int n = 0; n < board.ninputs; n++)
+        history_put(&hist, n, ts_ms(&now), board_bit_test(input_state, n));
+    for (unsigned int n = 0; n < board.noutputs; n++)
+        history_put(&hist, board.ninputs + n, ts_ms(&now), board_bit_test(outputs, n));
+    memcpy(hist_inputs, input_state, sizeof(hist_inputs));
+    memcpy(hist_outputs, outputs, sizeof(hist_outputs));
+    tc_next = now;
+
+    if (cfg.history_socket[0] == '\0')
+        syslog(LOG_INFO, "History: no query socket configured");
+    else if ((hist_socket = bind_socket(cfg.history_socket)) < 0)
+        syslog(LOG_ERR, "History: no query socket");
+
+    syslog(LOG_INFO, "History of %u series, %u KiB", hist.n, cfg.history_kb);
+}
+
+void
+hist_stop(void)
+{
+    peer_drop(PEER_HISTORY);
+    if (hist_socket >= 0) {
+        close(hist_socket);
+        unlink(cfg.history_socket);
+        hist_socket = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (tc[i].fd)
+            spi_close(&tc[i]);
+        memset(&tc[i], 0, sizeof(tc[i]));
+    }
+    history_free(&hist);
+}
+
+/*
+ * One query per connection: "<series> <seconds>" or "list", one line of
+ * answer in rep. Queries are cheap, so they are answered right away.
+ */
+void
+hist_reply(const char *req, char *rep, size_t size)
+{
+    char name[16];
+    struct history_agg agg;
+    struct timespec now;
+    unsigned long secs;
+    size_t len;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (strncmp(req, "list", 4) == 0) {
+        len = 0;
+        for (unsigned int n = 0; n < hist.n && len < size - 18; n++)
+            len += sprintf(rep + len, "%s%s", n ? " " : "", hist.s[n].name);
+        snprintf(rep + len, size - len, "\n");
+    }
+    else if (sscanf(req, "%15s %lu", name, &secs) != 2)
+        snprintf(rep, size, "error expected <series> <seconds>\n");
+    else if ((i = history_find(&hist, name)) < 0)
+        snprintf(rep, size, "%s %lu error unknown series\n", name, secs);
+    else if (history_query(&hist, i, ts_ms(&now) > secs * 1000 ? ts_ms(&now) - secs * 1000 : 0,
+                           ts_ms(&now) + 1, ts_ms(&now), &agg) < 0)
+        snprintf(rep, size, "%s %lu error no data\n", name, secs);
+    else if (agg.duty >= 0)
+        snprintf(rep, size, "%s %lu min=%g max=%g mean=%.4f duty=%.4f count=%lu\n",
+                 name, secs, agg.min, agg.max, agg.mean, agg.duty, agg.count);
+    else
+        snprintf(rep, size, "%s %lu min=%g max=%g mean=%.4f count=%lu\n",
+                 name, secs, agg.min, agg.max, agg.mean, agg.count);
+}
+
+/* Show the channels that changed since the last call, counting input edges */
+void
+met_record(void)
+{
+    if (met_socket < 0)
+        return;
+
+    for (unsigned int n = 0; n < board.ninputs; n++) {
+        int v = board_bit_test(input_state, n);
+
+        if (v != board_bit_test(met_inputs, n)) {
+            metrics_set(&met, met_input + n, v);
+            metrics_add(&met, met_edges + n, 1);
+        }
+    }
+    for (unsigned int n = 0; n < board.noutputs; n++)
+        metrics_set(&met, met_output + n, board_bit_test(outputs, n));
+
+    memcpy(met_inputs, input_state, sizeof(met_inputs));
+}
+
+/* TCP listener on metrics_addr, or a Unix socket when it is a path */
+int
+met_listen(void)
+{
+    struct sockaddr_in local;
+    int fd, on = 1;
+
+    if (cfg.metrics_addr[0] == '/')
+        return bind_socket(cfg.metrics_addr);
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(cfg.metrics_port);
+    if (inet_pton(AF_INET, cfg.metrics_addr, &local.sin_addr) != 1) {
+        syslog(LOG_ERR, "Metrics: bad address %s", cfg.metrics_addr);
+        return -1;
+    }
+
+    if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        syslog(LOG_ERR, "Metrics: socket(): %s", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0 || listen(fd, 5) < 0) {
+        syslog(LOG_ERR, "Metrics: %s:%u: %s", cfg.metrics_addr, cfg.metrics_port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* One sample per channel of the current family, the id of the first */
+int
+met_channels(const char *prefix, unsigned int n)
+{
+    char labels[32];
+    int first = -1, id;
+
+    for (unsigned int c = 0; c < n; c++) {
+        snprintf(labels, sizeof(labels), "channel=\"%s%02u\"", prefix, c);
+        id = metrics_sample(&met, labels);
+        if (c == 0)
+            first = id;
+    }
+
+    return first;
+}
+
+/* One sample per plugin of the current family, the id of the first */
+int
+met_plugins(void)
+{
+    struct plugin_stats st;
+    char labels[96];
+    int first = -1, id;
+
+    for (unsigned int i = 0; plugin_stats(i, &st) == 0; i++) {
+        snprintf(labels, sizeof(labels), "plugin=\"%s\"", st.name);
+        id = metrics_sample(&met, labels);
+        if (i == 0)
+            first = id;
+    }
+
+    return first;
+}
+
+/*
+ * Lay out every metric of the board and open the endpoint. Counters
+ * start at zero, a reload that changes the board starts them over.
+ */
+void
+met_start(void)
+{
+    char labels[128];
+
+    if (cfg.metrics_port == 0)
+        return;
+
+    metrics_init(&met);
+
+    metrics_family(&met, "iotool_input", METRICS_GAUGE, "Input level");
+    met_input = met_channels("DI", board.ninputs);
+    metrics_family(&met, "iotool_output", METRICS_GAUGE, "Commanded output level");
+    met_output = met_channels("DO", board.noutputs);
+    metrics_family(&met, "iotool_input_edges_total", METRICS_COUNTER, "Input level changes seen");
+    met_edges = met_channels("DI", board.ninputs);
+    metrics_family(&met, "iotool_short_circuit_trips_total", METRICS_COUNTER, "Outputs cut off on a short circuit");
+    met_trips = met_channels("DO", board.noutputs);
+
+    /* Thermocouples come with the history, see hist_start() */
+    for (int i = 0; i < 2; i++)
+        met_temp[i] = met_tc_faults[i] = met_spi_errors[i] = -1;
+    metrics_family(&met, "iotool_temperature_celsius", METRICS_GAUGE, "Thermocouple temperature");
+    for (int i = 0; i < 2; i++) {
+        snprintf(labels, sizeof(labels), "sensor=\"TC%d\"", i);
+        if (tc[i].fd)
+            met_temp[i] = metrics_sample(&met, labels);
+    }
+    metrics_family(&met, "iotool_thermocouple_faults_total", METRICS_COUNTER, "Thermocouple reads with an open or shorted probe");
+    for (int i = 0; i < 2; i++) {
+        snprintf(labels, sizeof(labels), "sensor=\"TC%d\"", i);
+        if (tc[i].fd)
+            met_tc_faults[i] = metrics_sample(&met, labels);
+    }
+    metrics_family(&met, "iotool_spi_errors_total", METRICS_COUNTER, "Failed SPI transfers");
+    for (int i = 0; i < 2; i++) {
+        snprintf(labels, sizeof(labels), "device=\"%s\"", cfg.tc[i]);
+        if (tc[i].fd)
+            met_spi_errors[i] = metrics_sample(&met, labels);
+    }
+    metrics_family(&met, "iotool_i2c_errors_total", METRICS_COUNTER, "Failed I2C transfers the daemon carried on after");
+    for (unsigned int b = 0; b < board.nbuses; b++) {
+        snprintf(labels, sizeof(labels), "bus=\"%s\"", board.bus[b]);
+        if (b == 0)
+            met_i2c_errors = metrics_sample(&met, labels);
+        else
+            metrics_sample(&met, labels);
+    }
+
+    metrics_family(&met, "iotool_interrupt_latency_seconds", METRICS_HISTOGRAM, "Interrupt edge to clients told");
+    met_irq_latency = metrics_histogram(&met, NULL, latency_bounds, NLATENCY);
+    metrics_family(&met, "iotool_cutoff_latency_seconds", METRICS_HISTOGRAM, "Interrupt edge to shorted output cut off");
+    met_cut_latency = metrics_histogram(&met, NULL, latency_bounds, NLATENCY);
+    metrics_family(&met, "iotool_command_latency_seconds", METRICS_HISTOGRAM, "Client command to output latch written");
+    met_lane[LANE_NORMAL] = metrics_histogram(&met, "lane=\"normal\"", latency_bounds, NLATENCY);
+    met_lane[LANE_URGENT] = metrics_histogram(&met, "lane=\"urgent\"", latency_bounds, NLATENCY);
+
+    metrics_family(&met, "iotool_clients", METRICS_GAUGE, "Connected clients");
+    met_clients = metrics_sample(&met, NULL);
+    metrics_family(&met, "iotool_scrub_repairs_total", METRICS_COUNTER, "Expanders found reset and configured again");
+    met_repairs = metrics_sample(&met, NULL);
+    metrics_family(&met, "iotool_events_lost_total", METRICS_COUNTER, "Interrupt events dropped on a full queue");
+    met_lost = metrics_sample(&met, NULL);
+    metrics_family(&met, "iotool_throttled_requests_total", METRICS_COUNTER, "Client requests held back by the rate limit");
+    met_throttled = metrics_sample(&met, "kind=\"command\"");
+    metrics_sample(&met, "kind=\"query\"");
+
+    /* Plugins are loaded first, see plugins_start() */
+    metrics_family(&met, "iotool_plugin_calls_total", METRICS_COUNTER, "Plugin callbacks run");
+    met_plugin_calls = met_plugins();
+    metrics_family(&met, "iotool_plugin_seconds_total", METRICS_COUNTER, "Time spent in plugin callbacks");
+    met_plugin_seconds = met_plugins();
+    metrics_family(&met, "iotool_plugin_overruns_total", METRICS_COUNTER, "Plugin callbacks over the time budget");
+    met_plugin_overruns = met_plugins();
+    metrics_family(&met, "iotool_plugin_disabled", METRICS_GAUGE, "Plugin disabled after overrunning");
+    met_plugin_disabled = met_plugins();
+
+    if (metrics_done(&met) < 0) {
+        syslog(LOG_ERR, "Metrics: out of memory, turned off");
+        metrics_free(&met);
+        return;
+    }
+    for (unsigned int n = 0; n < board.ninputs; n++)
+        metrics_set(&met, met_input + n, board_bit_test(input_state, n));
+    for (unsigned int n = 0; n < board.noutputs; n++)
+        metrics_set(&met, met_output + n, board_bit_test(outputs, n));
+    memcpy(met_inputs, input_state, sizeof(met_inputs));
+    metrics_set(&met, met_throttled, throttled[0]);
+    metrics_set(&met, met_throttled + 1, throttled[1]);
+
+    if ((met_socket = met_listen()) < 0) {
+        metrics_free(&met);
+        return;
+    }
+
+    if (cfg.metrics_addr[0] == '/')
+        syslog(LOG_INFO, "Metrics on %s, %zu bytes", cfg.metrics_addr, met.len);
+    else
+        syslog(LOG_INFO, "Metrics on %s:%u, %zu bytes", cfg.metrics_addr, cfg.metrics_port, met.len);
+}
+
+void
+met_stop(void)
+{
+    if (met_socket < 0)
+        return;
+
+    peer_drop(PEER_METRICS);
+    close(met_socket);
+    if (cfg.metrics_addr[0] == '/')
+        unlink(cfg.metrics_addr);
+    met_socket = -1;
+    metrics_free(&met);
+}
+
+/*
+ * A scrape: whatever the request, the rendered text in one HTTP/1.0
+ * answer. Only the few values kept by the workers are brought up to
+ * date first. The head goes in pr, the text is written from met.
+ */
+void
+met_reply(struct peer *pr)
+{
+    unsigned int nclients = 0;
+    struct plugin_stats st;
+
+    for (size_t i = 0; i < MAX_CLIENTS; i++)
+        nclients += client_socket[i] != 0;
+    metrics_set(&met, met_clients, nclients);
+    metrics_set(&met, met_repairs, __atomic_load_n(&scrub_repairs, __ATOMIC_RELAXED));
+    for (unsigned int b = 0; b < board.nbuses; b++)
+        metrics_set(&met, met_i2c_errors + b, __atomic_load_n(&i2c_errors[b], __ATOMIC_RELAXED));
+    for (unsigned int l = 0; l < LANES; l++) {
+        unsigned long buckets[NLATENCY + 1];
+
+        for (unsigned int i = 0; i <= NLATENCY; i++)
+            buckets[i] = __atomic_load_n(&lane_buckets[l][i], __ATOMIC_RELAXED);
+        metrics_histogram_load(&met, met_lane[l], buckets, __atomic_load_n(&lane_sum_ns[l], __ATOMIC_RELAXED) / 1e9);
+    }
+    for (unsigned int i = 0; plugin_stats(i, &st) == 0; i++) {
+        metrics_set(&met, met_plugin_calls + i, st.calls);
+        metrics_set(&met, met_plugin_seconds + i, st.ns / 1e9);
+        metrics_set(&met, met_plugin_overruns + i, st.overruns);
+        metrics_set(&met, met_plugin_disabled + i, st.disabled);
+    }
+
+    pr->len = snprintf(pr->rep, sizeof(pr->rep), "HTTP/1.0 200 OK\r\n"
+                       "Content-Type: text/plain; version=0.0.4\r\n"
+                       "Content-Length: %zu\r\n\r\n", met.len);
+    pr->body = met.len;
+}
+
+/* A new connection on a listener, dropped when all slots are busy */
+void
+peer_accept(int listener, int kind, const struct timespec *now)
+{
+    int fd;
+
+    if ((fd = accept(listener, NULL, NULL)) < 0)
+        return;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    for (unsigned int i = 0; i < PEERS; i++) {
+        if (peer[i].fd == 0) {
+            peer[i].fd = fd;
+            peer[i].kind = kind;
+            peer[i].since = *now;
+            return;
+        }
+    }
+
+    syslog(LOG_DEBUG, "Too many queries in progress, dropping one");
+    close(fd);
+}
+
+/* Write what the socket takes of the reply, closing the peer once it is all out */
+void
+peer_write(struct peer *pr)
+{
+    while (pr->off < pr->len + pr->body) {
+        const char *p = pr->off < pr->len ? pr->rep + pr->off : met.text + (pr->off - pr->len);
+        size_t n = pr->off < pr->len ? pr->len - pr->off : pr->len + pr->body - pr->off;
+        /* A peer gone before the end must not raise SIGPIPE */
+        ssize_t ret = send(pr->fd, p, n, MSG_NOSIGNAL);
+
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+            syslog(LOG_DEBUG, "%s: send(): %s", pr->kind == PEER_METRICS ? "Metrics" : "History query",
+                   strerror(errno));
+            break;
+        }
+        pr->off += ret;
+    }
+
+    peer_close(pr);
+}
+
+/* Put the peers in the select sets. ms until the first one times out, or -1 */
+int
+peers_fdset(fd_set *rd, fd_set *wr, int *max_fd, const struct timespec *now)
+{
+    int wait = -1;
+
+    for (unsigned int i = 0; i < PEERS; i++) {
+        struct peer *pr = &peer[i];
+        int left;
+
+        if (pr->fd == 0)
+            continue;
+        if ((left = PEER_TIMEOUT_MS - (int)elapsed_ms(&pr->since, now)) <= 0) {
+            peer_close(pr);
+            continue;
+        }
+        FD_SET(pr->fd, pr->len ? wr : rd);
+        if (pr->fd > *max_fd)
+            *max_fd = pr->fd;
+        if (wait < 0 || left < wait)
+            wait = left;
+    }
+
+    return wait;
+}
+
+/* Read the requests that came and write what the sockets take */
+void
+peers_serve(fd_set *rd, fd_set *wr)
+{
+    for (unsigned int i = 0; i < PEERS; i++) {
+        struct peer *pr = &peer[i];
+        char req[512];
+        ssize_t len;
+
+        if (pr->fd == 0)
+            continue;
+
+        if (pr->len) {
+            if (FD_ISSET(pr->fd, wr))
+                peer_write(pr);
+            continue;
+        }
+        if (!FD_ISSET(pr->fd, rd))
+            continue;
+
+        /* The first read is enough, a query is one short line and of a scrape the rest goes unread */
+        if ((len = read(pr->fd, req, sizeof(req) - 1)) <= 0) {
+            if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                peer_close(pr);
+            continue;
+        }
+        req[len] = '\0';
+
+        if (pr->kind == PEER_METRICS) {
+            met_reply(pr);
+        }
+        else {
+            hist_reply(req, pr->rep, sizeof(pr->rep));
+            pr->len = strlen(pr->rep);
+        }
+        peer_write(pr);
+    }
+}
+
+/* Save and write the outputs commanded since the last time, if any */
+void
+outputs_commit(unsigned int lane, const struct timespec *ts)
+{
+    struct timespec now;
+    unsigned int failed;
+
+    if (!output_pending())
+        return;
+
+    /* Record the intent first, a crash in between replays it */
+    save_outputs();
+
+    if (output_flush(lane, ts, &failed) < 0) {
+        syslog(LOG_ERR, "mcp23017_write(): %s\n", mcp23017_errmsg(&mcp[failed]));
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    hist_record(&now);
+    met_record();
+}
+
+/* The daemon side of plugin_host */
+int
+host_input(unsigned int n)
+{
+    return n < board.ninputs && board_bit_test(input_state, n);
+}
+
+int
+host_output(unsigned int n)
+{
+    return n < board.noutputs && board_bit_test(outputs, n);
+}
+
+void
+host_set_output(unsigned int n, int on)
+{
+    if (n < board.noutputs)
+        output_set(n, on);
+}
+
+/* Load the configured plugins, writing what their init set */
+void
+plugins_start(void)
+{
+    const struct plugin_host host = {
+        .ninputs = board.ninputs,
+        .noutputs = board.noutputs,
+        .input = host_input,
+        .output = host_output,
+        .set_output = host_set_output,
+    };
+
+    plugin_start(&host, cfg.plugin, sizeof(cfg.plugin) / sizeof(cfg.plugin[0]),
+                 cfg.plugin_budget_us, cfg.plugin_hang_ms);
+    outputs_commit(LANE_URGENT, NULL);
+}
+
+/*
+ * Switch to a new board description, reusing open buses and interrupt
+ * lines and writing only the expander registers and output latches that
+ * differ. Nothing changes if a bus or interrupt line cannot be opened.
+ */
+int
+apply_board(const struct board *nb)
+{
+    struct board old = board;
+    i2c_t nbus[BOARD_MAX_BUSES];
+    gpio_t nirq[BOARD_MAX_IRQS];
+    mcp23017_t old_mcp[BOARD_MAX_EXPANDERS];
+    int bus_used[BOARD_MAX_BUSES] = { 0 }, irq_used[BOARD_MAX_IRQS] = { 0 };
+    int bus_from[BOARD_MAX_BUSES], irq_from[BOARD_MAX_IRQS];
+    unsigned int j, failed;
+
+    for (j = 0; j < nb->nbuses; j++) {
+        bus_from[j] = -1;
+        for (unsigned int i = 0; i < old.nbuses; i++) {
+            if (!bus_used[i] && strcmp(old.bus[i], nb->bus[j]) == 0) {
+                bus_from[j] = i;
+                bus_used[i] = 1;
+                nbus[j] = bus[i];
+                break;
+            }
+        }
+        if (bus_from[j] < 0 && i2c_open(&nbus[j], nb->bus[j]) < 0) {
+            syslog(LOG_ERR, "Reload: i2c_open(): %s", i2c_errmsg(&nbus[j]));
+            goto undo_buses;
+        }
+    }
+
+    for (j = 0; j < nb->nirqs; j++) {
+        irq_from[j] = -1;
+        for (unsigned int i = 0; i < old.nirqs; i++) {
+            if (!irq_used[i] && old.irq_gpio[i] == nb->irq_gpio[j]) {
+                irq_from[j] = i;
+                irq_used[i] = 1;
+                nirq[j] = irq[i];
+                break;
+            }
+        }
+        if (irq_from[j] < 0 && interrupt_setup(&nirq[j], nb->irq_gpio[j]) < 0) {
+            syslog(LOG_ERR, "Reload: interrupt line %u: %s", nb->irq_gpio[j], gpio_errmsg(&nirq[j]));
+            goto undo_irqs;
+        }
+    }
+
+    for (unsigned int i = 0; i < old.nbuses; i++) {
+        if (!bus_used[i])
+            i2c_close(&bus[i]);
+    }
+    for (unsigned int i = 0; i < old.nirqs; i++) {
+        if (!irq_used[i])
+            gpio_close(&irq[i]);
+    }
+    memcpy(bus, nbus, sizeof(nbus[0]) * nb->nbuses);
+    memcpy(irq, nirq, sizeof(nirq[0]) * nb->nirqs);
+
+    memcpy(old_mcp, mcp, sizeof(mcp));
+    board = *nb;
+    output_rebuild();
+
+    /* Known expanders keep their shadows, new ones are read in */
+    for (unsigned int e = 0; e < board.nexpanders; e++) {
+        int o = board_find_expander(&old, board.bus[board.exp[e].bus], board.exp[e].addr);
+
+        if (o >= 0) {
+            mcp[e] = old_mcp[o];
+            mcp[e].i2c = &bus[board.exp[e].bus];
+        }
+        else if (mcp23017_open(&mcp[e], &bus[board.exp[e].bus], board.exp[e].addr) < 0 ||
+                 mcp23017_refresh(&mcp[e]) < 0) {
+            syslog(LOG_ERR, "Reload: mcp23017_refresh(): %s", mcp23017_errmsg(&mcp[e]));
+        }
+    }
+
+    /* Latches first, so pins turning into outputs come up right */
+    for (unsigned int e = 0; e < board.nexpanders; e++) {
+        for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+            if (board.exp[e].output[p])
+                olat_dirty[e][p] = olat[e][p] ^ mcp23017_shadow(&mcp[e], MCP23017_OLAT, p);
+        }
+    }
+    if (output_flush(LANE_NORMAL, NULL, &failed) < 0)
+        syslog(LOG_ERR, "Reload: output latch: %s", mcp23017_errmsg(&mcp[failed]));
+
+    for (unsigned int e = 0; e < board.nexpanders; e++) {
+        if (expander_setup(e) < 0)
+            syslog(LOG_ERR, "Reload: setting up expander: %s", mcp23017_errmsg(&mcp[e]));
+    }
+
+    save_outputs();
+
+    return 0;
+
+undo_irqs:
+    while (j-- > 0) {
+        if (irq_from[j] < 0)
+            gpio_close(&nirq[j]);
+    }
+    j = nb->nbuses;
+undo_buses:
+    while (j-- > 0) {
+        if (bus_from[j] < 0)
+            i2c_close(&nbus[j]);
+    }
+
+    return -1;
+}
+
+/*
+ * Re-read the configuration file and apply only what changed. Clients,
+ * output state and untouched expander registers are left alone. Anything
+ * that fails to apply keeps its running value.
+ */
+void
+reload_config(void)
+{
+    struct config next;
+    struct board nb;
+    char err[192];
+    unsigned int changed;
+
+    if (config_load(&next, config_path, err, sizeof(err)) < 0 ||
+        load_board(&nb, &next, err, sizeof(err)) < 0) {
+        syslog(LOG_ERR, "Reload: %s, keeping the running configuration", err);
+        return;
+    }
+
+    changed = config_diff(&cfg, &next);
+
+    if (changed & CONFIG_SOCKET) {
+        int fd = -1;
+
+        if (socket_activated)
+            syslog(LOG_WARNING, "Reload: socket_path is set by the service manager, ignored");
+        else if ((fd = bind_socket(next.socket_path)) >= 0) {
+            close(master_socket);
+            unlink(cfg.socket_path);
+            master_socket = fd;
+            syslog(LOG_INFO, "Reload: listening on %s", next.socket_path);
+        }
+
+        if (fd < 0)
+            strcpy(next.socket_path, cfg.socket_path);
+    }
+
+    if (changed & CONFIG_URGENT) {
+        int fd = -1;
+
+        if (next.urgent_socket[0] == '\0' || (fd = bind_socket(next.urgent_socket)) >= 0) {
+            if (urgent_socket >= 0) {
+                close(urgent_socket);
+                unlink(cfg.urgent_socket);
+            }
+            urgent_socket = fd;
+            if (fd >= 0)
+                syslog(LOG_INFO, "Reload: urgent clients on %s", next.urgent_socket);
+            else
+                syslog(LOG_INFO, "Reload: no urgent socket");
+        }
+        else {
+            strcpy(next.urgent_socket, cfg.urgent_socket);
+        }
+    }
+
+    if (changed & CONFIG_STATE) {
+        struct persist_state st;
+
+        persist_close(&persist);
+        if (persist_open(&persist, next.state_path) < 0) {
+            syslog(LOG_ERR, "Reload: persist_open(%s): %s", next.state_path, strerror(errno));
+        }
+        else {
+            persist_load(&persist, &st);
+            save_outputs();
+            syslog(LOG_INFO, "Reload: output state now kept in %s", next.state_path);
+        }
+    }
+
+    if (changed & CONFIG_BINLOG) {
+        binlog_stop();
+        if (binlog_start(log_formats, sizeof(log_formats) / sizeof(log_formats[0]), next.binlog_path) < 0) {
+            syslog(LOG_ERR, "Reload: binary log %s: %s", next.binlog_path, strerror(errno));
+            binlog_start(log_formats, sizeof(log_formats) / sizeof(log_formats[0]), NULL);
+        }
+    }
+
+    /* The board file may have changed even if the config did not */
+    if (memcmp(&nb, &board, sizeof(nb)) != 0) {
+        if (apply_board(&nb) < 0) {
+            strcpy(next.board, cfg.board);
+            strcpy(next.i2c_bus, cfg.i2c_bus);
+            next.i2c_addr = cfg.i2c_addr;
+            next.int_gpio = cfg.int_gpio;
+            next.pullup_a = cfg.pullup_a;
+            next.int_enable_a = cfg.int_enable_a;
+        }
+        else {
+            changed |= CONFIG_BOARD;
+            syslog(LOG_INFO, "Reload: board has %u expanders, %u inputs, %u outputs",
+                   board.nexpanders, board.ninputs, board.noutputs);
+        }
+    }
+
+    /* Series follow the channels, history starts over */
+    if (changed & (CONFIG_HISTORY | CONFIG_BOARD))
+        hist_stop();
+    /* Plugins start over too, they were told of the old channels */
+    if (changed & (CONFIG_PLUGINS | CONFIG_BOARD))
+        plugin_stop();
+    /* Metrics follow the channels, thermocouples and plugins */
+    if (changed & (CONFIG_METRICS | CONFIG_HISTORY | CONFIG_BOARD | CONFIG_PLUGINS))
+        met_stop();
+    cfg = next;
+    if (changed & (CONFIG_HISTORY | CONFIG_BOARD))
+        hist_start();
+    if (changed & (CONFIG_PLUGINS | CONFIG_BOARD))
+        plugins_start();
+    if (changed & (CONFIG_METRICS | CONFIG_HISTORY | CONFIG_BOARD | CONFIG_PLUGINS))
+        met_start();
+
+    syslog(LOG_INFO, "Reload: configuration applied (changes 0x%x)", changed);
+}
+
+/*
+ * Worker side short circuit cutoff: find the outputs whose sense is
+ * active in what was just read and clear their latch bits from the
+ * shadow, no bus read. A sense seen active has to be still active
+ * short_confirm_us later, so the inrush of a lamp or a capacitive load
+ * at switch-on is not taken for a short. Outputs on another bus are
+ * left to the daemon loop, a worker only touches its own bus. Nothing
+ * is logged here.
+ */
+void
+cutoff(struct event *ev)
+{
+    uint8_t sensed[BOARD_MAX_EXPANDERS][2], gpio[BOARD_MAX_EXPANDERS][2];
+    uint32_t exps = ev->exps, confirm = 0;
+    unsigned int b = board.exp[__builtin_ctz(exps)].bus, failed;
+    int shorted = 0;
+
+    /*
+     * Short circuit sense is active low. INTCAP catches a short that was
+     * over by the time we read GPIO.
+     */
+    for (uint32_t m = exps; m; m &= m - 1) {
+        unsigned int e = __builtin_ctz(m);
+        const struct mcp23017_events *r = &ev->exp[e];
+
+        for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+            sensed[e][p] = board.exp[e].fault[p] & (~r->gpio[p] | (r->intf[p] & ~r->intcap[p]));
+            if (sensed[e][p])
+                confirm |= 1u << e;
+        }
+    }
+
+    /* Only what is still low on a second read trips */
+    if (confirm && cfg.short_confirm_us > 0) {
+        usleep(cfg.short_confirm_us);
+        if (snapshot(confirm, MCP23017_GPIO, 1, gpio, sizeof(gpio[0]), &failed) < 0) {
+            syslog(LOG_ERR, "Reading the expanders: %s\n", snapshot_errmsg(failed));
+            exit(EXIT_FAILURE);
+        }
+        for (uint32_t m = confirm; m; m &= m - 1) {
+            unsigned int e = __builtin_ctz(m);
+
+            memcpy(ev->exp[e].gpio, gpio[e], 2);
+            sensed[e][BOARD_PORT_A] &= ~gpio[e][BOARD_PORT_A];
+            sensed[e][BOARD_PORT_B] &= ~gpio[e][BOARD_PORT_B];
+        }
+    }
+
+    while (confirm) {
+        unsigned int e = __builtin_ctz(confirm);
+        const struct board_expander *x = &board.exp[e];
+
+        confirm &= confirm - 1;
+
+        for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+            for (uint8_t m = sensed[e][p]; m; m &= m - 1) {
+                unsigned int n = x->chan[p][__builtin_ctz(m)];
+                const struct board_pin *pin = &board.output[n];
+
+                board_bit_set(ev->tripped, n);
+                if (board.exp[pin->exp].bus == b) {
+                    ev->cut[pin->exp][pin->port] |= pin->mask;
+                    shorted = 1;
+                }
+            }
+        }
+    }
+
+    if (!shorted)
+        return;
+
+    for (unsigned int e = 0; e < board.nexpanders; e++) {
+        for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+            if (ev->cut[e][p] && mcp23017_update(&mcp[e], MCP23017_OLAT, p, ev->cut[e][p], 0x00) < 0) {
+                syslog(LOG_ERR, "mcp23017_write(): %s\n", mcp23017_errmsg(&mcp[e]));
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ev->cut_ts);
+    PERIPHERY_PROBE3(iotool, cutoff, b, ts_ns(&ev->ts), ts_ns(&ev->cut_ts));
+}
+
+/*
+ * Worker side read of the expanders in ev->exps: their input and fault
+ * ports, cutting off shorted outputs right away. The settle time only
+ * delays the input read.
+ */
+void
+read_expanders(struct event *ev, unsigned int settle_us)
+{
+    unsigned int failed;
+
+    /* INTF, INTCAP and GPIO of both ports in one burst per expander */
+    if (snapshot(ev->exps, MCP23017_INTF, 3, ev->exp, sizeof(ev->exp[0]), &failed) < 0) {
+        syslog(LOG_ERR, "Reading the expanders: %s\n", snapshot_errmsg(failed));
+        exit(EXIT_FAILURE);
+    }
+
+    if (expanders_with(PINS_FAULT) & ev->exps)
+        cutoff(ev);
+
+    /* Possible inrush current, read the inputs again once it settled */
+    if (settle_us > 0 && (expanders_with(PINS_INPUT) & ev->exps)) {
+        uint8_t gpio[BOARD_MAX_EXPANDERS][2];
+
+        usleep(settle_us);
+        if (snapshot(ev->exps, MCP23017_GPIO, 1, gpio, sizeof(gpio[0]), &failed) < 0) {
+            syslog(LOG_ERR, "Reading the expanders: %s\n", snapshot_errmsg(failed));
+            exit(EXIT_FAILURE);
+        }
+        for (uint32_t m = ev->exps; m; m &= m - 1)
+            memcpy(ev->exp[__builtin_ctz(m)].gpio, gpio[__builtin_ctz(m)], 2);
+    }
+}
+
+/* Worker side of an interrupt on line i: clear the edge and read */
+int
+read_interrupt(unsigned int i, struct event *ev)
+{
+    bool dummy;
+
+    if (gpio_read(&irq[i], &dummy) < 0) {
+        syslog(LOG_CRIT, "gpio_read(): %s\n", gpio_errmsg(&irq[i]));
+        exit(EXIT_FAILURE);
+    }
+
+    ev->exps = board.irq_expanders[i];
+    PERIPHERY_PROBE3(iotool, interrupt_start, i, ev->exps, ts_ns(&ev->ts));
+    read_expanders(ev, cfg.debounce_us);
+    PERIPHERY_PROBE2(iotool, interrupt_done, i, ev->exps);
+
+    return 0;
+}
+
+/* Worker side of a queued job, on bus b */
+void
+run_job(unsigned int b, const struct job *j)
+{
+    int ret;
+
+    /* Expanders with inputs on the bus, read like an interrupt */
+    if (j->type == JOB_SAMPLE) {
+        struct event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        clock_gettime(CLOCK_MONOTONIC, &ev.ts);
+        ev.irq = BOARD_NO_IRQ;
+        ev.exps = inputs_on(b);
+        read_expanders(&ev, 0);
+        events_post(&ev);
+        return;
+    }
+
+    /* All of it superseded by an urgent write */
+    if (j->mask == 0)
+        return;
+
+    /* The shadow latch is what we wrote last, no need to read it back */
+    if ((ret = mcp23017_update(&mcp[j->exp], MCP23017_OLAT, j->port, j->mask, j->val)) < 0) {
+        syslog(LOG_ERR, "mcp23017_write(): %s\n", mcp23017_errmsg(&mcp[j->exp]));
+        exit(EXIT_FAILURE);
+    }
+
+    if (j->ts.tv_sec != 0 || j->ts.tv_nsec != 0) {
+        struct timespec now;
+        double s;
+        unsigned int i;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        s = elapsed_ms(&j->ts, &now) / 1000;
+        for (i = 0; i < NLATENCY && s > latency_bounds[i]; i++)
+            ;
+        __atomic_add_fetch(&lane_buckets[j->lane][i], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&lane_sum_ns[j->lane], (unsigned long long)(s * 1e9), __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Worker side idle time: check the configuration registers of the next
+ * expander on bus b. A brown-out silently puts an MCP23017 back to all
+ * inputs, the shadow then no longer matches and is written back.
+ */
+void
+scrub_bus(unsigned int b)
+{
+    static unsigned int next[BOARD_MAX_BUSES];
+    uint8_t cur[BOARD_MAX_EXPANDERS][MCP23017_GPPU + 1][2];
+    unsigned int e, failed;
+
+    /* Round robin, one expander and one burst per call */
+    for (e = 0; e < board.nexpanders; e++) {
+        if (board.exp[(next[b] + e) % board.nexpanders].bus == b)
+            break;
+    }
+    if (e == board.nexpanders)
+        return;
+    e = (next[b] + e) % board.nexpanders;
+    next[b] = e + 1;
+
+    /* IODIR to GPPU, leaving the interrupt registers alone */
+    if (snapshot(1u << e, MCP23017_IODIR, MCP23017_GPPU + 1, cur, sizeof(cur[0]), &failed) < 0) {
+        syslog(LOG_ERR, "Scrub: reading the expander: %s", snapshot_errmsg(failed));
+        __atomic_add_fetch(&i2c_errors[b], 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* The shadow holds the registers in the same order as the burst */
+    if (memcmp(cur[e], mcp[e].shadow, sizeof(cur[e])) == 0)
+        return;
+
+    if (mcp23017_restore(&mcp[e]) < 0) {
+        syslog(LOG_ERR, "Scrub: %s", mcp23017_errmsg(&mcp[e]));
+        __atomic_add_fetch(&i2c_errors[b], 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    syslog(LOG_WARNING, "Scrub: expander 0x%02x on %s was reset, configuration restored (%lu repairs)",
+           board.exp[e].addr, board.bus[b], __atomic_add_fetch(&scrub_repairs, 1, __ATOMIC_RELAXED));
+}
+
+const struct worker_ops worker_ops = {
+    .job = run_job,
+    .irq = read_interrupt,
+    .idle = scrub_bus,
+};
+
+/* Have every bus with inputs read them once */
+void
+sample_inputs(void)
+{
+    for (unsigned int b = 0; b < board.nbuses; b++) {
+        struct job j = { JOB_SAMPLE, 0, 0, 0, 0 };
+
+        if (!inputs_on(b))
+            continue;
+        worker_push(&worker[b], &j);
+        sampling++;
+    }
+}
+
+/* One worker per bus, each owning the interrupt lines of its expanders */
+void
+workers_start(void)
+{
+    for (unsigned int b = 0; b < board.nbuses; b++) {
+        unsigned int irqs[BOARD_MAX_IRQS], n = 0;
+        int fds[BOARD_MAX_IRQS];
+
+        for (unsigned int i = 0; i < board.nirqs; i++) {
+            if (board.exp[__builtin_ctz(board.irq_expanders[i])].bus == b) {
+                irqs[n] = i;
+                fds[n++] = gpio_fd(&irq[i]);
+            }
+        }
+
+        if (worker_start(&worker[b], b, &worker_ops, cfg.scrub_ms, irqs, fds, n) < 0) {
+            syslog(LOG_CRIT, "worker_start(%s): %s", board.bus[b], strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    workers_running = 1;
+
+    /* Samples in flight went with the old workers */
+    sampling = 0;
+    for (size_t i = 0; i < MAX_CLIENTS; i++) {
+        if (query[i].banks) {
+            sample_inputs();
+            break;
+        }
+    }
+}
+
+/* Reload and handover change the hardware under the workers' feet */
+void
+workers_stop(void)
+{
+    for (unsigned int b = 0; b < board.nbuses && workers_running; b++)
+        worker_stop(&worker[b]);
+
+    workers_running = 0;
+}
+
+/* Worst time from an interrupt edge to the cutoff write, since start */
+double cutoff_worst_ms;
+
+/* Account and log a cutoff, after the fact */
+void
+cutoff_note(const struct event *ev)
+{
+    double ms;
+
+    /* Only outputs on other buses, cut off by the daemon loop */
+    if (ev->cut_ts.tv_sec == 0 && ev->cut_ts.tv_nsec == 0) {
+        BINLOG0(BL_SHORT);
+        return;
+    }
+
+    ms = elapsed_ms(&ev->ts, &ev->cut_ts);
+    metrics_observe(&met, met_cut_latency, ms / 1000);
+    if (ms > cutoff_worst_ms) {
+        cutoff_worst_ms = ms;
+        syslog(LOG_NOTICE, "Short circuit, cut off in %.3f ms, the worst so far", ms);
+    }
+    else {
+        BINLOG(BL_CUTOFF, binlog_double(ms), binlog_double(cutoff_worst_ms));
+    }
+}
+
+/* Age of the oldest input reading, in *oldest. 0 if there are no inputs */
+int
+inputs_read_at(struct timespec *oldest)
+{
+    int found = 0;
+
+    for (uint32_t m = expanders_with(PINS_INPUT); m; m &= m - 1) {
+        const struct timespec *t = &input_ts[__builtin_ctz(m)];
+
+        if (!found || elapsed_ms(t, oldest) > 0)
+            *oldest = *t;
+        found = 1;
+    }
+
+    return found;
+}
+
+/* Send client i the state of a bank */
+void
+answer(size_t i, unsigned int bank)
+{
+    io_t rep = { IO_COMMAND(OUTPUT_INFO, bank), board_bank(input_state, bank), board_bank(outputs, bank) };
+
+    /* The client may have left before its answer, no SIGPIPE for that */
+    if (send(client_socket[i], &rep, sizeof(rep), MSG_NOSIGNAL) < 0) {
+        syslog(LOG_ERR, "Failed to answer a query. send(): %s", strerror(errno));
+        client_close(i);
+    }
+}
+
+/* Answer the queries that the inputs have been read since */
+void
+answer_queries(void)
+{
+    struct timespec oldest;
+    int any = inputs_read_at(&oldest);
+
+    for (size_t i = 0; i < MAX_CLIENTS; i++) {
+        if (!query[i].banks || (any && elapsed_ms(&query[i].since, &oldest) < 0))
+            continue;
+        for (uint16_t m = query[i].banks; m && client_socket[i]; m &= m - 1)
+            answer(i, __builtin_ctz(m));
+        query[i].banks = 0;
+    }
+}
+
+/*
+ * Client i asks for the state of a bank, no older than the number of
+ * milliseconds in input_bits (low byte) and output_bits (high byte).
+ * Outputs are what was commanded. Inputs are answered from the last read
+ * when that is recent enough, otherwise the query waits for one sample
+ * read per bus, shared by all queries arriving meanwhile.
+ */
+void
+handle_query(size_t i, const io_t *req)
+{
+    unsigned int max_age = req->input_bits | req->output_bits << 8;
+    struct timespec now, oldest;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (!inputs_read_at(&oldest) || elapsed_ms(&oldest, &now) <= max_age) {
+        answer(i, IO_BANK(req->command));
+        return;
+    }
+
+    if (!query[i].banks)
+        query[i].since = now;
+    query[i].banks |= 1u << IO_BANK(req->command);
+
+    if (!sampling)
+        sample_inputs();
+}
+
+/*
+ * Daemon side of an interrupt or sample read: update the inputs, finish
+ * the cutoff of outputs whose short circuit sense was active and tell the
+ * clients.
+ */
+void
+handle_event(const struct event *ev)
+{
+    uint8_t cut[BOARD_MAX_EXPANDERS][2];
+    board_bits_t before;
+    uint32_t exps = ev->exps;
+    unsigned int nbanks;
+    int shorted = 0;
+
+    PERIPHERY_PROBE3(iotool, event_start, ev->irq, ev->exps, ts_ns(&ev->ts));
+    memcpy(before, input_state, sizeof(before));
+    if (ev->irq == BOARD_NO_IRQ && sampling > 0)
+        sampling--;
+
+    while (exps) {
+        unsigned int e = __builtin_ctz(exps);
+        const struct board_expander *x = &board.exp[e];
+
+        exps &= exps - 1;
+        input_ts[e] = ev->ts;
+
+        for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+            uint8_t v = ev->exp[e].gpio[p];
+
+            for (uint8_t m = x->input[p]; m; m &= m - 1) {
+                unsigned int n = x->chan[p][__builtin_ctz(m)];
+                if (v & m & -m)
+                    board_bit_set(input_state, n);
+                else
+                    board_bit_clear(input_state, n);
+            }
+        }
+    }
+
+    output_masks(ev->tripped, cut);
+    for (unsigned int e = 0; e < board.nexpanders; e++)
+        shorted |= cut[e][BOARD_PORT_A] | cut[e][BOARD_PORT_B];
+
+    if (shorted) {
+        /* The worker cut off what is on its bus, the rest is ours */
+        for (unsigned int e = 0; e < board.nexpanders; e++) {
+            for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+                struct job j = { JOB_WRITE, e, p, cut[e][p] & ~ev->cut[e][p], 0x00, LANE_URGENT };
+
+                if (j.mask)
+                    worker_push(&worker[board.exp[e].bus], &j);
+                olat[e][p] &= ~cut[e][p];
+                olat_dirty[e][p] &= ~cut[e][p];
+            }
+        }
+        cutoff_note(ev);
+        for (unsigned int n = 0; n < board.noutputs; n++) {
+            if (board_bit_test(ev->tripped, n))
+                metrics_add(&met, met_trips + n, 1);
+        }
+        /* Keep them off after a restart too */
+        for (unsigned int w = 0; w < BOARD_WORDS; w++)
+            outputs[w] &= ~ev->tripped[w];
+        save_outputs();
+        /* Inform clients */
+        nbanks = (board.noutputs + 7) / 8;
+        for (unsigned int b = 0; b < nbanks; b++) {
+            if (board_bank(ev->tripped, b))
+                broadcast(IO_COMMAND(SHORT_CIRCUIT, b), board_bank(ev->tripped, b), board_bank(outputs, b));
+        }
+    }
+    /* A sample read only tells of an edge the interrupt missed */
+    else if (ev->irq != BOARD_NO_IRQ || memcmp(before, input_state, sizeof(before)) != 0) {
+        BINLOG(BL_INPUT, ev->exps);
+        nbanks = (board.ninputs + 7) / 8;
+        for (unsigned int b = 0; b < nbanks || b == 0; b++)
+            broadcast(IO_COMMAND(INPUT_INFO, b), board_bank(input_state, b), board_bank(outputs, b));
+    }
+
+    /* Plugins act on changes only, what they set goes out ahead of the clients' */
+    if (plugin_count()) {
+        struct plugin_event pev = { ev->ts, ev->irq == BOARD_NO_IRQ };
+        uint32_t any = 0;
+
+        memcpy(pev.inputs, input_state, sizeof(pev.inputs));
+        memcpy(pev.tripped, ev->tripped, sizeof(pev.tripped));
+        for (unsigned int w = 0; w < BOARD_WORDS; w++) {
+            pev.changed[w] = before[w] ^ input_state[w];
+            any |= pev.changed[w] | pev.tripped[w];
+        }
+        if (any) {
+            plugin_event(&pev);
+            outputs_commit(LANE_URGENT, NULL);
+        }
+    }
+
+    answer_queries();
+    hist_record(&ev->ts);
+    met_record();
+
+    if (ev->irq != BOARD_NO_IRQ && met_socket >= 0) {
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        metrics_observe(&met, met_irq_latency, elapsed_ms(&ev->ts, &now) / 1000);
+    }
+    PERIPHERY_PROBE1(iotool, event_done, ev->irq);
+}
+
+/* A client asked for outputs to change, on a lane, read at ts */
+void
+handle_command(const io_t *req, unsigned int lane, const struct timespec *ts)
+{
+    unsigned int base = IO_BANK(req->command) * 8;
+
+    switch (IO_CMD(req->command)) {
+        case SET_OUTPUT_BIT :
+        case CLEAR_OUTPUT_BIT :
+            for (unsigned int b = 0; b < 8; b++) {
+                if ((req->output_bits & (1 << b)) && base + b < board.noutputs)
+                    output_set(base + b, IO_CMD(req->command) == SET_OUTPUT_BIT);
+            }
+        break;
+        case SET_ALL_OUTPUT_BIT :
+        case CLEAR_ALL_OUTPUT_BIT :
+            for (unsigned int n = 0; n < board.noutputs; n++)
+                output_set(n, IO_CMD(req->command) == SET_ALL_OUTPUT_BIT);
+        break;
+        default : break;
+    }
+
+    outputs_commit(lane, ts);
+}
+
+/* Read ahead what client i sent, closing it on a read error */
+int
+client_read(size_t i)
+{
+    if (session_fill(&session[i], client_socket[i]) < 0) {
+        syslog(LOG_ERR, "Failed to read client on socket. read(): %s", strerror(errno));
+        client_close(i);
+        return -1;
+    }
+
+    return 0;
+}
 
-#include "i2c.h"
-#include "gpio.h"
+/* Client i sent everything it will and all of it ran */
+void
+client_done(size_t i)
+{
+    io_t req;
 
-#define MAX_CLIENTS 5
-#define SOCK_PATH "/var/run/iotool.sock"
-#define PH17 241
-#define I2C_ADDR 0x20
+    if (client_socket[i] && session[i].eof && !session_peek(&session[i], &req)) {
+        BINLOG0(BL_CLIENT_GONE);
+        client_close(i);
+    }
+}
 
-uint8_t inputs[]  = {0x01, 0x02, 0x04, 0x08};
-volatile sig_atomic_t exit_flag = 0;
+void
+client_run(size_t i, const io_t *req, const struct timespec *ts)
+{
+    if (IO_CMD(req->command) == QUERY_STATE)
+        handle_query(i, req);
+    else
+        handle_command(req, client_lane[i], ts);
+}
 
-typedef struct iotool {
-    uint8_t command;
-    uint8_t input_bits;
-    uint8_t output_bits;
-} io_t;
+/* Urgent client i: everything it sent, no limits */
+void
+urgent_run(size_t i, const struct timespec *ts)
+{
+    io_t req;
+    int n;
 
-enum {
-    INPUT_INFO,
-    OUTPUT_INFO,
-    SHORT_CIRCUIT,
-    SET_OUTPUT_BIT,
-    SET_ALL_OUTPUT_BIT,
-    CLEAR_OUTPUT_BIT,
-    CLEAR_ALL_OUTPUT_BIT
-};
+    do {
+        if (client_read(i) < 0)
+            return;
+        for (n = 0; client_socket[i] && session_peek(&session[i], &req); n++) {
+            session_pop(&session[i]);
+            client_run(i, &req, ts);
+        }
+    } while (client_socket[i] && n > 0 && !session[i].eof);
 
-/* MCP12X017 registers when IOCON.BANK = 0 */
-
-#define MCP23017_IODIRA    0x00
-#define MCP23017_IODIRB    0x01
-#define MCP23017_IPOLA     0x02
-#define MCP23017_IPOLB     0x03
-#define MCP23017_GPINTENA  0x04
-#define MCP23017_GPINTENB  0x05
-#define MCP23017_DEFVALA   0x06
-#define MCP23017_DEFVALB   0x07
-#define MCP23017_INTCONA   0x08
-#define MCP23017_INTCONB   0x09
-#define MCP23017_IOCONA    0x0A
-#define MCP23017_IOCONB    0x0B
-#define MCP23017_GPPUA     0x0C
-#define MCP23017_GPPUB     0x0D
-#define MCP23017_INTFA     0x0E
-#define MCP23017_INTFB     0x0F
-#define MCP23017_INTCAPA   0x10
-#define MCP23017_INTCAPB   0x11
-#define MCP23017_GPIOA     0x12
-#define MCP23017_GPIOB     0x13
-#define MCP23017_OLATA     0x14
-#define MCP23017_OLATB     0x15
+    client_done(i);
+}
 
-void
-usage(const char *pname)
+/*
+ * One deficit round robin round over the normal clients, starting one
+ * further each time. What the loop has to wait for: 0 when requests are
+ * left for another round, the ms until a bucket refills, or -1.
+ */
+int
+sessions_run(const struct timespec *now)
 {
-    fprintf(stderr, "Usage: %s <options> \n", pname);
-    fprintf(stderr, "   Options:    -o <0-3|x,y>    Digital output number or comma separated list.\n");
-    fprintf(stderr, "               -l <0|1>        Output level.\n");
-    fprintf(stderr, "               -p <ms>         Polling inputs. Negative means infinite.\n");
-    fprintf(stderr, "               -s              Read the inputs and exit.\n");
-    fprintf(stderr, "               -i <ms>         Pulse mode. Time is the period time. Use with -o and -c\n");
-    fprintf(stderr, "               -c <num>        Number of periods in pulse mode.\n");
-    fprintf(stderr, "               -d              Daemon mode.\n");
+    int wait = -1;
 
-    exit(0);
+    for (size_t k = 0; k < MAX_CLIENTS; k++) {
+        size_t i = (session_next + k) % MAX_CLIENTS;
+        struct session *s = &session[i];
+        io_t req;
+        int ms, q;
+
+        if (!client_socket[i] || client_lane[i] != LANE_NORMAL)
+            continue;
+        if (!session_peek(s, &req)) {
+            s->deficit = 0;
+            client_done(i);
+            continue;
+        }
+
+        s->deficit += SESSION_QUANTUM;
+        while (client_socket[i] && session_peek(s, &req) && s->deficit >= session_cost(&req)) {
+            q = IO_CMD(req.command) == QUERY_STATE;
+            if (!s->unlimited && !(q ? bucket_take(&s->query, cfg.query_rate, cfg.query_burst, now, &ms)
+                    : bucket_take(&s->cmd, cfg.cmd_rate, cfg.cmd_burst, now, &ms))) {
+                if (!s->throttled) {
+                    s->throttled = 1;
+                    throttled[q]++;
+                    metrics_add(&met, met_throttled + q, 1);
+                    BINLOG(BL_THROTTLED, i, q);
+                }
+                /* Credit is no use while waiting, do not hoard it */
+                if (s->deficit > SESSION_QUANTUM)
+                    s->deficit = SESSION_QUANTUM;
+                if (wait < 0 || ms < wait)
+                    wait = ms;
+                break;
+            }
+            s->deficit -= session_cost(&req);
+            session_pop(s);
+            client_run(i, &req, now);
+        }
+
+        if (!client_socket[i])
+            continue;
+        if (!session_peek(s, &req)) {
+            s->deficit = 0;
+            client_done(i);
+        }
+        else if (!s->throttled) {
+            wait = 0;
+        }
+    }
+
+    session_next = (session_next + 1) % MAX_CLIENTS;
+
+    return wait;
 }
 
-void
-exit_program(int sig)
+/*
+ * Command line side of the interrupt lines: wait for an edge on any of
+ * them and clear those that saw one. 1 on an edge, 0 on a timeout, -1 on
+ * an error
+ */
+int
+irqs_poll(int timeout_ms)
 {
-    exit_flag = 1;
+    struct pollfd pfd[BOARD_MAX_IRQS];
+    bool dummy;
+    int ret;
+
+    for (unsigned int i = 0; i < board.nirqs; i++) {
+        pfd[i].fd = gpio_fd(&irq[i]);
+        pfd[i].events = POLLPRI | POLLERR;
+    }
+
+    if ((ret = poll(pfd, board.nirqs, timeout_ms)) < 0) {
+        fprintf(stderr, "poll(): %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < board.nirqs && ret > 0; i++) {
+        if (pfd[i].revents && gpio_read(&irq[i], &dummy) < 0) {
+            fprintf(stderr, "gpio_read(): %s\n", gpio_errmsg(&irq[i]));
+            return -1;
+        }
+    }
+
+    return ret > 0;
+}
+
+/*
+ * Daemon side of the bus broker: a client running this very binary is
+ * the command line forwarding output changes. It stays on the normal
+ * lane but has no rate limit, which would stretch its pulses.
+ */
+int
+client_is_broker(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    char proc[32], exe[PATH_MAX];
+    ssize_t n;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return 0;
+    snprintf(proc, sizeof(proc), "/proc/%d/exe", (int)cred.pid);
+    if ((n = readlink(proc, exe, sizeof(exe) - 1)) <= 0)
+        return 0;
+    exe[n] = '\0';
+
+    return strcmp(exe, self_exe) == 0;
+}
+
+/*
+ * Bus broker: while the daemon runs it owns the bus, so output changes
+ * from the command line are sent to it as client commands rather than
+ * written behind its back. They apply on top of its shadows, without
+ * setting up the expanders again. They go to the normal socket like any
+ * client's, the daemon knows the broker and does not rate limit it. 0
+ * when no daemon listens, 1 once it has handed them to the bus workers,
+ * -1 on error.
+ */
+int
+forward_outputs(const uint32_t *set, int level, int pulse, unsigned long periods, unsigned int halfperiod)
+{
+    const struct timeval tv = { 2, 0 };
+    const char *path = cfg.socket_path;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    unsigned int nbanks = (board.noutputs + 7) / 8;
+    ssize_t ret = -1;
+    io_t req, rep;
+    int fd;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        fprintf(stderr, "socket(): %s\n", strerror(errno));
+        return -1;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+
+        close(fd);
+        if (err == ENOENT || err == ECONNREFUSED)
+            return 0;
+        fprintf(stderr, "%s: %s\n", path, strerror(err));
+        return -1;
+    }
+
+    for (size_t i = 0; i < (pulse ? periods * 2 : 1); i++) {
+        int on = pulse ? !(i & 1) : level;
+
+        for (unsigned int b = 0; b < nbanks; b++) {
+            req = (io_t){ IO_COMMAND(on ? SET_OUTPUT_BIT : CLEAR_OUTPUT_BIT, b), 0, board_bank(set, b) };
+            if (req.output_bits && write(fd, &req, sizeof(req)) != sizeof(req))
+                goto fail;
+        }
+        if (pulse)
+            usleep(halfperiod-200);
+    }
+
+    /*
+     * Requests of a client run in order: once the answer is back, all the
+     * commands are queued to the bus workers, not necessarily latched yet
+     */
+    req = (io_t){ IO_COMMAND(QUERY_STATE, 0), 0xFF, 0xFF };
+    if (write(fd, &req, sizeof(req)) != sizeof(req))
+        goto fail;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    while ((ret = recv(fd, &rep, sizeof(rep), MSG_WAITALL)) == sizeof(rep)) {
+        if (IO_CMD(rep.command) == OUTPUT_INFO) {
+            close(fd);
+            return 1;
+        }
+    }
+
+fail:
+    if (ret >= 0)
+        fprintf(stderr, "%s: closed by the daemon, too many clients?\n", path);
+    else
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
 }
 
 int
 main(int argc, char *argv[])
 {
-    i2c_t i2c;
-    uint8_t pbst = 0, past = 0, outc = 0;
-    int opt, level = 0, timeout = 0, q = 0, interrupt_fd;
+    board_bits_t outc = { 0 };
+    uint8_t mask[BOARD_MAX_EXPANDERS][2];
+    struct mcp23017_events evs[BOARD_MAX_EXPANDERS];
+    int opt, level = 0, timeout = 0, q = 0;
     int p = 0, seto = 0;
-    gpio_t interrupt;
-    bool dummy;
-    io_t iotool_data, iotool_data_req;
+    /* Poll mode capture */
+    capture_t cap;
+    int cap_fmt = CAPTURE_TEXT;
+    const char *cap_path = NULL;
+    board_bits_t inputs;
+    struct timespec ts;
+    /* Logic analyzer */
+    const char *la_path = NULL, *la_start = NULL, *la_stop = NULL;
+    size_t la_size = ANALYZER_RING;
+    /* Handover socket when replacing a running daemon */
+    int hsock = -1, handed_over = 0;
+    struct persist_state pstate;
+    int restore = 0, nclients;
+    unsigned int failed;
+    char err[192];
     /* Variables for unix sockets */
-    int client_socket[MAX_CLIENTS], new_socket, master_socket,
-        sd, max_sd, len;
+    int new_socket, sd, max_sd;
+    /* A first round right away, for requests handed over already read */
+    int sessions_wait = 0;
     socklen_t t;
-    struct sockaddr_un local, remote;
-    fd_set rdfs, exfs;
+    struct sockaddr_un remote;
+    fd_set rdfs;
+    /* Interrupt events from the bus workers */
+    static struct event events[WORKER_EVENTS];
+    size_t n;
+    unsigned long lost;
     /* Pulse mode */
     int pulse = 0;
     unsigned long periodcnt;
     unsigned int halfperiod;
 
     /* Install signal for ^C */
-    struct sigaction sa_exit;
+    struct sigaction sa_exit, sa_handover, sa_reload;
 
     nice(-20);
 
-    while ((opt = getopt(argc, argv, "o:l:p:si:c:d?")) != -1) {
+    while ((opt = getopt(argc, argv, "o:l:p:sf:w:a:t:T:b:i:c:dC:?")) != -1) {
         switch (opt) {
             case 'o' :
-                if (strlen(optarg) > 1) {
+                {
                     int i = 0;
                     char *token;
                     const char s[] = ",";
@@ -127,22 +2414,14 @@ main(int argc, char *argv[])
 
                     while (token != NULL) {
                         i = atoi(token);
-                        if (i < 0 || i > 3) {
-                            fprintf(stderr, "Output must be 0-3\n");
+                        if (i < 0 || i >= BOARD_MAX_CHANNELS) {
+                            fprintf(stderr, "Output must be 0-%d\n", BOARD_MAX_CHANNELS - 1);
                             usage(argv[0]);
                         }
-                        outc = (outc | (1 << (uint8_t) i));
+                        board_bit_set(outc, i);
                         token = strtok(NULL, s);
                     }
                 }
-                else {
-                    int i = atoi(optarg);
-                    if (i < 0 || i > 3) {
-                        fprintf(stderr, "Output must be 0-3\n");
-                        usage(argv[0]);
-                    }
-                    outc = (1 << (uint8_t) i);
-                }
                 seto = 1;
             break;
 
@@ -164,6 +2443,37 @@ main(int argc, char *argv[])
                 timeout = 0;
             break;
 
+            case 'f' :
+                if ((cap_fmt = capture_format(optarg)) < 0) {
+                    fprintf(stderr, "Format must be text, csv, ndjson or bin\n");
+                    usage(argv[0]);
+                }
+            break;
+
+            case 'w' :
+                cap_path = optarg;
+            break;
+
+            case 'a' :
+                la_path = optarg;
+            break;
+
+            case 't' :
+                la_start = optarg;
+            break;
+
+            case 'T' :
+                la_stop = optarg;
+            break;
+
+            case 'b' :
+                if (atoi(optarg) < 1) {
+                    fprintf(stderr, "Buffer size must be a positive number of KiB.\n");
+                    usage(argv[0]);
+                }
+                la_size = (size_t)atoi(optarg) * 1024;
+            break;
+
             case 'i' :
                 pulse = 1;
                 if (atoi(optarg) < 1) {
@@ -181,146 +2491,294 @@ main(int argc, char *argv[])
                 q = 1;
             break;
 
+            case 'C' :
+                config_path = optarg;
+            break;
+
             default :
                 usage(argv[0]);
             break;
         }
     }
 
+    if (config_load(&cfg, config_path, err, sizeof(err)) < 0 ||
+        load_board(&board, &cfg, err, sizeof(err)) < 0) {
+        fprintf(stderr, "%s\n", err);
+        exit(1);
+    }
+
+    for (unsigned int n = board.noutputs; n < BOARD_MAX_CHANNELS; n++) {
+        if (board_bit_test(outc, n)) {
+            fprintf(stderr, "Output must be 0-%u\n", board.noutputs - 1);
+            usage(argv[0]);
+        }
+    }
+
     sa_exit.sa_handler = exit_program;
     sa_exit.sa_flags = 0;
     sigemptyset(&sa_exit.sa_mask);
 
-    if (sigaction(SIGINT, &sa_exit, NULL) < 0) {
+    if (sigaction(SIGINT, &sa_exit, NULL) < 0 ||
+        sigaction(SIGTERM, &sa_exit, NULL) < 0) {
         perror("sigaction() error");
         exit(EXIT_FAILURE);
     }
 
-    /* Open the i2c-1 bus */
-    if (i2c_open(&i2c, "/dev/i2c-1") < 0) {
-        fprintf(stderr, "i2c_open(): %s\n", i2c_errmsg(&i2c));
-        exit(1);
-    }
+    sa_handover.sa_handler = request_handover;
+    sa_handover.sa_flags = 0;
+    sigemptyset(&sa_handover.sa_mask);
 
-    /* Enable interrupts on Port A */
-    uint8_t inta[] = { MCP23017_GPINTENA, 0xFF };
-    /* Port B 0-3 to output */
-    uint8_t portb_dir[] = { MCP23017_IODIRB, 0xF0 };
-    uint8_t porta_dir[] = { MCP23017_IODIRA, 0xFF };
-    /* Enable pull-ups Port A 4-7 */
-    uint8_t pulla[] = { MCP23017_GPPUA, 0xF0 };
-    uint8_t outp[] = { MCP23017_GPIOB, 0x00 };
-
-    struct i2c_msg conf[] =
-        {
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = portb_dir },
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = porta_dir },
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = pulla },
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = inta }
-        };
-
-    uint8_t PADR = MCP23017_GPIOA;
-    struct i2c_msg padata[] =
-        {
-            { .addr = I2C_ADDR, .flags = 0, .len = 1, .buf = &PADR },
-            { .addr = I2C_ADDR, .flags = I2C_M_RD, .len = 1, .buf = &past }
-        };
-
-    uint8_t PBDR = MCP23017_GPIOB;
-    struct i2c_msg pbdata[] =
-        {
-            { .addr = I2C_ADDR, .flags = 0, .len = 1, .buf = &PBDR },
-            { .addr = I2C_ADDR, .flags = I2C_M_RD, .len = 1, .buf = &pbst }
-        };
-
-    struct i2c_msg output[] =
-        {
-            { .addr = I2C_ADDR, .flags = 0, .len = 2, .buf = outp }
-        };
+    sa_reload.sa_handler = request_reload;
+    sa_reload.sa_flags = 0;
+    sigemptyset(&sa_reload.sa_mask);
 
-    /* Transfer I2C messages */
-    for (size_t i = 0; i < 4; i++) {
-        if (i2c_transfer(&i2c, &conf[i], 1) < 0) {
-            fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-            exit(1);
-        }
+    if (q && (sigaction(SIGUSR2, &sa_handover, NULL) < 0 ||
+              sigaction(SIGHUP, &sa_reload, NULL) < 0)) {
+        perror("sigaction() error");
+        exit(EXIT_FAILURE);
     }
 
+    /*
+     * Get the socket up before touching the hardware, so clients racing
+     * us at boot queue in the listen backlog instead of failing to connect.
+     */
     if (q) {
         openlog("iotool-server", LOG_CONS | LOG_PID, LOG_USER);
         syslog(LOG_INFO, "Entering iotool-server daemon...");
+        clock_gettime(CLOCK_MONOTONIC, &boot_start);
+        boot_last = boot_start;
 
-        if (daemon(0, 0) < 0) {
-            syslog(LOG_CRIT, "daemon(): %s", strerror(errno));
-            return -2;
-        }
+        ssize_t n = readlink("/proc/self/exe", self_exe, sizeof(self_exe) - 1);
+        if (n > 0)
+            self_exe[n] = '\0';
+        else
+            snprintf(self_exe, sizeof(self_exe), "%s", argv[0]);
 
         for (size_t i = 0; i < MAX_CLIENTS; i++)
             client_socket[i] = 0;
 
-        if ((master_socket = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-            syslog(LOG_CRIT, "socket(): %s", strerror(errno));
-            exit(1);
+        if ((hsock = handover_inherited()) >= 0) {
+            if (resume_handover(hsock) < 0)
+                exit(1);
+            boot_phase("handover");
+        }
+        else {
+            if ((master_socket = listen_socket()) < 0)
+                exit(1);
+            boot_phase("socket");
         }
 
-        local.sun_family = AF_UNIX;
-        strcpy(local.sun_path, SOCK_PATH);
-        unlink(local.sun_path);
-        len = strlen(local.sun_path) + sizeof(local.sun_family);
-        if (bind(master_socket, (struct sockaddr *)&local, len) == -1) {
-            syslog(LOG_CRIT, "bind(): %s", strerror(errno));
+        /* Handed over with the listening socket unless there was none */
+        if (urgent_socket < 0 && cfg.urgent_socket[0] != '\0' &&
+            (urgent_socket = bind_socket(cfg.urgent_socket)) < 0)
+            syslog(LOG_ERR, "No urgent socket, emergency clients use %s", cfg.socket_path);
+    }
+
+    /* The daemon applies output changes for us when it runs */
+    if (!q && (pulse || seto)) {
+        int ret = forward_outputs(outc, level, pulse, periodcnt, halfperiod);
+
+        if (ret < 0)
             exit(1);
-        }
+        if (ret > 0)
+            return 0;
+    }
 
-        if (listen(master_socket, 5) == -1) {
-            syslog(LOG_CRIT, "listen(): %s", strerror(errno));
+    /* Open the buses, unless inherited already configured */
+    for (unsigned int i = 0; i < board.nbuses && hsock < 0; i++) {
+        if (i2c_open(&bus[i], board.bus[i]) < 0) {
+            fprintf(stderr, "i2c_open(): %s\n", i2c_errmsg(&bus[i]));
             exit(1);
         }
+    }
 
-        t = sizeof(remote);
+    /* Register shadows, including the output latches */
+    if (expanders_open() < 0)
+        exit(1);
 
-        if (gpio_open(&interrupt, PH17, GPIO_DIR_IN) < 0) {
-            syslog(LOG_CRIT, "gpio_open(): %s\n", gpio_errmsg(&interrupt));
+    if (q) {
+        if (persist_open(&persist, cfg.state_path) < 0)
+            syslog(LOG_WARNING, "persist_open(%s): %s, outputs will not survive a restart",
+                   cfg.state_path, strerror(errno));
+        else if (persist_load(&persist, &pstate) > 0 && hsock < 0)
+            restore = 1;
+
+        if (restore)
+            memcpy(outputs, pstate.output_bits, sizeof(pstate.output_bits));
+        output_rebuild();
+
+        for (unsigned int e = 0; e < board.nexpanders && hsock < 0; e++) {
+            for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+                if (!board.exp[e].output[p])
+                    continue;
+
+                if (restore) {
+                    /* Latch the commanded outputs before IODIR drives the pins */
+                    olat_dirty[e][p] = 0xFF;
+                    continue;
+                }
+
+                /* Nothing saved: take over whatever the latches hold */
+                for (uint8_t m = mcp23017_shadow(&mcp[e], MCP23017_OLAT, p) & board.exp[e].output[p];
+                     m; m &= m - 1)
+                    output_set(board.exp[e].chan[p][__builtin_ctz(m)], 1);
+            }
+        }
+        if (!restore)
+            memset(olat_dirty, 0, sizeof(olat_dirty));
+
+        if (output_flush(LANE_NORMAL, NULL, &failed) < 0) {
+            fprintf(stderr, "mcp23017_write(): %s\n", mcp23017_errmsg(&mcp[failed]));
             exit(1);
         }
+        if (restore && hsock < 0) {
+            unsigned int on = 0;
+
+            for (unsigned int w = 0; w < BOARD_WORDS; w++)
+                on += __builtin_popcount(outputs[w]);
+            syslog(LOG_INFO, "Restored %u output(s) on, of %u", on, board.noutputs);
+        }
+    }
 
-        if (gpio_set_edge(&interrupt, GPIO_EDGE_FALLING) < 0) {
-            syslog(LOG_CRIT, "gpio_set_edge(): %s\n", gpio_errmsg(&interrupt));
+    /* Transfer I2C messages */
+    for (unsigned int e = 0; e < board.nexpanders && hsock < 0; e++) {
+        if (expander_setup(e) < 0) {
+            fprintf(stderr, "mcp23017_write_pair(): %s\n", mcp23017_errmsg(&mcp[e]));
             exit(1);
         }
+    }
 
-        if ((interrupt_fd = gpio_fd(&interrupt)) < 0) {
-            syslog(LOG_CRIT, "gpio_fd(): %s\n", gpio_errmsg(&interrupt));
+    if (q && hsock >= 0) {
+        /* Tell systemd about the new main pid before the old one exits */
+        sdnotify_sendf("MAINPID=%d\nREADY=1\nSTATUS=Running", (int)getpid());
+        if (handover_ack(hsock) < 0) {
+            syslog(LOG_CRIT, "handover_ack(): %s", strerror(errno));
             exit(1);
         }
+        close(hsock);
+        syslog(LOG_INFO, "Handover complete");
+    }
+    else if (q) {
+        boot_phase("i2c");
+
+        /* With Type=notify the service manager tracks us, no need to fork */
+        if (getenv("NOTIFY_SOCKET") == NULL && daemon(0, 0) < 0) {
+            syslog(LOG_CRIT, "daemon(): %s", strerror(errno));
+            return -2;
+        }
+
+        for (unsigned int i = 0; i < board.nirqs; i++) {
+            if (interrupt_setup(&irq[i], board.irq_gpio[i]) < 0) {
+                syslog(LOG_CRIT, "interrupt_setup(): %s\n", gpio_errmsg(&irq[i]));
+                exit(1);
+            }
+        }
 
-        if (gpio_read(&interrupt, &dummy) < 0) {
-            syslog(LOG_CRIT, "gpio_read(): %s\n", gpio_errmsg(&interrupt));
+        /* Dummy read, releases INTA and fills in the input state */
+        if (snapshot(expanders_with(PINS_INPUT | PINS_FAULT), MCP23017_INTF, 3,
+                     evs, sizeof(evs[0]), &failed) < 0) {
+            syslog(LOG_ERR, "Reading the expanders: %s\n", snapshot_errmsg(failed));
             exit(EXIT_FAILURE);
         }
-        /* Dummy read */
-        for (size_t i = 0; i < 2; i++) {
-            if (i2c_transfer(&i2c, &padata[i], 1) < 0) {
-                syslog(LOG_ERR, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                exit(EXIT_FAILURE);
+        for (unsigned int e = 0; e < board.nexpanders; e++) {
+            for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+                for (uint8_t m = evs[e].gpio[p] & board.exp[e].input[p]; m; m &= m - 1)
+                    board_bit_set(input_state, board.exp[e].chan[p][__builtin_ctz(m)]);
             }
         }
 
-        syslog(LOG_INFO, "Init success!");
+        boot_phase("gpio");
+        syslog(LOG_INFO, "Init success! %u expander(s), %u inputs, %u outputs",
+               board.nexpanders, board.ninputs, board.noutputs);
+        sdnotify_send("READY=1\nSTATUS=Running");
+    }
+
+    if (q) {
+        t = sizeof(remote);
+
+        if (events_init() < 0) {
+            syslog(LOG_CRIT, "events_init(): %s", strerror(errno));
+            exit(1);
+        }
+        if (binlog_start(log_formats, sizeof(log_formats) / sizeof(log_formats[0]), cfg.binlog_path) < 0) {
+            syslog(LOG_ERR, "Binary log %s: %s", cfg.binlog_path, strerror(errno));
+            binlog_start(log_formats, sizeof(log_formats) / sizeof(log_formats[0]), NULL);
+        }
+        workers_start();
+        hist_start();
+        plugins_start();
+        met_start();
 
         while (!exit_flag) {
+            struct timeval tv, *tvp = NULL;
+            int ms, pms;
+            fd_set wrfs;
+
+            if (handover_flag) {
+                handover_flag = 0;
+                workers_stop();
+                /* The new instance binds the metrics port and loads the plugins itself */
+                met_stop();
+                plugin_stop();
+                if (hand_over(argv) == 0) {
+                    handed_over = 1;
+                    break;
+                }
+                plugins_start();
+                met_start();
+                workers_start();
+            }
+
+            if (reload_flag) {
+                reload_flag = 0;
+                sdnotify_send("RELOADING=1");
+                workers_stop();
+                reload_config();
+                workers_start();
+                sdnotify_send("READY=1");
+            }
+
             FD_ZERO(&rdfs);
-            FD_ZERO(&exfs);
+            FD_ZERO(&wrfs);
             FD_SET(master_socket, &rdfs);
-            FD_SET(interrupt_fd, &exfs);
-            max_sd = interrupt_fd;
+            FD_SET(events_fd(), &rdfs);
+            max_sd = (master_socket > events_fd()) ? master_socket : events_fd();
+            if (hist_socket >= 0) {
+                FD_SET(hist_socket, &rdfs);
+                if (hist_socket > max_sd)
+                    max_sd = hist_socket;
+            }
+            if (met_socket >= 0) {
+                FD_SET(met_socket, &rdfs);
+                if (met_socket > max_sd)
+                    max_sd = met_socket;
+            }
+            if (urgent_socket >= 0) {
+                FD_SET(urgent_socket, &rdfs);
+                if (urgent_socket > max_sd)
+                    max_sd = urgent_socket;
+            }
+            /* Thermocouples are sampled on the timeout, throttled clients, plugin timers and peers wait for it */
+            ms = hist_sample();
+            if (sessions_wait >= 0 && (ms < 0 || sessions_wait < ms))
+                ms = sessions_wait;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            if ((pms = plugin_timeout_ms(&ts)) >= 0 && (ms < 0 || pms < ms))
+                ms = pms;
+            if ((pms = peers_fdset(&rdfs, &wrfs, &max_sd, &ts)) >= 0 && (ms < 0 || pms < ms))
+                ms = pms;
+            if (ms >= 0) {
+                tv.tv_sec = ms / 1000;
+                tv.tv_usec = (ms % 1000) * 1000;
+                tvp = &tv;
+            }
 
             /* add child sockets to set */
             for (size_t i = 0; i < MAX_CLIENTS; i++) {
                 sd = client_socket[i];
 
-                /* if valid socket descriptor then add to read list */
-                if(sd > 0)
+                /* if valid socket descriptor with room for requests, add to read list */
+                if(sd > 0 && session_room(&session[i]))
                     FD_SET(sd , &rdfs);
 
                 /* highest file descriptor number, need it for the select function */
@@ -328,80 +2786,80 @@ main(int argc, char *argv[])
                     max_sd = sd;
             }
 
-            if (select(max_sd + 1, &rdfs, NULL, &exfs, NULL) < 0) {
+            if (select(max_sd + 1, &rdfs, &wrfs, NULL, tvp) < 0) {
+                if (errno == EINTR)
+                    continue;
                 syslog(LOG_CRIT, "select(): %s", strerror(errno));
                 exit_flag = 1;
                 continue;
             }
-            /* INTA */
-            if (FD_ISSET(interrupt_fd, &exfs)) {
-                if (gpio_read(&interrupt, &dummy) < 0) {
-                    syslog(LOG_CRIT, "gpio_read(): %s\n", gpio_errmsg(&interrupt));
-                    exit(EXIT_FAILURE);
-                }
-                /* Getting inputs */
-                /* Possible inrush current */
-                usleep(1000);
-                for (size_t i = 0; i < 2; i++) {
-                    if (i2c_transfer(&i2c, &padata[i], 1) < 0) {
-                        syslog(LOG_ERR, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                /* Check short circuit */
-                /* Short circuit data is the last 4 bits active low */
-                uint8_t scdata = (past >> 4);
-                scdata = (scdata | 0xF0);
-                scdata = ~scdata;
-                if (scdata) {
-                    syslog(LOG_DEBUG, "Short circuit");
-                    /* Short circuit */
-                    /* Getting outputs */
-                    for (size_t i = 0; i < 2; i++) {
-                        if (i2c_transfer(&i2c, &pbdata[i], 1) < 0) {
-                            syslog(LOG_ERR, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                    /* Turn off corresponding output(s) */
-                    outp[1] = (pbst ^ scdata);
-                    if (i2c_transfer(&i2c, output, 1) < 0) {
-                        syslog(LOG_ERR, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                        exit(EXIT_FAILURE);
-                    }
-                    /* Inform clients */
-                    iotool_data.command = SHORT_CIRCUIT;
-                    iotool_data.input_bits = scdata;
-                }
-                else {
-                    syslog(LOG_DEBUG, "Input");
-                    iotool_data.command = INPUT_INFO;
-                    iotool_data.input_bits = past;
-                }
-                /* Send data to clients */
-                for (size_t i = 0; i < MAX_CLIENTS; i++) {
-                    if (client_socket[i] != 0) {
-                        int ret = write(client_socket[i], &iotool_data, sizeof(struct iotool));
-                        if (ret < 0) {
-                            syslog(LOG_ERR, "Failed to send data. write(): %s", strerror(errno));
-                            exit(EXIT_FAILURE);
-                        }
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            /* Emergency commands before anything else, all that is pending */
+            for (size_t i = 0; i < MAX_CLIENTS; i++) {
+                io_t req;
+
+                if (client_lane[i] == LANE_URGENT && client_socket[i] > 0 &&
+                    (FD_ISSET(client_socket[i], &rdfs) || session_peek(&session[i], &req)))
+                    urgent_run(i, &ts);
+            }
+
+            /* INTA, as read by the bus workers */
+            if (FD_ISSET(events_fd(), &rdfs)) {
+                n = events_drain(events, WORKER_EVENTS);
+                if ((lost = events_lost()) > 0) {
+                    syslog(LOG_WARNING, "%lu interrupt event(s) lost", lost);
+                    metrics_add(&met, met_lost, lost);
+                    /* Possibly a sample, ask again rather than wait forever */
+                    if (sampling) {
+                        sampling = 0;
+                        sample_inputs();
                     }
                 }
+                for (size_t i = 0; i < n; i++)
+                    handle_event(&events[i]);
             }
-            /* Unix socket new client */
-            if (FD_ISSET(master_socket, &rdfs)) {
-                syslog(LOG_DEBUG, "New client.");
-                if ((new_socket = accept(master_socket,
+            if (plugin_count()) {
+                plugin_timers(&ts);
+                outputs_commit(LANE_URGENT, NULL);
+            }
+            peers_serve(&rdfs, &wrfs);
+            if (hist_socket >= 0 && FD_ISSET(hist_socket, &rdfs))
+                peer_accept(hist_socket, PEER_HISTORY, &ts);
+            if (met_socket >= 0 && FD_ISSET(met_socket, &rdfs))
+                peer_accept(met_socket, PEER_METRICS, &ts);
+            /* Unix socket new client, on either lane */
+            if (FD_ISSET(master_socket, &rdfs) || (urgent_socket >= 0 && FD_ISSET(urgent_socket, &rdfs))) {
+                int lane = FD_ISSET(master_socket, &rdfs) ? LANE_NORMAL : LANE_URGENT;
+
+                BINLOG0(BL_CLIENT_NEW);
+                if ((new_socket = accept(lane == LANE_URGENT ? urgent_socket : master_socket,
                     (struct sockaddr *)&remote, (socklen_t*)&t)) < 0) {
                     syslog(LOG_CRIT, "accept(): %s", strerror(errno));
                     return -1;
                 }
-                /* Add new socket to array of sockets */
+
+                /* Each lane has its own limit */
+                nclients = 0;
                 for (size_t i = 0; i < MAX_CLIENTS; i++) {
-                    if(client_socket[i] == 0) {
-                        client_socket[i] = new_socket;
-                        break;
+                    if (client_socket[i] != 0 && client_lane[i] == lane)
+                        nclients++;
+                }
+
+                if (nclients >= (lane == LANE_URGENT ? URGENT_CLIENTS : (int)cfg.max_clients)) {
+                    syslog(LOG_WARNING, "Too many clients, rejecting.");
+                    close(new_socket);
+                }
+                else {
+                    /* Add new socket to array of sockets */
+                    for (size_t i = 0; i < MAX_CLIENTS; i++) {
+                        if(client_socket[i] == 0) {
+                            client_socket[i] = new_socket;
+                            client_lane[i] = lane;
+                            session_init(&session[i], cfg.cmd_burst, cfg.query_burst);
+                            session[i].unlimited = lane == LANE_NORMAL && client_is_broker(new_socket);
+                            break;
+                        }
                     }
                 }
             }
@@ -410,127 +2868,179 @@ main(int argc, char *argv[])
                 for (size_t i = 0; i < MAX_CLIENTS; i++) {
                     sd = client_socket[i];
 
-                    if (FD_ISSET(sd, &rdfs)) {
-                        /* Somebody disconnected */
-                        int ret = read(sd, &iotool_data_req, sizeof(struct iotool));
-                        if (ret == 0) {
-                            /* Close the socket and mark as 0 in list for reuse */
-                            syslog(LOG_DEBUG, "Client disconnected.");
-                            close(sd);
-                            client_socket[i] = 0;
-                        }
-                        else if (ret < 0) {
-                            close(sd);
-                            client_socket[i] = 0;
-                            syslog(LOG_ERR, "Failed to read client on socket. read(): %s", strerror(errno));
-                        }
-                        else {
-                            switch (iotool_data_req.command) {
-                                case SET_OUTPUT_BIT :
-                                break;
-                                case SET_ALL_OUTPUT_BIT :
-                                break;
-                                case CLEAR_OUTPUT_BIT :
-                                break;
-                                case CLEAR_ALL_OUTPUT_BIT :
-                                break;
-                                default : break;
-                            }
-                        }
-                    }
+                    if (sd > 0 && client_lane[i] == LANE_NORMAL && FD_ISSET(sd, &rdfs))
+                        client_read(i);
                 }
             }
+
+            /* Fair share of the loop for each client, within its rate */
+            sessions_wait = sessions_run(&ts);
         }
-    }
-    else if (pulse) {
-        if (outc == -1) {
-            fprintf(stderr, "You need to specify an output!\n");
-            exit(1);
-        }
-        /* Getting outputs */
-        for (size_t i = 0; i < 2; i++) {
-            if (i2c_transfer(&i2c, &pbdata[i], 1) < 0) {
-                fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                exit(1);
-            }
+
+        /* What the plugins set on the way out is written too */
+        if (!handed_over) {
+            plugin_stop();
+            outputs_commit(LANE_URGENT, NULL);
         }
+        /* Lets queued output writes finish */
+        workers_stop();
 
-        for (size_t i = 0; i < periodcnt; i++) {
-            outp[1] = (pbst | (uint8_t)outc);
-            if (i2c_transfer(&i2c, output, 1) < 0) {
-                fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                exit(1);
-            }
-            usleep(halfperiod-200);
-            outp[1] = (pbst & ~(uint8_t)outc);
-            if (i2c_transfer(&i2c, output, 1) < 0) {
-                fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                exit(1);
-            }
-            usleep(halfperiod-200);
+        /* The new instance has bound the query sockets already */
+        if (!handed_over) {
+            sdnotify_send("STOPPING=1");
+            hist_stop();
+            if (urgent_socket >= 0)
+                unlink(cfg.urgent_socket);
         }
+        met_stop();
+        binlog_stop();
+
+        persist_close(&persist);
     }
-    else if (seto) {
-        /* Getting outputs */
-        for (size_t i = 0; i < 2; i++) {
-            if (i2c_transfer(&i2c, &pbdata[i], 1) < 0) {
-                fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                exit(1);
-            }
-        }
+    else if (pulse || seto) {
+        output_masks(outc, mask);
 
-        if (level == 1)
-            outp[1] = (pbst | (uint8_t)outc);
-        else
-            outp[1] = (pbst & ~(uint8_t)outc);
+        /* Pulse mode toggles, otherwise set the level once. The latches
+         * were read in with the shadows, no read before each change. */
+        for (size_t i = 0; i < (pulse ? periodcnt * 2 : 1); i++) {
+            int on = pulse ? !(i & 1) : level;
 
-        if (i2c_transfer(&i2c, output, 1) < 0) {
-            fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-            exit(1);
+            for (unsigned int e = 0; e < board.nexpanders; e++) {
+                for (int p = BOARD_PORT_A; p <= BOARD_PORT_B; p++) {
+                    if (!mask[e][p])
+                        continue;
+                    if (mcp23017_update(&mcp[e], MCP23017_OLAT, p, mask[e][p], on ? 0xFF : 0x00) < 0) {
+                        fprintf(stderr, "mcp23017_update(): %s\n", mcp23017_errmsg(&mcp[e]));
+                        exit(1);
+                    }
+                }
+            }
+            if (pulse)
+                usleep(halfperiod-200);
         }
     }
 
     else if (p) {
-        if (gpio_open(&interrupt, PH17, GPIO_DIR_IN) < 0) {
-            fprintf(stderr, "gpio_open(): %s\n", gpio_errmsg(&interrupt));
-            exit(1);
+        /* Every interrupt line, each covers its own expanders */
+        for (unsigned int i = 0; i < board.nirqs; i++) {
+            if (interrupt_setup(&irq[i], board.irq_gpio[i]) < 0) {
+                fprintf(stderr, "interrupt_setup(): %s\n", gpio_errmsg(&irq[i]));
+                exit(1);
+            }
         }
 
-        if (gpio_set_edge(&interrupt, GPIO_EDGE_FALLING) < 0) {
-            fprintf(stderr, "gpio_set_edge(): %s\n", gpio_errmsg(&interrupt));
+        if (capture_open(&cap, cap_fmt, cap_path, board.ninputs) < 0) {
+            fprintf(stderr, "%s: %s\n", cap_path ? cap_path : "stdout", strerror(errno));
             exit(1);
         }
 
         while (!exit_flag) {
-            int ret = gpio_poll(&interrupt, timeout);
+            int ret = 0;
+
+            /* Write out while the inputs are quiet, not between edges */
+            if (capture_pending(&cap) && (ret = irqs_poll(0)) == 0 && capture_flush(&cap) < 0)
+                break;
+
+            if (ret == 0)
+                ret = irqs_poll(timeout);
             if (ret < 0)
                 break;
             else if (ret == 0 && timeout != 0) {
-                printf("Poll timed out\n");
+                fprintf(stderr, "Poll timed out\n");
                 break;
             }
+            clock_gettime(CLOCK_MONOTONIC, &ts);
 
-            for (size_t i = 0; i < 2; i++) {
-                if (i2c_transfer(&i2c, &padata[i], 1) < 0) {
-                    fprintf(stderr, "i2c_transfer(): %s\n", i2c_errmsg(&i2c));
-                    exit(1);
-                }
+            if (snapshot(expanders_with(PINS_INPUT), MCP23017_INTF, 3,
+                         evs, sizeof(evs[0]), &failed) < 0) {
+                fprintf(stderr, "Reading the expanders: %s\n", snapshot_errmsg(failed));
+                exit(1);
             }
-            for (size_t i = 0; i < 4; i++) {
-                printf("DI0%zu -> %d\n", i, (past & inputs[i]) ? 1 : 0);
+            memset(inputs, 0, sizeof(inputs));
+            for (unsigned int n = 0; n < board.ninputs; n++) {
+                const struct board_pin *pin = &board.input[n];
+                if (evs[pin->exp].gpio[pin->port] & pin->mask)
+                    board_bit_set(inputs, n);
             }
-            printf("\n");
+            if (capture_record(&cap, &ts, inputs) < 0)
+                break;
 
             if (timeout == 0)
                 break;
         }
+
+        if (capture_close(&cap) < 0) {
+            fprintf(stderr, "%s: %s\n", cap_path ? cap_path : "stdout", strerror(errno));
+            exit(1);
+        }
+    }
+    else if (la_path) {
+        static analyzer_t la;
+        uint8_t gpio[BOARD_MAX_EXPANDERS][2];
+        struct timespec t1;
+        FILE *vcd;
+
+        if (analyzer_init(&la, &board, la_size) < 0) {
+            fprintf(stderr, "analyzer_init(): %s\n", strerror(errno));
+            exit(1);
+        }
+        if (la_start && analyzer_cond_parse(&board, la_start, &la.start) < 0) {
+            fprintf(stderr, "Bad start condition %s\n", la_start);
+            usage(argv[0]);
+        }
+        if (la_stop && analyzer_cond_parse(&board, la_stop, &la.stop) < 0) {
+            fprintf(stderr, "Bad stop condition %s\n", la_stop);
+            usage(argv[0]);
+        }
+
+        /* Back to back, one planned burst per bus, until ^C or the stop condition */
+        while (!exit_flag) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            if (snapshot((1u << board.nexpanders) - 1, MCP23017_GPIO, 1,
+                         gpio, sizeof(gpio[0]), &failed) < 0) {
+                fprintf(stderr, "Reading the expanders: %s\n", snapshot_errmsg(failed));
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+
+            /* Sampled somewhere in the transfer, call it the middle */
+            ts.tv_nsec += ((t1.tv_sec - ts.tv_sec) * 1000000000L + t1.tv_nsec - ts.tv_nsec) / 2;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+
+            if (analyzer_sample(&la, &ts, gpio))
+                break;
+        }
+
+        if (!la.started) {
+            fprintf(stderr, "Start condition never met, nothing written\n");
+            exit(1);
+        }
+
+        if ((vcd = fopen(la_path, "w")) == NULL) {
+            fprintf(stderr, "%s: %s\n", la_path, strerror(errno));
+            exit(1);
+        }
+        setvbuf(vcd, NULL, _IOFBF, CAPTURE_BUF);
+        if (analyzer_write_vcd(&la, vcd) < 0 || fclose(vcd) == EOF) {
+            fprintf(stderr, "%s: %s\n", la_path, strerror(errno));
+            exit(1);
+        }
+
+        fprintf(stderr, "%lu samples in %.3f s, %lu changes in %zu bytes, %lu dropped\n",
+                la.samples, la.end_us / 1e6, la.records, la.used, la.dropped);
+        analyzer_free(&la);
     }
     else {
         usage(argv[0]);
     }
 
-    i2c_close(&i2c);
-    gpio_close(&interrupt);
+    for (unsigned int i = 0; i < board.nbuses; i++)
+        i2c_close(&bus[i]);
+    for (unsigned int i = 0; i < board.nirqs; i++)
+        gpio_close(&irq[i]);
 
     return 0;
 }
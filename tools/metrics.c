@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "metrics.h"
+
+static const char *const type_name[] = { "gauge", "counter", "histogram" };
+
+static void
+append(metrics_t *m, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (m->failed)
+        return;
+
+    va_start(ap, fmt);
+    len = vsnprintf(m->text + m->len, m->cap - m->len, fmt, ap);
+    va_end(ap);
+
+    if (m->len + len >= m->cap) {
+        size_t cap = m->cap ? m->cap : 4096;
+        char *text;
+
+        while (m->len + len >= cap)
+            cap *= 2;
+        if ((text = realloc(m->text, cap)) == NULL) {
+            m->failed = 1;
+            return;
+        }
+        m->text = text;
+        m->cap = cap;
+
+        va_start(ap, fmt);
+        vsnprintf(m->text + m->len, m->cap - m->len, fmt, ap);
+        va_end(ap);
+    }
+
+    m->len += len;
+}
+
+static void
+render(metrics_t *m, unsigned int id)
+{
+    char buf[METRICS_WIDTH + 8];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "%*.10g", METRICS_WIDTH, m->slot[id].v);
+    memcpy(m->text + m->slot[id].off, buf + len - METRICS_WIDTH, METRICS_WIDTH);
+}
+
+/* A sample line, name with suffix and labels, and its value slot */
+static int
+line(metrics_t *m, const char *suffix, const char *labels, const char *le)
+{
+    struct metrics_slot *slot;
+
+    if (m->n == m->nalloc) {
+        unsigned int n = m->nalloc ? m->nalloc * 2 : 64;
+
+        if ((slot = realloc(m->slot, n * sizeof(*slot))) == NULL) {
+            m->failed = 1;
+            return -1;
+        }
+        m->slot = slot;
+        m->nalloc = n;
+    }
+
+    append(m, "%s%s", m->family, suffix);
+    if (labels && le)
+        append(m, "{%s,le=\"%s\"}", labels, le);
+    else if (labels || le)
+        append(m, le ? "{le=\"%s\"}" : "{%s}", le ? le : labels);
+    append(m, " %*s\n", METRICS_WIDTH, "");
+    if (m->failed)
+        return -1;
+
+    m->slot[m->n].off = m->len - 1 - METRICS_WIDTH;
+    m->slot[m->n].v = 0;
+    render(m, m->n);
+
+    return m->n++;
+}
+
+void
+metrics_init(metrics_t *m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+void
+metrics_free(metrics_t *m)
+{
+    free(m->text);
+    free(m->slot);
+    free(m->hist);
+    memset(m, 0, sizeof(*m));
+}
+
+void
+metrics_family(metrics_t *m, const char *name, enum metrics_type type, const char *help)
+{
+    snprintf(m->family, sizeof(m->family), "%s", name);
+    append(m, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type_name[type]);
+}
+
+int
+metrics_sample(metrics_t *m, const char *labels)
+{
+    return line(m, "", labels, NULL);
+}
+
+int
+metrics_histogram(metrics_t *m, const char *labels, const double *bounds, unsigned int nbounds)
+{
+    struct metrics_histogram *h;
+    char le[32];
+
+    if (nbounds > METRICS_BOUNDS_MAX || m->failed)
+        return -1;
+    if ((h = realloc(m->hist, (m->nhist + 1) * sizeof(*h))) == NULL) {
+        m->failed = 1;
+        return -1;
+    }
+    m->hist = h;
+    h = &m->hist[m->nhist];
+
+    h->nbounds = nbounds;
+    memcpy(h->bounds, bounds, nbounds * sizeof(bounds[0]));
+    for (unsigned int i = 0; i < nbounds; i++) {
+        snprintf(le, sizeof(le), "%g", bounds[i]);
+        if (i == 0)
+            h->slot = line(m, "_bucket", labels, le);
+        else
+            line(m, "_bucket", labels, le);
+    }
+    if (nbounds == 0)
+        h->slot = line(m, "_bucket", labels, "+Inf");
+    else
+        line(m, "_bucket", labels, "+Inf");
+    line(m, "_sum", labels, NULL);
+    line(m, "_count", labels, NULL);
+    if (m->failed)
+        return -1;
+
+    return m->nhist++;
+}
+
+int
+metrics_done(metrics_t *m)
+{
+    return m->failed ? -1 : 0;
+}
+
+void
+metrics_set(metrics_t *m, int id, double v)
+{
+    if (id < 0 || (unsigned int)id >= m->n || m->slot[id].v == v)
+        return;
+    m->slot[id].v = v;
+    render(m, id);
+}
+
+void
+metrics_add(metrics_t *m, int id, double v)
+{
+    if (id < 0 || (unsigned int)id >= m->n)
+        return;
+    metrics_set(m, id, m->slot[id].v + v);
+}
+
+/* Buckets are cumulative: every one from the first bound v fits under */
+void
+metrics_observe(metrics_t *m, int hist, double v)
+{
+    const struct metrics_histogram *h;
+    unsigned int i;
+
+    if (hist < 0 || (unsigned int)hist >= m->nhist)
+        return;
+    h = &m->hist[hist];
+
+    for (i = 0; i < h->nbounds && v > h->bounds[i]; i++)
+        ;
+    for (; i <= h->nbounds; i++)
+        metrics_add(m, h->slot + i, 1);
+    metrics_add(m, h->slot + h->nbounds + 1, v);
+    metrics_add(m, h->slot + h->nbounds + 2, 1);
+}
+
+void
+metrics_histogram_load(metrics_t *m, int hist, const unsigned long *counts, double sum)
+{
+    const struct metrics_histogram *h;
+    unsigned long total = 0;
+
+    if (hist < 0 || (unsigned int)hist >= m->nhist)
+        return;
+    h = &m->hist[hist];
+
+    for (unsigned int i = 0; i <= h->nbounds; i++) {
+        total += counts[i];
+        metrics_set(m, h->slot + i, total);
+    }
+    metrics_set(m, h->slot + h->nbounds + 1, sum);
+    metrics_set(m, h->slot + h->nbounds + 2, total);
+}
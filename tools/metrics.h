@@ -0,0 +1,68 @@
+#ifndef _IOTOOL_METRICS_H
+#define _IOTOOL_METRICS_H
+
+#include <stddef.h>
+
+/*
+ * Metrics in the Prometheus text format, kept rendered.
+ *
+ * Families and samples are laid out once, each sample value in a fixed
+ * width slot padded with blanks on the left. Updating a value rewrites
+ * its slot in place, so the text is always ready and a scrape is a copy
+ * of it. Not thread safe, the daemon loop owns it.
+ */
+
+#define METRICS_WIDTH       20      /* value slot, blanks then the value */
+#define METRICS_BOUNDS_MAX  16      /* histogram buckets, +Inf aside */
+
+enum metrics_type {
+    METRICS_GAUGE,
+    METRICS_COUNTER,
+    METRICS_HISTOGRAM,
+};
+
+struct metrics_histogram {
+    unsigned int slot;              /* first bucket, then _sum and _count */
+    unsigned int nbounds;
+    double bounds[METRICS_BOUNDS_MAX];
+};
+
+typedef struct metrics {
+    char *text;
+    size_t len, cap;
+
+    /* Where each value is in text, and the value */
+    struct metrics_slot {
+        size_t off;
+        double v;
+    } *slot;
+    unsigned int n, nalloc;
+
+    struct metrics_histogram *hist;
+    unsigned int nhist;
+
+    char family[64];
+    int failed;                     /* out of memory while laying out */
+} metrics_t;
+
+void metrics_init(metrics_t *m);
+void metrics_free(metrics_t *m);
+/* Start a family, its samples follow */
+void metrics_family(metrics_t *m, const char *name, enum metrics_type type, const char *help);
+/*
+ * A sample of the current family, e.g. labels "channel=\"DI00\"", or NULL.
+ * Samples of a family get consecutive ids. Its id, or -1
+ */
+int metrics_sample(metrics_t *m, const char *labels);
+/* Histogram of the current family over the upper bounds, ascending. Its id, or -1 */
+int metrics_histogram(metrics_t *m, const char *labels, const double *bounds, unsigned int nbounds);
+/* 0 once everything was laid out, -1 if memory ran out on the way */
+int metrics_done(metrics_t *m);
+
+void metrics_set(metrics_t *m, int id, double v);
+void metrics_add(metrics_t *m, int id, double v);
+void metrics_observe(metrics_t *m, int hist, double v);
+/* Whole histogram from counts kept elsewhere, per bucket (not cumulative), +Inf last */
+void metrics_histogram_load(metrics_t *m, int hist, const unsigned long *counts, double sum);
+
+#endif
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "persist.h"
+#include "crc32.h"
+
+static uint32_t
+slot_crc(const struct persist_slot *s)
+{
+    return crc32_update(0, s, offsetof(struct persist_slot, crc));
+}
+
+static int
+slot_valid(const struct persist_slot *s)
+{
+    return s->seq != 0 && s->crc == slot_crc(s);
+}
+
+static void *
+sync_loop(void *arg)
+{
+    persist_t *p = arg;
+    int stop;
+
+    do {
+        pthread_mutex_lock(&p->lock);
+        while (!p->dirty && !p->stopping)
+            pthread_cond_wait(&p->wake, &p->lock);
+        stop = p->stopping;
+        p->dirty = 0;
+        pthread_mutex_unlock(&p->lock);
+
+        /* Survive power loss, not just a crash */
+        if (msync(p->map, sizeof(struct persist_file), MS_SYNC) < 0)
+            syslog(LOG_ERR, "persist: msync(): %s", strerror(errno));
+    } while (!stop);
+
+    return NULL;
+}
+
+int
+persist_open(persist_t *p, const char *path)
+{
+    struct stat st;
+
+    memset(p, 0, sizeof(*p));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+
+    if ((p->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+        return -1;
+
+    if (fstat(p->fd, &st) < 0)
+        goto fail;
+
+    if ((size_t)st.st_size < sizeof(struct persist_file) &&
+        ftruncate(p->fd, sizeof(struct persist_file)) < 0)
+        goto fail;
+
+    p->map = mmap(NULL, sizeof(struct persist_file), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, p->fd, 0);
+    if (p->map == MAP_FAILED)
+        goto fail;
+
+    /* New or foreign file: start over */
+    if (p->map->magic != PERSIST_MAGIC || p->map->version != PERSIST_VERSION) {
+        memset(p->map, 0, sizeof(struct persist_file));
+        p->map->magic = PERSIST_MAGIC;
+        p->map->version = PERSIST_VERSION;
+    }
+
+    return 0;
+
+fail:
+    {
+        int errsv = errno;
+        close(p->fd);
+        p->fd = -1;
+        p->map = NULL;
+        errno = errsv;
+    }
+    return -1;
+}
+
+int
+persist_load(persist_t *p, struct persist_state *st)
+{
+    int cur = -1;
+
+    for (int i = 0; i < 2; i++) {
+        if (!slot_valid(&p->map->slot[i]))
+            continue;
+        if (cur < 0 || p->map->slot[i].seq > p->map->slot[cur].seq)
+            cur = i;
+    }
+
+    if (cur < 0) {
+        p->seq = 0;
+        p->next = 0;
+        return 0;
+    }
+
+    *st = p->map->slot[cur].state;
+    p->seq = p->map->slot[cur].seq;
+    p->next = !cur;
+
+    return 1;
+}
+
+int
+persist_store(persist_t *p, const struct persist_state *st)
+{
+    struct persist_slot *s;
+
+    if (p->map == NULL)
+        return 0;
+
+    /* Overwrite the older slot only, the newer one stays intact */
+    s = &p->map->slot[p->next];
+    s->seq = 0;
+    s->state = *st;
+    s->crc = 0;
+    s->seq = ++p->seq;
+    s->crc = slot_crc(s);
+    p->next = !p->next;
+
+    /* Not before, a fork (daemon()) would leave the thread behind */
+    if (!p->running) {
+        if (pthread_create(&p->syncer, NULL, sync_loop, p) != 0)
+            return msync(p->map, sizeof(struct persist_file), MS_SYNC);
+        p->running = 1;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->dirty = 1;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+
+    return 0;
+}
+
+void
+persist_close(persist_t *p)
+{
+    if (p->running) {
+        pthread_mutex_lock(&p->lock);
+        p->stopping = 1;
+        pthread_cond_signal(&p->wake);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->syncer, NULL);
+        p->running = 0;
+    }
+
+    if (p->map != NULL)
+        munmap(p->map, sizeof(struct persist_file));
+    if (p->fd >= 0)
+        close(p->fd);
+    p->map = NULL;
+    p->fd = -1;
+}
@@ -0,0 +1,57 @@
+#ifndef _IOTOOL_PERSIST_H
+#define _IOTOOL_PERSIST_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Commanded output state kept in a small memory-mapped file, so a
+ * restarted daemon knows what the outputs should be. The file holds two
+ * checksummed slots written alternately; a torn write only ever destroys
+ * the older copy.
+ *
+ * A store is in the shared mapping, and so survives a crash of the
+ * daemon, as soon as persist_store() returns. Getting it to flash for a
+ * power loss is left to a thread started by the first store, so output
+ * writes never wait for the msync.
+ */
+
+#define PERSIST_MAGIC   0x696f7374      /* "iost" */
+#define PERSIST_VERSION 2
+
+struct persist_state {
+    uint8_t output_bits[16];    /* commanded outputs, bit n is channel n */
+};
+
+struct persist_slot {
+    uint32_t seq;               /* higher is newer */
+    struct persist_state state;
+    uint32_t crc;               /* over seq and state */
+};
+
+struct persist_file {
+    uint32_t magic;
+    uint32_t version;
+    struct persist_slot slot[2];
+};
+
+typedef struct persist {
+    int fd;
+    struct persist_file *map;
+    uint32_t seq;
+    int next;                   /* slot the next store goes to */
+    /* Background msync */
+    pthread_t syncer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running, dirty, stopping;
+} persist_t;
+
+int persist_open(persist_t *p, const char *path);
+/* 1 and the newest valid state, 0 if there is none */
+int persist_load(persist_t *p, struct persist_state *st);
+int persist_store(persist_t *p, const struct persist_state *st);
+/* Waits for the last store to reach the file */
+void persist_close(persist_t *p);
+
+#endif
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "plugin.h"
+
+static struct loaded {
+    void *dl;
+    const struct plugin *p;
+    void *ctx;
+    char path[256];
+    /* Timers, bit id of active */
+    unsigned int active;
+    struct timespec due[PLUGIN_TIMERS];
+    /* Accounting */
+    unsigned long calls, overruns;
+    unsigned long long ns, worst_ns;
+    unsigned int strikes;
+    int disabled;
+} plugins[PLUGIN_MAX];
+static unsigned int nplugins;
+
+static struct plugin_host host;
+static unsigned long long budget_ns;
+static unsigned int hang_ms;
+
+/* Plugin whose callback runs, -1 outside of them */
+static int current = -1;
+static struct timespec begin;
+
+/* Watchdog: when the running callback began, 0 when none runs */
+static unsigned long long busy_since;
+static pthread_t watchdog;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static int watching, stopping;
+
+static unsigned long long
+ns(const struct timespec *ts)
+{
+    return (unsigned long long)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void *
+watch_loop(void *arg)
+{
+    unsigned int period = hang_ms / 4 ? hang_ms / 4 : 1;
+    struct timespec at, now;
+    unsigned long long since;
+    int stop;
+
+    do {
+        clock_gettime(CLOCK_REALTIME, &at);
+        at.tv_sec += period / 1000;
+        at.tv_nsec += (period % 1000) * 1000000L;
+        if (at.tv_nsec >= 1000000000L) {
+            at.tv_sec++;
+            at.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&lock);
+        while (!stopping && pthread_cond_timedwait(&wake, &lock, &at) == 0)
+            ;
+        stop = stopping;
+        pthread_mutex_unlock(&lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        since = __atomic_load_n(&busy_since, __ATOMIC_ACQUIRE);
+        if (since && ns(&now) - since > (unsigned long long)hang_ms * 1000000) {
+            int i = __atomic_load_n(&current, __ATOMIC_RELAXED);
+
+            syslog(LOG_CRIT, "Plugin %s stuck in a callback for over %u ms, aborting",
+                   i >= 0 ? plugins[i].p->name : "?", hang_ms);
+            abort();
+        }
+    } while (!stop);
+
+    return NULL;
+}
+
+static void
+call_begin(unsigned int i)
+{
+    __atomic_store_n(&current, (int)i, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    __atomic_store_n(&busy_since, ns(&begin), __ATOMIC_RELEASE);
+}
+
+/*
+ * The callback that began last returned. Unless it is init or fini, which
+ * have no budget, account it and disable the plugin on its last strike.
+ */
+static void
+call_end(int budgeted)
+{
+    struct loaded *l = &plugins[current];
+    struct timespec end;
+    unsigned long long d;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    __atomic_store_n(&busy_since, 0, __ATOMIC_RELEASE);
+    d = ns(&end) - ns(&begin);
+
+    if (!budgeted) {
+        __atomic_store_n(&current, -1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    l->calls++;
+    l->ns += d;
+    if (d > l->worst_ns)
+        l->worst_ns = d;
+
+    if (d <= budget_ns) {
+        l->strikes = 0;
+    }
+    else if (l->overruns++, ++l->strikes >= PLUGIN_STRIKES) {
+        l->disabled = 1;
+        l->active = 0;
+        syslog(LOG_ERR, "Plugin %s: over its %llu us budget %u times in a row, disabled",
+               l->p->name, budget_ns / 1000, l->strikes);
+    }
+    else {
+        syslog(LOG_WARNING, "Plugin %s: callback took %.3f ms, budget %.3f ms",
+               l->p->name, d / 1e6, budget_ns / 1e6);
+    }
+
+    __atomic_store_n(&current, -1, __ATOMIC_RELAXED);
+}
+
+static int
+timer_start(unsigned int id, unsigned int ms)
+{
+    struct loaded *l;
+    struct timespec *t;
+
+    if (current < 0 || id >= PLUGIN_TIMERS)
+        return -1;
+    l = &plugins[current];
+    t = &l->due[id];
+
+    clock_gettime(CLOCK_MONOTONIC, t);
+    t->tv_sec += ms / 1000;
+    t->tv_nsec += (ms % 1000) * 1000000L;
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+    l->active |= 1u << id;
+
+    return 0;
+}
+
+static void
+timer_stop(unsigned int id)
+{
+    if (current >= 0 && id < PLUGIN_TIMERS)
+        plugins[current].active &= ~(1u << id);
+}
+
+static void
+plugin_log(int level, const char *fmt, ...)
+{
+    char msg[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    syslog(level, "Plugin %s: %s", current >= 0 ? plugins[current].p->name : "?", msg);
+}
+
+int
+plugin_start(const struct plugin_host *h, char paths[][256], unsigned int npaths,
+             unsigned int budget_us, unsigned int hang)
+{
+    int err;
+
+    host = *h;
+    host.timer_start = timer_start;
+    host.timer_stop = timer_stop;
+    host.log = plugin_log;
+    budget_ns = (unsigned long long)budget_us * 1000;
+    hang_ms = hang;
+    nplugins = 0;
+
+    for (unsigned int k = 0; k < npaths && nplugins < PLUGIN_MAX; k++) {
+        struct loaded *l = &plugins[nplugins];
+        int ret = 0;
+
+        if (paths[k][0] == '\0')
+            continue;
+
+        memset(l, 0, sizeof(*l));
+        snprintf(l->path, sizeof(l->path), "%s", paths[k]);
+        if ((l->dl = dlopen(l->path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+            syslog(LOG_ERR, "Plugin %s: %s", l->path, dlerror());
+            continue;
+        }
+        if ((l->p = dlsym(l->dl, PLUGIN_SYMBOL)) == NULL || l->p->abi != PLUGIN_ABI || l->p->name == NULL) {
+            syslog(LOG_ERR, "Plugin %s: no %s of ABI %d", l->path, PLUGIN_SYMBOL, PLUGIN_ABI);
+            dlclose(l->dl);
+            continue;
+        }
+
+        if (l->p->init) {
+            call_begin(nplugins);
+            ret = l->p->init(&host, &l->ctx);
+            call_end(0);
+        }
+        if (ret != 0) {
+            syslog(LOG_ERR, "Plugin %s: init failed", l->p->name);
+            dlclose(l->dl);
+            continue;
+        }
+
+        syslog(LOG_INFO, "Plugin %s loaded from %s", l->p->name, l->path);
+        nplugins++;
+    }
+
+    if (nplugins == 0)
+        return 0;
+
+    stopping = 0;
+    if ((err = pthread_create(&watchdog, NULL, watch_loop, NULL)) != 0)
+        syslog(LOG_ERR, "Plugin watchdog: pthread_create(): %s", strerror(err));
+    else
+        watching = 1;
+
+    return nplugins;
+}
+
+void
+plugin_stop(void)
+{
+    for (unsigned int i = 0; i < nplugins; i++) {
+        struct loaded *l = &plugins[i];
+
+        if (l->p->fini) {
+            call_begin(i);
+            l->p->fini(l->ctx);
+            call_end(0);
+        }
+        dlclose(l->dl);
+    }
+    nplugins = 0;
+
+    if (!watching)
+        return;
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(watchdog, NULL);
+    watching = 0;
+}
+
+unsigned int
+plugin_count(void)
+{
+    return nplugins;
+}
+
+void
+plugin_event(const struct plugin_event *ev)
+{
+    for (unsigned int i = 0; i < nplugins; i++) {
+        struct loaded *l = &plugins[i];
+
+        if (l->disabled || !l->p->event)
+            continue;
+        call_begin(i);
+        l->p->event(l->ctx, ev);
+        call_end(1);
+    }
+}
+
+void
+plugin_timers(const struct timespec *now)
+{
+    for (unsigned int i = 0; i < nplugins; i++) {
+        struct loaded *l = &plugins[i];
+
+        for (unsigned int m = l->active; m && !l->disabled; m &= m - 1) {
+            unsigned int id = __builtin_ctz(m);
+
+            /* Stopped or moved on by a callback of this pass */
+            if (!(l->active & (1u << id)) || ns(&l->due[id]) > ns(now))
+                continue;
+            /* One shot, the callback may start it again */
+            l->active &= ~(1u << id);
+            if (!l->p->timer)
+                continue;
+            call_begin(i);
+            l->p->timer(l->ctx, id);
+            call_end(1);
+        }
+    }
+}
+
+int
+plugin_timeout_ms(const struct timespec *now)
+{
+    unsigned long long next = 0;
+
+    for (unsigned int i = 0; i < nplugins; i++) {
+        for (unsigned int m = plugins[i].active; m; m &= m - 1) {
+            unsigned long long due = ns(&plugins[i].due[__builtin_ctz(m)]);
+
+            if (next == 0 || due < next)
+                next = due;
+        }
+    }
+
+    if (next == 0)
+        return -1;
+    if (next <= ns(now))
+        return 0;
+
+    /* Rounded up, waking early would only spin */
+    return (next - ns(now) + 999999) / 1000000;
+}
+
+int
+plugin_stats(unsigned int i, struct plugin_stats *st)
+{
+    const struct loaded *l;
+
+    if (i >= nplugins)
+        return -1;
+    l = &plugins[i];
+
+    st->name = l->p->name;
+    st->calls = l->calls;
+    st->overruns = l->overruns;
+    st->ns = l->ns;
+    st->worst_ns = l->worst_ns;
+    st->disabled = l->disabled;
+
+    return 0;
+}
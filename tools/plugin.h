@@ -0,0 +1,97 @@
+#ifndef _IOTOOL_PLUGIN_H
+#define _IOTOOL_PLUGIN_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "board.h"
+
+/*
+ * In-process plugins: shared objects loaded with dlopen() for control
+ * logic that must answer an input change faster than a client could.
+ *
+ * A plugin exports a struct plugin named "iotool_plugin". Its callbacks
+ * run on the daemon loop, right as it takes in the events read by the bus
+ * workers, and must return within plugin_budget_us. Output changes are
+ * coalesced with those of the clients and written once the callback
+ * returns, on the urgent lane. Timers are one shot, in milliseconds, and
+ * fire from the same loop.
+ *
+ * Every callback is timed. One over the budget is an overrun; a plugin
+ * with PLUGIN_STRIKES overruns in a row is disabled; init and fini have
+ * no budget. A callback that does not return at all is caught by a
+ * watchdog thread, which aborts the daemon after plugin_hang_ms: it
+ * cannot be stopped otherwise, and the service manager restarts the
+ * daemon with the outputs it saved.
+ */
+
+#define PLUGIN_ABI          1
+#define PLUGIN_SYMBOL       "iotool_plugin"
+#define PLUGIN_MAX          4       /* plugins loaded at once */
+#define PLUGIN_TIMERS       8       /* timers of each plugin */
+#define PLUGIN_STRIKES      3       /* overruns in a row before disabling */
+
+/* What the plugin is told of an event */
+struct plugin_event {
+    struct timespec ts;         /* CLOCK_MONOTONIC when the edge was seen */
+    int sampled;                /* from a sample read, not an interrupt */
+    board_bits_t inputs;        /* input levels, bit n is channel n */
+    board_bits_t changed;       /* inputs that changed with this event */
+    board_bits_t tripped;       /* outputs just cut off on a short circuit */
+};
+
+/* The daemon, to the plugin. Only valid within the callbacks */
+struct plugin_host {
+    unsigned int ninputs, noutputs;
+    int (*input)(unsigned int n);
+    /* Commanded level */
+    int (*output)(unsigned int n);
+    void (*set_output)(unsigned int n, int on);
+    /* Call timer(id) once in ms, again if already started. -1 on a bad id */
+    int (*timer_start)(unsigned int id, unsigned int ms);
+    void (*timer_stop)(unsigned int id);
+    void (*log)(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+/* The plugin, to the daemon. Any callback may be NULL */
+struct plugin {
+    unsigned int abi;           /* PLUGIN_ABI */
+    const char *name;
+    /* 0 to run, the host stays valid until fini */
+    int (*init)(const struct plugin_host *host, void **ctx);
+    void (*fini)(void *ctx);
+    void (*event)(void *ctx, const struct plugin_event *ev);
+    void (*timer)(void *ctx, unsigned int id);
+};
+
+/* Time spent in the callbacks of a plugin */
+struct plugin_stats {
+    const char *name;
+    unsigned long calls;
+    unsigned long overruns;
+    unsigned long long ns;      /* total */
+    unsigned long long worst_ns;
+    int disabled;
+};
+
+/*
+ * Load the plugins at the non-empty paths, with the daemon side of the
+ * host (input, output and set_output) filled in. A plugin that fails to
+ * load is skipped. Starts the watchdog when any is loaded. How many
+ * loaded
+ */
+int plugin_start(const struct plugin_host *host, char paths[][256], unsigned int npaths,
+                 unsigned int budget_us, unsigned int hang_ms);
+/* fini and unload every plugin, stop the watchdog */
+void plugin_stop(void);
+unsigned int plugin_count(void);
+
+void plugin_event(const struct plugin_event *ev);
+/* Fire the timers due by now */
+void plugin_timers(const struct timespec *now);
+/* ms until the next timer, or -1 */
+int plugin_timeout_ms(const struct timespec *now);
+
+int plugin_stats(unsigned int i, struct plugin_stats *st);
+
+#endif
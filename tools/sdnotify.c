@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "sdnotify.h"
+
+int
+sdnotify_listen_fds(void)
+{
+    const char *e;
+    char *end;
+    long pid, n;
+
+    if ((e = getenv("LISTEN_PID")) == NULL)
+        return 0;
+
+    errno = 0;
+    pid = strtol(e, &end, 10);
+    if (errno || *end != '\0' || pid <= 0)
+        return -EINVAL;
+    /* Not meant for us, e.g. inherited through a fork */
+    if ((pid_t)pid != getpid())
+        return 0;
+
+    if ((e = getenv("LISTEN_FDS")) == NULL)
+        return 0;
+
+    errno = 0;
+    n = strtol(e, &end, 10);
+    if (errno || *end != '\0' || n < 0)
+        return -EINVAL;
+
+    /* Do not leak the sockets into anything we exec */
+    for (int fd = SDNOTIFY_LISTEN_FDS_START; fd < SDNOTIFY_LISTEN_FDS_START + n; fd++) {
+        int flags = fcntl(fd, F_GETFD);
+        if (flags < 0 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0)
+            return -errno;
+    }
+
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    return (int)n;
+}
+
+int
+sdnotify_is_unix_listener(int fd)
+{
+    struct sockaddr_un sa;
+    socklen_t l = sizeof(sa);
+    int val;
+    socklen_t vl = sizeof(val);
+
+    if (getsockname(fd, (struct sockaddr *)&sa, &l) < 0 || sa.sun_family != AF_UNIX)
+        return 0;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &val, &vl) < 0 || val != SOCK_STREAM)
+        return 0;
+
+    vl = sizeof(val);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &val, &vl) < 0 || !val)
+        return 0;
+
+    return 1;
+}
+
+int
+sdnotify_send(const char *state)
+{
+    struct sockaddr_un sa;
+    const char *path;
+    size_t plen;
+    socklen_t len;
+    int fd, ret;
+
+    if ((path = getenv("NOTIFY_SOCKET")) == NULL)
+        return 0;
+
+    plen = strlen(path);
+    if ((path[0] != '/' && path[0] != '@') || plen < 2 || plen >= sizeof(sa.sun_path))
+        return -EINVAL;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    memcpy(sa.sun_path, path, plen);
+    /* Leading '@' means abstract namespace */
+    if (sa.sun_path[0] == '@')
+        sa.sun_path[0] = '\0';
+    len = offsetof(struct sockaddr_un, sun_path) + plen;
+
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+        return -errno;
+
+    ret = sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&sa, len);
+    if (ret < 0)
+        ret = -errno;
+    else
+        ret = 1;
+
+    close(fd);
+
+    return ret;
+}
+
+int
+sdnotify_sendf(const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    return sdnotify_send(buf);
+}
@@ -0,0 +1,21 @@
+#ifndef _IOTOOL_SDNOTIFY_H
+#define _IOTOOL_SDNOTIFY_H
+
+/*
+ * Minimal implementation of the systemd socket activation and readiness
+ * notification protocols (see sd_listen_fds(3) and sd_notify(3)), so the
+ * daemon does not have to link against libsystemd.
+ */
+
+/* First file descriptor passed by the service manager */
+#define SDNOTIFY_LISTEN_FDS_START 3
+
+/* Number of inherited sockets, 0 if not socket activated, <0 on error */
+int sdnotify_listen_fds(void);
+/* Nonzero if fd is a listening AF_UNIX stream socket */
+int sdnotify_is_unix_listener(int fd);
+/* Send a state string like "READY=1". 0 if not supervised, 1 if sent, <0 on error */
+int sdnotify_send(const char *state);
+int sdnotify_sendf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "session.h"
+
+void
+session_init(struct session *s, unsigned int cmd_burst, unsigned int query_burst)
+{
+    memset(s, 0, sizeof(*s));
+    clock_gettime(CLOCK_MONOTONIC, &s->cmd.at);
+    s->query.at = s->cmd.at;
+    s->cmd.tokens = cmd_burst;
+    s->query.tokens = query_burst;
+}
+
+int
+session_fill(struct session *s, int fd)
+{
+    ssize_t ret;
+
+    if (s->eof || s->len == sizeof(s->buf))
+        return 0;
+
+    ret = recv(fd, s->buf + s->len, sizeof(s->buf) - s->len, MSG_DONTWAIT);
+    if (ret < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    if (ret == 0)
+        s->eof = 1;
+    s->len += ret;
+
+    return 0;
+}
+
+int
+session_room(const struct session *s)
+{
+    return !s->eof && s->len < sizeof(s->buf);
+}
+
+int
+session_peek(const struct session *s, io_t *req)
+{
+    if (s->len < sizeof(*req))
+        return 0;
+    memcpy(req, s->buf, sizeof(*req));
+
+    return 1;
+}
+
+void
+session_pop(struct session *s)
+{
+    s->len -= sizeof(io_t);
+    memmove(s->buf, s->buf + sizeof(io_t), s->len);
+    s->throttled = 0;
+}
+
+int
+session_cost(const io_t *req)
+{
+    return IO_CMD(req->command) == QUERY_STATE ? SESSION_COST_QUERY : SESSION_COST_COMMAND;
+}
+
+int
+bucket_take(struct bucket *b, unsigned int rate, unsigned int burst, const struct timespec *now, int *wait_ms)
+{
+    double dt;
+
+    if (rate == 0)
+        return 1;
+
+    dt = (now->tv_sec - b->at.tv_sec) + (now->tv_nsec - b->at.tv_nsec) / 1e9;
+    b->at = *now;
+    if (dt > 0)
+        b->tokens += dt * rate;
+    if (b->tokens > burst)
+        b->tokens = burst;
+
+    if (b->tokens >= 1) {
+        b->tokens -= 1;
+        return 1;
+    }
+
+    *wait_ms = (int)((1 - b->tokens) * 1000 / rate) + 1;
+    return 0;
+}
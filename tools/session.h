@@ -0,0 +1,64 @@
+#ifndef _IOTOOL_SESSION_H
+#define _IOTOOL_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "iotool.h"
+
+/*
+ * Client sessions of the daemon: requests read ahead from the socket,
+ * token buckets limiting the commands and queries of each, and the
+ * deficit a session has left in the round robin.
+ *
+ * Every round a session with requests gets SESSION_QUANTUM credit and
+ * runs requests while it has credit for the next one, a command costing
+ * more than a query (it means bus writes). A session that sends a lot
+ * thus gets no more than its share of a round, and one whose bucket is
+ * empty waits for tokens; its requests stay in the socket meanwhile,
+ * so the client is slowed down rather than losing any.
+ */
+
+#define SESSION_BUF             16      /* requests read ahead */
+#define SESSION_QUANTUM         4
+#define SESSION_COST_QUERY      1
+#define SESSION_COST_COMMAND    2
+
+struct bucket {
+    double tokens;
+    struct timespec at;         /* last refill */
+};
+
+struct session {
+    uint8_t buf[SESSION_BUF * sizeof(io_t)];
+    size_t len;
+    int eof;                    /* closed by the client, buf still to run */
+    int deficit;
+    struct bucket cmd, query;
+    int throttled;              /* head request already counted */
+    int unlimited;              /* no rate limit, the command line broker */
+};
+
+/* A new session, both buckets full */
+void session_init(struct session *s, unsigned int cmd_burst, unsigned int query_burst);
+/*
+ * Read what fits from fd without blocking. 0, or -1 with errno on a
+ * read error; a closed connection sets eof
+ */
+int session_fill(struct session *s, int fd);
+/* Room for more, worth polling the socket for */
+int session_room(const struct session *s);
+/* Next whole request, 0 if there is none */
+int session_peek(const struct session *s, io_t *req);
+void session_pop(struct session *s);
+int session_cost(const io_t *req);
+
+/*
+ * Take a token from b, refilled at rate per second up to burst since the
+ * last call. rate 0 is no limit. 1 if there was one, otherwise 0 and the
+ * ms until there is in *wait_ms
+ */
+int bucket_take(struct bucket *b, unsigned int rate, unsigned int burst, const struct timespec *now, int *wait_ms);
+
+#endif
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+
+#include "worker.h"
+
+static struct {
+    pthread_mutex_t lock;
+    int fd;
+    struct event ev[WORKER_EVENTS];
+    unsigned int head, tail;
+    unsigned long lost;
+} events = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+static void
+kick(int fd)
+{
+    uint64_t one = 1;
+
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+static void
+drain_fd(int fd)
+{
+    uint64_t n;
+
+    while (read(fd, &n, sizeof(n)) < 0 && errno == EINTR)
+        ;
+}
+
+/* Take one job, urgent ones first, 0 if both queues are empty */
+static int
+next_job(struct worker *w, struct job *j)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->uhead != w->utail) {
+        *j = w->urgent[w->utail % WORKER_URGENT];
+        w->utail++;
+        pthread_cond_signal(&w->space);
+        ret = 1;
+    }
+    else if (w->head != w->tail) {
+        *j = w->job[w->tail % WORKER_JOBS];
+        w->tail++;
+        pthread_cond_signal(&w->space);
+        ret = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return ret;
+}
+
+/* t = now + ms */
+static void
+deadline(struct timespec *t, unsigned int ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, t);
+    t->tv_sec += ms / 1000;
+    t->tv_nsec += (ms % 1000) * 1000000L;
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Milliseconds from now until t, 0 if that has passed */
+static int
+ms_until(const struct timespec *t)
+{
+    struct timespec now;
+    long ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (t->tv_sec - now.tv_sec) * 1000 + (t->tv_nsec - now.tv_nsec) / 1000000;
+
+    return ms > 0 ? (int)ms : 0;
+}
+
+static void *
+worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct pollfd pfd[1 + BOARD_MAX_IRQS];
+    struct timespec idle_at;
+    struct event ev;
+    struct job j;
+    int stop, timeout, irqs;
+
+    pfd[0].fd = w->wake;
+    pfd[0].events = POLLIN;
+    for (unsigned int i = 0; i < w->nirqs; i++) {
+        pfd[1 + i].fd = w->irq_fd[i];
+        pfd[1 + i].events = POLLPRI | POLLERR;
+    }
+
+    deadline(&idle_at, w->idle_ms);
+
+    for (;;) {
+        timeout = (w->ops->idle && w->idle_ms) ? ms_until(&idle_at) : -1;
+
+        if (poll(pfd, 1 + w->nirqs, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Interrupts first, they may be short circuits */
+        irqs = 0;
+        for (unsigned int i = 0; i < w->nirqs; i++) {
+            if (!pfd[1 + i].revents)
+                continue;
+            irqs++;
+            memset(&ev, 0, sizeof(ev));
+            clock_gettime(CLOCK_MONOTONIC, &ev.ts);
+            ev.irq = w->irq[i];
+            if (w->ops->irq(w->irq[i], &ev) == 0)
+                events_post(&ev);
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            drain_fd(w->wake);
+            while (next_job(w, &j))
+                w->ops->job(w->id, &j);
+
+            pthread_mutex_lock(&w->lock);
+            stop = w->stop && w->head == w->tail && w->uhead == w->utail;
+            pthread_mutex_unlock(&w->lock);
+            if (stop)
+                break;
+        }
+
+        /* Due, and the interrupt lines were quiet this round */
+        if (timeout >= 0 && irqs == 0 && ms_until(&idle_at) == 0) {
+            w->ops->idle(w->id);
+            deadline(&idle_at, w->idle_ms);
+        }
+    }
+
+    return NULL;
+}
+
+int
+worker_start(struct worker *w, unsigned int id, const struct worker_ops *ops, unsigned int idle_ms,
+             const unsigned int *irqs, const int *irq_fds, unsigned int nirqs)
+{
+    sigset_t all, old;
+    int err;
+
+    memset(w, 0, sizeof(*w));
+    w->id = id;
+    w->ops = ops;
+    w->idle_ms = idle_ms;
+    w->nirqs = nirqs;
+    memcpy(w->irq, irqs, sizeof(irqs[0]) * nirqs);
+    memcpy(w->irq_fd, irq_fds, sizeof(irq_fds[0]) * nirqs);
+
+    if ((w->wake = eventfd(0, EFD_CLOEXEC)) < 0)
+        return -1;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->space, NULL);
+
+    /* Signals are for the daemon loop, so they interrupt its select() */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&w->thread, NULL, worker_main, w);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err != 0) {
+        close(w->wake);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->space);
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+worker_push(struct worker *w, const struct job *j)
+{
+    pthread_mutex_lock(&w->lock);
+    if (j->lane == LANE_URGENT) {
+        while (w->uhead - w->utail == WORKER_URGENT)
+            pthread_cond_wait(&w->space, &w->lock);
+        w->urgent[w->uhead % WORKER_URGENT] = *j;
+        w->uhead++;
+
+        /* What it writes, older normal writes must not undo */
+        for (unsigned int i = w->tail; i != w->head && j->type == JOB_WRITE; i++) {
+            struct job *q = &w->job[i % WORKER_JOBS];
+
+            if (q->type == JOB_WRITE && q->exp == j->exp && q->port == j->port)
+                q->mask &= ~j->mask;
+        }
+    }
+    else {
+        while (w->head - w->tail == WORKER_JOBS)
+            pthread_cond_wait(&w->space, &w->lock);
+        w->job[w->head % WORKER_JOBS] = *j;
+        w->head++;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    kick(w->wake);
+}
+
+void
+worker_stop(struct worker *w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_mutex_unlock(&w->lock);
+
+    kick(w->wake);
+    pthread_join(w->thread, NULL);
+
+    close(w->wake);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->space);
+}
+
+int
+events_init(void)
+{
+    if (events.fd < 0 && (events.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+        return -1;
+
+    return 0;
+}
+
+int
+events_fd(void)
+{
+    return events.fd;
+}
+
+/*
+ * Never blocks: the daemon loop may itself be waiting for room in our
+ * job queue. With the queue full, a newer read of the same expanders
+ * replaces the pending one, which is all the daemon would look at.
+ */
+void
+events_post(const struct event *ev)
+{
+    pthread_mutex_lock(&events.lock);
+    if (events.head - events.tail < WORKER_EVENTS) {
+        events.ev[events.head % WORKER_EVENTS] = *ev;
+        events.head++;
+    }
+    else {
+        unsigned int i = events.head;
+
+        while (i != events.tail && (events.ev[(i - 1) % WORKER_EVENTS].irq != ev->irq ||
+                                    events.ev[(i - 1) % WORKER_EVENTS].exps != ev->exps))
+            i--;
+        if (i != events.tail) {
+            struct event *p = &events.ev[(i - 1) % WORKER_EVENTS];
+
+            memcpy(p->exp, ev->exp, sizeof(ev->exp));
+            /* Cutoffs are never dropped */
+            for (unsigned int w = 0; w < BOARD_WORDS; w++)
+                p->tripped[w] |= ev->tripped[w];
+            for (unsigned int e = 0; e < BOARD_MAX_EXPANDERS; e++) {
+                p->cut[e][0] |= ev->cut[e][0];
+                p->cut[e][1] |= ev->cut[e][1];
+            }
+            if (p->cut_ts.tv_sec == 0 && p->cut_ts.tv_nsec == 0)
+                p->cut_ts = ev->cut_ts;
+        }
+        else
+            events.lost++;
+    }
+    pthread_mutex_unlock(&events.lock);
+
+    kick(events.fd);
+}
+
+unsigned long
+events_lost(void)
+{
+    unsigned long n;
+
+    pthread_mutex_lock(&events.lock);
+    n = events.lost;
+    events.lost = 0;
+    pthread_mutex_unlock(&events.lock);
+
+    return n;
+}
+
+static int
+ts_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+size_t
+events_drain(struct event *ev, size_t max)
+{
+    size_t n = 0;
+
+    drain_fd(events.fd);
+
+    pthread_mutex_lock(&events.lock);
+    while (n < max && events.head != events.tail) {
+        ev[n++] = events.ev[events.tail % WORKER_EVENTS];
+        events.tail++;
+    }
+    /* More left than we took, come back */
+    if (events.head != events.tail)
+        kick(events.fd);
+    pthread_mutex_unlock(&events.lock);
+
+    /*
+     * Each worker posts in order, but workers race each other for the
+     * queue. Few events are pending at a time, insertion sort is fine.
+     */
+    for (size_t i = 1; i < n; i++) {
+        struct event t = ev[i];
+        size_t k = i;
+
+        while (k > 0 && ts_before(&t.ts, &ev[k - 1].ts)) {
+            ev[k] = ev[k - 1];
+            k--;
+        }
+        ev[k] = t;
+    }
+
+    return n;
+}
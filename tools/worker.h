@@ -0,0 +1,107 @@
+#ifndef _IOTOOL_WORKER_H
+#define _IOTOOL_WORKER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mcp23017.h"
+#include "board.h"
+
+/*
+ * One thread per I2C bus. A worker owns its bus and the interrupt lines
+ * of the expanders on it: the daemon loop never touches the hardware
+ * while workers run, it queues jobs and consumes events instead. Work on
+ * different buses thus runs in parallel, and a slow transfer or debounce
+ * delay on one bus does not hold up the others.
+ */
+
+#define WORKER_JOBS     64
+#define WORKER_URGENT   16
+#define WORKER_EVENTS   256
+
+enum {
+    JOB_WRITE,          /* set the bits in mask of the latch of port to val */
+    JOB_SAMPLE          /* read the inputs of the bus and post an event */
+};
+
+/*
+ * Urgent jobs (emergency commands, cutoffs) have a queue of their own,
+ * taken before any normal job still queued. Normal writes queued before
+ * an urgent one lose the bits it writes, they are stale by then.
+ */
+enum {
+    LANE_NORMAL,
+    LANE_URGENT,
+    LANES
+};
+
+struct job {
+    uint8_t type;
+    uint8_t exp;
+    uint8_t port;
+    uint8_t mask;
+    uint8_t val;
+    uint8_t lane;
+    struct timespec ts;     /* when the command was read, 0 if none */
+};
+
+/* What a worker read after an interrupt */
+struct event {
+    struct timespec ts;     /* CLOCK_MONOTONIC when the edge was seen */
+    unsigned int irq;       /* BOARD_NO_IRQ for a JOB_SAMPLE read */
+    uint32_t exps;          /* expanders read, bit e */
+    /* INTF, INTCAP and GPIO of the expanders behind irq */
+    struct mcp23017_events exp[BOARD_MAX_EXPANDERS];
+    /* Output channels whose short circuit sense was active */
+    board_bits_t tripped;
+    /* Latch bits the worker already cleared for them, on its own bus */
+    uint8_t cut[BOARD_MAX_EXPANDERS][2];
+    struct timespec cut_ts; /* when that write completed */
+};
+
+struct worker_ops {
+    void (*job)(unsigned int id, const struct job *j);
+    /* Clear the edge on irq and fill in ev->exp. 0 posts the event */
+    int (*irq)(unsigned int irq, struct event *ev);
+    /* Low priority work, run at most every idle_ms and only while no
+     * interrupt is pending. NULL for none */
+    void (*idle)(unsigned int id);
+};
+
+struct worker {
+    pthread_t thread;
+    const struct worker_ops *ops;
+    unsigned int id;                    /* passed to ops->job and ops->idle */
+    unsigned int idle_ms;
+    int wake;                           /* eventfd, jobs queued or stop */
+    unsigned int nirqs;
+    unsigned int irq[BOARD_MAX_IRQS];   /* interrupt lines we own */
+    int irq_fd[BOARD_MAX_IRQS];
+    pthread_mutex_t lock;
+    pthread_cond_t space;
+    struct job job[WORKER_JOBS];
+    unsigned int head, tail;
+    struct job urgent[WORKER_URGENT];
+    unsigned int uhead, utail;
+    int stop;
+};
+
+int worker_start(struct worker *w, unsigned int id, const struct worker_ops *ops, unsigned int idle_ms,
+                 const unsigned int *irqs, const int *irq_fds, unsigned int nirqs);
+/* Queue a job on its lane, blocks while that queue is full */
+void worker_push(struct worker *w, const struct job *j);
+/* Run what is still queued, then stop the thread */
+void worker_stop(struct worker *w);
+
+/* Events of all workers, merged for the daemon loop */
+int events_init(void);
+/* Readable when events are pending */
+int events_fd(void);
+void events_post(const struct event *ev);
+/* Events dropped because the queue was full, since the last call */
+unsigned long events_lost(void);
+/* Take up to max pending events, oldest first by timestamp */
+size_t events_drain(struct event *ev, size_t max);
+
+#endif